@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "alloc.h"
+
+
+mem_account_t mem_accounts[MEM_SUBSYSTEM_COUNT] = {
+	[MEM_MODEL]      = { "model arrays" },
+	[MEM_GL_STAGING] = { "GL staging" },
+	[MEM_PARTICLES]  = { "particle entities" },
+	[MEM_TELEMETRY]  = { "telemetry" },
+	[MEM_SIMULATION] = { "simulation" },
+	[MEM_RENDERER]   = { "renderer" },
+	[MEM_PROGRAMS]   = { "shader programs" }
+};
+
+// Allocations of all threads but background ones since mem_frame_begin()
+static uint64_t mem_frame_allocs[MEM_SUBSYSTEM_COUNT];
+static __thread bool mem_background = false;
+
+// Stored in front of each block so mem_free() knows its size. The union keeps the block aligned like
+// plain malloc().
+typedef union {
+	size_t size;
+	long double align_ld;
+	void *align_ptr;
+} mem_header_t;
+
+
+void mem_track_alloc(mem_subsystem_t subsystem, size_t bytes){
+	mem_account_p account = &mem_accounts[subsystem];
+	__atomic_add_fetch(&account->allocs, 1, __ATOMIC_RELAXED);
+	uint64_t current = __atomic_add_fetch(&account->bytes, bytes, __ATOMIC_RELAXED);
+	uint64_t peak = __atomic_load_n(&account->peak_bytes, __ATOMIC_RELAXED);
+	while ( current > peak && !__atomic_compare_exchange_n(&account->peak_bytes, &peak, current, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+		;
+	if (!mem_background)
+		__atomic_add_fetch(&mem_frame_allocs[subsystem], 1, __ATOMIC_RELAXED);
+}
+
+void mem_track_free(mem_subsystem_t subsystem, size_t bytes){
+	mem_account_p account = &mem_accounts[subsystem];
+	__atomic_add_fetch(&account->frees, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&account->bytes, bytes, __ATOMIC_RELAXED);
+}
+
+
+//
+// Heap wrappers
+//
+
+void* mem_malloc(mem_subsystem_t subsystem, size_t size){
+	mem_header_t *header = malloc(sizeof(mem_header_t) + size);
+	if (header == NULL)
+		return NULL;
+	header->size = size;
+	mem_track_alloc(subsystem, size);
+	return header + 1;
+}
+
+void* mem_calloc(mem_subsystem_t subsystem, size_t count, size_t size){
+	mem_header_t *header = calloc(1, sizeof(mem_header_t) + count * size);
+	if (header == NULL)
+		return NULL;
+	header->size = count * size;
+	mem_track_alloc(subsystem, count * size);
+	return header + 1;
+}
+
+/**
+ * Same as realloc(). Growing or shrinking a block counts as a free of the old and an allocation of the
+ * new one, even if the C library can resize it in place.
+ */
+void* mem_realloc(mem_subsystem_t subsystem, void *ptr, size_t size){
+	if (ptr == NULL)
+		return mem_malloc(subsystem, size);
+	
+	mem_header_t *header = (mem_header_t*)ptr - 1;
+	size_t old_size = header->size;
+	header = realloc(header, sizeof(mem_header_t) + size);
+	if (header == NULL)
+		return NULL;
+	
+	header->size = size;
+	mem_track_free(subsystem, old_size);
+	mem_track_alloc(subsystem, size);
+	return header + 1;
+}
+
+void mem_free(mem_subsystem_t subsystem, void *ptr){
+	if (ptr == NULL)
+		return;
+	mem_header_t *header = (mem_header_t*)ptr - 1;
+	mem_track_free(subsystem, header->size);
+	free(header);
+}
+
+
+//
+// Frame check and report
+//
+
+/**
+ * Excludes the allocations of the calling thread from the frame check. For threads that work
+ * independently of the frames (e.g. the I/O thread loading a model over many frames).
+ */
+void mem_thread_background(){
+	mem_background = true;
+}
+
+void mem_frame_begin(){
+	for(size_t i = 0; i < MEM_SUBSYSTEM_COUNT; i++)
+		__atomic_store_n(&mem_frame_allocs[i], 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * Returns the number of allocations since mem_frame_begin(), made by the calling thread or any other
+ * thread that isn't a background thread (e.g. job workers). With assert_no_allocations the subsystems
+ * that allocated are printed and the program is aborted.
+ */
+uint64_t mem_frame_end(bool assert_no_allocations){
+	uint64_t allocs[MEM_SUBSYSTEM_COUNT], total = 0;
+	for(size_t i = 0; i < MEM_SUBSYSTEM_COUNT; i++){
+		allocs[i] = __atomic_load_n(&mem_frame_allocs[i], __ATOMIC_RELAXED);
+		total += allocs[i];
+	}
+	
+	if (assert_no_allocations && total > 0) {
+		fprintf(stderr, "mem: %" PRIu64 " allocations in a steady state frame:", total);
+		for(size_t i = 0; i < MEM_SUBSYSTEM_COUNT; i++){
+			if (allocs[i])
+				fprintf(stderr, " %s %" PRIu64, mem_accounts[i].name, allocs[i]);
+		}
+		fprintf(stderr, "\n");
+		abort();
+	}
+	return total;
+}
+
+void mem_report(FILE *out){
+	fprintf(out, "%-20s %10s %10s %12s %12s\n", "subsystem", "allocs", "frees", "bytes", "peak bytes");
+	for(size_t i = 0; i < MEM_SUBSYSTEM_COUNT; i++){
+		mem_account_p a = &mem_accounts[i];
+		fprintf(out, "%-20s %10" PRIu64 " %10" PRIu64 " %12" PRIu64 " %12" PRIu64 "\n", a->name, a->allocs, a->frees, a->bytes, a->peak_bytes);
+	}
+}
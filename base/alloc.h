@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/**
+
+Allocation accounting per subsystem. The mem_*alloc() and mem_free() wrappers count allocations and
+bytes for the subsystem they're called for. Memory that doesn't come from the heap (arenas, GL buffers)
+is reported with mem_track_alloc() and mem_track_free(). All functions can be called from any thread.
+
+Frame check: mem_frame_begin() and mem_frame_end() count the allocations made in between by all
+threads, including the job workers (see jobs.h) the frame hands work to. Threads that run
+independently of the frames (I/O, frame encoding) call mem_thread_background() once to be left out.
+The steady state of the main loop (simulating and drawing an unchanged scene) should not
+allocate at all. mem_frame_end(true) reports the subsystems that did and aborts, so regressions show
+up the first time they happen:
+	
+	mem_frame_begin();
+	draw();
+	simulate(dt);
+	mem_frame_end(assert_no_allocations);
+
+*/
+
+typedef enum {
+	MEM_MODEL,  // particle, beam and thruster arrays, edit journal and temporaries of removals
+	MEM_GL_STAGING,  // vertex data uploaded to GL buffers
+	MEM_PARTICLES,  // entities of the particle demo
+	MEM_TELEMETRY,
+	MEM_SIMULATION,  // scratch buffers of the simulation step
+	MEM_RENDERER,  // beam indices and culling data of the renderer
+	MEM_PROGRAMS,  // shader sources, reflection tables and program binaries of common.c
+	MEM_SUBSYSTEM_COUNT
+} mem_subsystem_t;
+
+typedef struct {
+	const char *name;
+	uint64_t allocs, frees;  // a realloc counts as both
+	uint64_t bytes, peak_bytes;  // currently allocated
+} mem_account_t, *mem_account_p;
+
+extern mem_account_t mem_accounts[MEM_SUBSYSTEM_COUNT];
+
+
+void* mem_malloc(mem_subsystem_t subsystem, size_t size);
+void* mem_calloc(mem_subsystem_t subsystem, size_t count, size_t size);
+void* mem_realloc(mem_subsystem_t subsystem, void *ptr, size_t size);
+void mem_free(mem_subsystem_t subsystem, void *ptr);
+
+void mem_track_alloc(mem_subsystem_t subsystem, size_t bytes);
+void mem_track_free(mem_subsystem_t subsystem, size_t bytes);
+
+void mem_thread_background();
+void mem_frame_begin();
+uint64_t mem_frame_end(bool assert_no_allocations);
+
+void mem_report(FILE *out);
@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+
+static size_t arena_round_up(size_t value, size_t multiple){
+	return (value + multiple - 1) / multiple * multiple;
+}
+
+/**
+ * Reserves region_count regions of at least region_size bytes each. Returns NULL if the address space
+ * can't be reserved (e.g. with vm.overcommit_memory = 2), callers should fall back to the heap then.
+ */
+arena_p arena_new(size_t region_count, size_t region_size, int flags){
+	if (region_count < 1 || region_count > ARENA_MAX_REGIONS)
+		return NULL;
+	
+	region_size = arena_round_up(region_size, ARENA_HUGEPAGE_SIZE);
+	size_t size = region_count * region_size;
+	uint8_t *base = MAP_FAILED;
+	
+	if (flags & ARENA_HUGETLB) {
+		base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (base == MAP_FAILED)
+			flags = (flags & ~ARENA_HUGETLB) | ARENA_THP;
+	}
+	
+	if (base == MAP_FAILED) {
+		// Reserve one huge page more than needed so the regions can start at a huge page boundary
+		size_t reserved = size + ARENA_HUGEPAGE_SIZE;
+		uint8_t *mapping = mmap(NULL, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (mapping == MAP_FAILED)
+			return NULL;
+		
+		base = (uint8_t*)arena_round_up((uintptr_t)mapping, ARENA_HUGEPAGE_SIZE);
+		if (base > mapping)
+			munmap(mapping, base - mapping);
+		if (mapping + reserved > base + size)
+			munmap(base + size, mapping + reserved - (base + size));
+	}
+	
+	arena_p arena = calloc(1, sizeof(arena_t));
+	arena->base = base;
+	arena->size = size;
+	arena->region_count = region_count;
+	arena->region_size = region_size;
+	arena->flags = flags;
+	return arena;
+}
+
+void arena_destroy(arena_p arena){
+	if (arena == NULL)
+		return;
+	munmap(arena->base, arena->size);
+	free(arena);
+}
+
+void* arena_region(arena_p arena, size_t region){
+	return arena->base + region * arena->region_size;
+}
+
+/**
+ * Marks the first bytes of a region as used. Returns false if they don't fit into the region.
+ */
+bool arena_commit(arena_p arena, size_t region, size_t bytes){
+	if (bytes > arena->region_size)
+		return false;
+	
+	arena->committed[region] = bytes;
+	if (bytes > arena->high_water[region])
+		arena->high_water[region] = bytes;
+	
+	if ( (arena->flags & ARENA_THP) && !arena->huge[region] && bytes >= ARENA_HUGEPAGE_MIN ) {
+		madvise(arena_region(arena, region), arena->region_size, MADV_HUGEPAGE);
+		arena->huge[region] = true;
+	}
+	return true;
+}
+
+/**
+ * Marks all regions as unused. The pages stay mapped and are reused by the next commits.
+ */
+void arena_reset(arena_p arena){
+	memset(arena->committed, 0, sizeof(arena->committed));
+}
+
+/**
+ * Returns the pages beyond the used part of each region to the system. They read as zero when touched
+ * again.
+ */
+void arena_trim(arena_p arena){
+	// Explicit huge pages stay reserved for the mapping anyway
+	if (arena->flags & ARENA_HUGETLB)
+		return;
+	
+	for(size_t i = 0; i < arena->region_count; i++){
+		size_t keep = arena_round_up(arena->committed[i], arena->huge[i] ? ARENA_HUGEPAGE_SIZE : 4096);
+		if (arena->high_water[i] > keep)
+			madvise((uint8_t*)arena_region(arena, i) + keep, arena->high_water[i] - keep, MADV_DONTNEED);
+		arena->high_water[i] = arena->committed[i];
+	}
+}
+
+
+//
+// Pool
+//
+
+/**
+ * Returns a reset arena from the pool or a new one. NULL if no new arena can be reserved.
+ */
+arena_p arena_pool_get(arena_pool_p pool){
+	pthread_mutex_lock(&pool->lock);
+	arena_p arena = pool->free;
+	if (arena) {
+		pool->free = arena->next;
+		pool->free_count--;
+	}
+	size_t region_count = pool->region_count, region_size = pool->region_size;
+	int flags = pool->flags;
+	pthread_mutex_unlock(&pool->lock);
+	
+	if (arena == NULL)
+		return arena_new(region_count, region_size, flags);
+	arena->next = NULL;
+	return arena;
+}
+
+/**
+ * Releases an arena. It's kept for the next arena_pool_get() unless the pool is full or was configured
+ * differently since the arena was created.
+ */
+void arena_pool_put(arena_pool_p pool, arena_p arena){
+	if (arena == NULL)
+		return;
+	
+	arena_reset(arena);
+	size_t touched = 0;
+	for(size_t i = 0; i < arena->region_count; i++)
+		touched += arena->high_water[i];
+	if (touched > pool->keep_bytes)
+		arena_trim(arena);
+	
+	pthread_mutex_lock(&pool->lock);
+	bool keep = pool->free_count < pool->max_free && arena->region_count == pool->region_count
+		&& arena->region_size == arena_round_up(pool->region_size, ARENA_HUGEPAGE_SIZE)
+		&& (arena->flags & ARENA_HUGETLB) == (pool->flags & ARENA_HUGETLB);
+	if (keep) {
+		arena->next = pool->free;
+		pool->free = arena;
+		pool->free_count++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	
+	if (!keep)
+		arena_destroy(arena);
+}
+
+/**
+ * Changes the size and flags of new arenas and releases the free arenas created with the old ones.
+ */
+void arena_pool_configure(arena_pool_p pool, size_t region_size, int flags){
+	pthread_mutex_lock(&pool->lock);
+	pool->region_size = region_size;
+	pool->flags = flags;
+	pthread_mutex_unlock(&pool->lock);
+	arena_pool_drain(pool);
+}
+
+void arena_pool_drain(arena_pool_p pool){
+	pthread_mutex_lock(&pool->lock);
+	arena_p arena = pool->free;
+	pool->free = NULL;
+	pool->free_count = 0;
+	pthread_mutex_unlock(&pool->lock);
+	
+	while (arena) {
+		arena_p next = arena->next;
+		arena_destroy(arena);
+		arena = next;
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/**
+
+Memory arenas for arrays that live as long as a model. An arena is a single reservation of address
+space split into region_count regions of region_size bytes, one region per array. Pages are only
+backed by memory once they are touched, so the reservation can be far larger than the arrays ever get.
+An array can grow to the size of its region without ever moving.
+
+Regions start at ARENA_HUGEPAGE_SIZE boundaries and are therefore aligned for cache lines and SIMD
+loads. The size of the used part of each region is tracked with arena_commit(). arena_reset() forgets
+it in O(1) and keeps the pages for the next use, arena_trim() gives the pages beyond it back to the
+system.
+
+Huge pages:
+- ARENA_THP asks for transparent huge pages (madvise) once a region gets bigger than
+  ARENA_HUGEPAGE_MIN. Small structures stay on normal pages and don't waste a 2 MiB page per array.
+- ARENA_HUGETLB maps the whole reservation from the explicit huge page pool (/proc/sys/vm/nr_hugepages).
+  Those pages are reserved up front, so region_size has to be small enough to fit into the pool. If
+  the mapping fails the arena falls back to normal pages with ARENA_THP.
+
+A pool keeps up to max_free released arenas around so spawning a structure doesn't have to map and
+fault in fresh memory. Pools can be used from any thread.
+
+*/
+
+#define ARENA_ALIGN 64
+#define ARENA_HUGEPAGE_SIZE (2 * 1024 * 1024)
+#define ARENA_HUGEPAGE_MIN (4 * 1024 * 1024)
+#define ARENA_MAX_REGIONS 4
+
+#define ARENA_THP		(1<<0)
+#define ARENA_HUGETLB	(1<<1)
+
+typedef struct arena_s {
+	uint8_t *base;
+	size_t size, region_count, region_size;
+	int flags;  // ARENA_* flags actually in effect
+	size_t committed[ARENA_MAX_REGIONS];  // bytes in use
+	size_t high_water[ARENA_MAX_REGIONS];  // bytes touched since the last trim
+	bool huge[ARENA_MAX_REGIONS];  // transparent huge pages requested
+	struct arena_s *next;  // next free arena of a pool
+} arena_t, *arena_p;
+
+arena_p arena_new(size_t region_count, size_t region_size, int flags);
+void arena_destroy(arena_p arena);
+void* arena_region(arena_p arena, size_t region);
+bool arena_commit(arena_p arena, size_t region, size_t bytes);
+void arena_reset(arena_p arena);
+void arena_trim(arena_p arena);
+
+
+typedef struct {
+	pthread_mutex_t lock;
+	size_t region_count, region_size;
+	int flags;
+	size_t max_free, keep_bytes;  // arenas that touched more than keep_bytes are trimmed when released
+	arena_p free;
+	size_t free_count;
+} arena_pool_t, *arena_pool_p;
+
+#define ARENA_POOL_INITIALIZER(region_count, region_size, flags, max_free, keep_bytes) \
+	{ PTHREAD_MUTEX_INITIALIZER, (region_count), (region_size), (flags), (max_free), (keep_bytes), NULL, 0 }
+
+arena_p arena_pool_get(arena_pool_p pool);
+void arena_pool_put(arena_pool_p pool, arena_p arena);
+void arena_pool_configure(arena_pool_p pool, size_t region_size, int flags);
+void arena_pool_drain(arena_pool_p pool);
@@ -5,6 +5,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #define __USE_XOPEN 1
 #include <math.h>
 
@@ -16,7 +17,18 @@
 #include "common.h"
 #include "math.h"
 #include "viewport.h"
+#include "renderer.h"
 #include "model.h"
+#include "iothread.h"
+#include "history.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "profile.h"
+#include "sim.h"
+#include "perfcount.h"
+#include "alloc.h"
+#include "jobs.h"
+#include "governor.h"
 
 
 
@@ -38,509 +50,83 @@ Pipeline:
 
 */
 
-// Viewport of the renderer. Data from the viewport is used by other components.
-viewport_p viewport;
-bool debug = false;
 model_p player = NULL;
 
 //
-// Grid
+// Window
 //
-GLuint grid_prog, grid_vertex_buffer;
-// Space between grid lines in world units
-vec2_t grid_default_spacing = {1, 1};
-
-void grid_load(){
-	grid_prog = load_and_link_program("grid.vs", "grid.ps");
-	assert(grid_prog != 0);
-	
-	glGenBuffers(1, &grid_vertex_buffer);
-	assert(grid_vertex_buffer != 0);
-	glBindBuffer(GL_ARRAY_BUFFER, grid_vertex_buffer);
-	
-	// Rectangle
-	const float vertecies[] = {
-		1, 1,
-		-1, 1,
-		-1, -1,
-		1, -1
-	};
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertecies), vertecies, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-}
-
-void grid_unload(){
-	glDeleteBuffers(1, &grid_vertex_buffer);
-	delete_program_and_shaders(grid_prog);
-}
-
-void grid_draw(){
-	vec2_t grid_spacing = (vec2_t){
-		grid_default_spacing.x * viewport->world_to_screen[0],
-		grid_default_spacing.y * viewport->world_to_screen[4]
-	};
-	vec2_t grid_offset = (vec2_t){
-		viewport->pos.x * viewport->world_to_screen[0],
-		viewport->pos.y * viewport->world_to_screen[4]
-	};
-	
-	glUseProgram(grid_prog);
-	glBindBuffer(GL_ARRAY_BUFFER, grid_vertex_buffer);
-	
-	GLint pos_attrib = glGetAttribLocation(grid_prog, "pos");
-	glEnableVertexAttribArray(pos_attrib);
-	glVertexAttribPointer(pos_attrib, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
-	
-	glUniform4f( glGetUniformLocation(grid_prog, "color"), 0, 0, 0.5, 1 );
-	glUniform2f( glGetUniformLocation(grid_prog, "grid_spacing"), grid_spacing.x, grid_spacing.y );
-	glUniform2f( glGetUniformLocation(grid_prog, "grid_offset"), grid_offset.x, grid_offset.y );
-	glUniform1f( glGetUniformLocation(grid_prog, "vp_scale_exp"), viewport->scale_exp );
-	glUniform2f( glGetUniformLocation(grid_prog, "screen_size"), viewport->screen_size.x, viewport->screen_size.y );
-	glDrawArrays(GL_QUADS, 0, 4);
-	
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glUseProgram(0);
-}
-
-
-//
-// Cursor
-//
-vec2_t cursor_pos = {0, 0};
-color_t cursor_color = {1, 1, 1, 1};
-GLuint cursor_prog, cursor_vertex_buffer;
-
-void cursor_load(){
-	cursor_prog = load_and_link_program("cursor.vs", "cursor.ps");
-	assert(cursor_prog != 0);
-	
-	glGenBuffers(1, &cursor_vertex_buffer);
-	assert(cursor_vertex_buffer != 0);
-	glBindBuffer(GL_ARRAY_BUFFER, cursor_vertex_buffer);
-	
-	// Rectangle
-	const float vertecies[] = {
-		5, 5,
-		-5, 5,
-		-5, -5,
-		5, -5
-	};
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertecies), vertecies, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-}
-
-void cursor_unload(){
-	glDeleteBuffers(1, &cursor_vertex_buffer);
-	delete_program_and_shaders(cursor_prog);
-}
-
-void cursor_draw(){
-	//printf("cursor pos: x %f y %f\n", cursor_pos.x, cursor_pos.y);
-	
-	glUseProgram(cursor_prog);
-	glBindBuffer(GL_ARRAY_BUFFER, cursor_vertex_buffer);
-	
-	GLint pos_attrib = glGetAttribLocation(cursor_prog, "pos");
-	glEnableVertexAttribArray(pos_attrib);
-	glVertexAttribPointer(pos_attrib, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
-	
-	GLint cursor_pos_uni = glGetUniformLocation(cursor_prog, "cursor_pos");
-	assert(cursor_pos_uni != -1);
-	glUniform2f(cursor_pos_uni, cursor_pos.x, cursor_pos.y);
-	
-	GLint color_uni = glGetUniformLocation(cursor_prog, "color");
-	assert(color_uni != -1);
-	glUniform4f(color_uni, cursor_color.r, cursor_color.g, cursor_color.b, cursor_color.a);
-	
-	GLint projection_uni = glGetUniformLocation(cursor_prog, "projection");
-	assert(projection_uni != -1);
-	glUniformMatrix3fv(projection_uni , 1, GL_FALSE, viewport->screen_to_normal);
-	
-	glDrawArrays(GL_QUADS, 0, 4);
-	
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glUseProgram(0);
-}
-
-
-//
-// Particles
-//
-GLuint particle_prog, particle_vertex_buffer;
-GLuint beam_prog, beam_vertex_buffer;
-
-void particles_load(){
-	beam_prog = load_and_link_program("unit.vs", "unit.ps");
-	assert(beam_prog != 0);
-	
-	glGenBuffers(1, &beam_vertex_buffer);
-	assert(beam_vertex_buffer != 0);
-	
-	particle_prog = load_and_link_program("particle.vs", "particle.ps");
-	assert(particle_prog != 0);
-	
-	glGenBuffers(1, &particle_vertex_buffer);
-	assert(particle_vertex_buffer != 0);
-	glBindBuffer(GL_ARRAY_BUFFER, particle_vertex_buffer);
-	
-	const float vertecies[] = {
-		// Rectangle
-		0.5, 0.5,
-		-0.5, 0.5,
-		-0.5, -0.5,
-		0.5, -0.5,
-		// Arrow: -->
-		1, 0,
-		0.25, 0.25,
-		0, -1,
-		0.25, -0.25
-	};
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertecies), vertecies, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-}
-
-void particles_unload(){
-	glDeleteBuffers(1, &particle_vertex_buffer);
-	delete_program_and_shaders(particle_prog);
-	
-	glDeleteBuffers(1, &beam_vertex_buffer);
-	delete_program_and_shaders(beam_prog);
+void window_resize(uint16_t width, uint16_t height){
+	SDL_SetVideoMode(width, height, 24, SDL_OPENGL | SDL_RESIZABLE);
+	renderer_resize(width, height);
 }
 
-void particles_draw(){
-	// Draw particles
-	glUseProgram(particle_prog);
-	glBindBuffer(GL_ARRAY_BUFFER, particle_vertex_buffer);
-	
-	GLint pos_attrib = glGetAttribLocation(particle_prog, "pos");
-	assert(pos_attrib != -1);
-	glEnableVertexAttribArray(pos_attrib);
-	glVertexAttribPointer(pos_attrib, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
-	
-	GLint color_uni = glGetUniformLocation(particle_prog, "color");
-	GLint to_norm_uni = glGetUniformLocation(particle_prog, "to_norm");
-	GLint trans_uni = glGetUniformLocation(particle_prog, "transform");
-	assert(color_uni != -1);
-	assert(to_norm_uni != -1);
-	assert(trans_uni != -1);
-	
-	glUniformMatrix3fv(to_norm_uni, 1, GL_FALSE, viewport->world_to_normal);
-	
-	for(size_t i = 0; i < player->particle_count; i++){
-		glUniformMatrix3fv(trans_uni, 1, GL_TRUE, (float[9]){
-			0.25, 0, player->particles[i].pos.x,
-			0, 0.25, player->particles[i].pos.y,
-			0, 0, 1
-		});
-		
-		if (player->particles[i].flags & PARTICLE_SELECTED)
-			glUniform4f(color_uni, 1, 0, 0, 1 );
-		else
-			glUniform4f(color_uni, 0, 1, 0, 1 );
-		
-		glDrawArrays(GL_QUADS, 0, 4);
-	}
-	
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glUseProgram(0);
-	
-	
-	// Draw beams
-	glUseProgram(beam_prog);
-	glBindBuffer(GL_ARRAY_BUFFER, beam_vertex_buffer);
-	
-	size_t unbroken_beam_count = 0;
-	for(size_t i = 0; i < player->beam_count; i++){
-		if ( !(player->beams[i].flags & BEAM_BROKEN) )
-			unbroken_beam_count++;
-	}
-	
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 4 * unbroken_beam_count, NULL, GL_STATIC_DRAW);
-	float *vertex_buffer = glMapBuffer(GL_ARRAY_BUFFER, GL_READ_WRITE);
-	size_t vi = 0;
-	for(size_t i = 0; i < player->beam_count; i++){
-		beam_p b = &player->beams[i];
-		
-		if (b->flags & BEAM_BROKEN)
-			continue;
-		
-		vertex_buffer[vi*4+0] = player->particles[b->i1].pos.x;
-		vertex_buffer[vi*4+1] = player->particles[b->i1].pos.y;
-		vertex_buffer[vi*4+2] = player->particles[b->i2].pos.x;
-		vertex_buffer[vi*4+3] = player->particles[b->i2].pos.y;
-		vi++;
-	}
-	glUnmapBuffer(GL_ARRAY_BUFFER);
-	
-	pos_attrib = glGetAttribLocation(beam_prog, "pos");
-	assert(pos_attrib != -1);
-	glEnableVertexAttribArray(pos_attrib);
-	glVertexAttribPointer(pos_attrib, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
-	
-	glUniform4f( glGetUniformLocation(beam_prog, "color"), 1, 1, 1, 1 );
-	glUniformMatrix3fv( glGetUniformLocation(beam_prog, "to_norm"), 1, GL_FALSE, viewport->world_to_normal);
-	
-	glDrawArrays(GL_LINES, 0, unbroken_beam_count * 2);
-	
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glUseProgram(0);
-}
-
-
-//
-// Thruster
-//
-GLuint thruster_prog, thruster_vertex_buffer;
-
-void thrusters_load(){
-	thruster_prog = load_and_link_program("thruster.vs", "thruster.ps");
-	assert(thruster_prog != 0);
-	
-	glGenBuffers(1, &thruster_vertex_buffer);
-	assert(thruster_vertex_buffer != 0);
-	glBindBuffer(GL_ARRAY_BUFFER, thruster_vertex_buffer);
-	
-	const float vertecies[] = {
-		0.5, 0.125,
-		-0.5, 0.25,
-		-0.5, -0.25,
-		0.5, -0.125
-	};
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertecies), vertecies, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-}
-
-void thrusters_unload(){
-	glDeleteBuffers(1, &thruster_vertex_buffer);
-	delete_program_and_shaders(thruster_prog);
-}
-
-void thrusters_draw(){
-	// Draw particles
-	glUseProgram(thruster_prog);
-	glBindBuffer(GL_ARRAY_BUFFER, thruster_vertex_buffer);
-	
-	GLint pos_attrib = glGetAttribLocation(thruster_prog, "pos");
-	assert(pos_attrib != -1);
-	glEnableVertexAttribArray(pos_attrib);
-	glVertexAttribPointer(pos_attrib, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
-	
-	GLint color_uni = glGetUniformLocation(thruster_prog, "color");
-	GLint to_norm_uni = glGetUniformLocation(thruster_prog, "to_norm");
-	GLint trans_uni = glGetUniformLocation(thruster_prog, "transform");
-	assert(color_uni != -1);
-	assert(to_norm_uni != -1);
-	assert(trans_uni != -1);
-	
-	glUniformMatrix3fv(to_norm_uni, 1, GL_FALSE, viewport->world_to_normal);
-	
-	for(size_t i = 0; i < player->thruster_count; i++){
-		thruster_p thruster = &player->thrusters[i];
-		
-		vec2_t p1_to_p2 = v2_sub(player->particles[thruster->i2].pos, player->particles[thruster->i1].pos);
-		vec2_t pos = v2_add(player->particles[thruster->i1].pos, v2_muls(p1_to_p2, 0.5));
-		float rad = atan2f(p1_to_p2.y, p1_to_p2.x);
-		float s = sin(rad), c = cos(rad);
-		
-		glUniformMatrix3fv(trans_uni, 1, GL_TRUE, (float[9]){
-			c, -s, pos.x,
-			s, c, pos.y,
-			0, 0, 1
-		});
-		
-		if (thruster->controlled_by & THRUSTER_BACK)
-			glUniform4f(color_uni, 1, 1, 1, 1);
-		else if (thruster->controlled_by & THRUSTER_FRONT)
-			glUniform4f(color_uni, 0.5, 0.5, 0.5, 1);
-		else if (thruster->controlled_by & THRUSTER_LEFT)
-			glUniform4f(color_uni, 0.5, 0, 0, 1);
-		else
-			glUniform4f(color_uni, 0, 0.5, 0, 1);
-		
-		glDrawArrays(GL_QUADS, 0, 4);
-	}
-	
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glUseProgram(0);
+void window_load(uint16_t width, uint16_t height, const char *title){
+	SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+	SDL_WM_SetCaption(title, NULL);
+	SDL_SetVideoMode(width, height, 24, SDL_OPENGL | SDL_RESIZABLE);
+	renderer_load(width, height);
 }
 
 
-
-
 //
-// Renderer
+// Simulation (interaction)
 //
-void renderer_resize(uint16_t window_width, uint16_t window_height){
-	SDL_SetVideoMode(window_width, window_height, 24, SDL_OPENGL | SDL_RESIZABLE);
-	glViewport(0, 0, window_width, window_height);
-	vp_screen_changed(viewport, window_width, window_height);
-}
-
-void renderer_load(uint16_t window_width, uint16_t window_height, const char *title){
-	// Create window
-	SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
-	SDL_WM_SetCaption(title, NULL);
-	
-	// Initialize viewport structure
-	viewport = vp_new((vec2_t){10, 10}, 2);
-	renderer_resize(window_width, window_height);
+void sim_apply_force(){
+	vec2_t world_cursor = m3_v2_mul(viewport->screen_to_world, cursor_pos);
 	
-	// Enable alpha blending
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	// Find nearest particle
+	closest_particle_t cp = sim_nearest_particle(player, world_cursor);
 	
-	glEnable(GL_LINE_SMOOTH);
-	glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
-}
-
-void renderer_unload(){
-	vp_destroy(viewport);
+	sim_grabbed_particle_idx = cp.index;
+	sim_grabbed_force = cp.to_particle;
 }
 
-void renderer_draw(){
-	glClearColor(0, 0, 0, 1.0);
-	glClear(GL_COLOR_BUFFER_BIT);
-	
-	grid_draw();
-	particles_draw();
-	thrusters_draw();
-	cursor_draw();
+void sim_retain_force(){
+	sim_grabbed_particle_idx = -1;
+	sim_grabbed_force = (vec2_t){0, 0};
 }
 
 
 //
-// Simulation
+// Rewind
 //
-ssize_t sim_grabbed_particle_idx = -1;
-vec2_t sim_grabbed_force = {0, 0};
-uint8_t sim_enabled_thrusters = 0;
-bool sim_turbo = false;
+history_p history = NULL;
+// Frame shown while scrubbing through the history, -1 if not scrubbing
+ssize_t history_frame = -1;
 
 /**
- * dt in seconds.
+ * Moves frames back (negative) or forward through the recorded history and shows that state. The
+ * simulation has to be paused while scrubbing.
  */
-void simulate(float dt){
-	if (debug) printf("step with dt %fs\n", dt);
-	
-	//for(size_t i = 0; i < player->particle_count; i++)
-	//	player->particles[i].force = (vec2_t){0, 0};
-	
-	if (sim_grabbed_particle_idx != -1)
-		player->particles[sim_grabbed_particle_idx].force = v2_add(player->particles[sim_grabbed_particle_idx].force, v2_muls(sim_grabbed_force, 10));
-	
-	// Iterate over all thrusters and apply the thruster force to all connected particles
-	if (debug) printf("  thrusters: %02x\n", sim_enabled_thrusters);
-	for(size_t i = 0; i < player->thruster_count; i++){
-		thruster_p t = &player->thrusters[i];
-		//if (debug) printf("  thruster: cb %02x, et %2x result %d\n", t->controlled_by, sim_enabled_thrusters, (sim_enabled_thrusters & t->controlled_by));
-		if ( !(sim_enabled_thrusters & t->controlled_by) )
-			continue;
-		
-		vec2_t force_dir = v2_norm( v2_sub(player->particles[t->i2].pos, player->particles[t->i1].pos) );
-		float force_mag = t->force;
-		// Turbo only for main thrusters. Otherwise turbo rotation tares the ship apart for sure.
-		if (sim_turbo && (t->controlled_by & THRUSTER_BACK))
-			force_mag *= 5;
-		vec2_t force = v2_muls(force_dir, force_mag);
-		
-		player->particles[t->i1].force = v2_add(player->particles[t->i1].force, force);
-		player->particles[t->i2].force = v2_add(player->particles[t->i2].force, force);
-	}
-	
-	
-	// Iterate all beams and calculate the forces they exert on the particles
-	float modulus_of_elasticity = player->modulus_of_elasticity; // 210e3; // 210e9; // N_m2 (elastic modulus of steel)
-	float beam_profile_area = player->beam_profile_area; // m2
-	float deform_threshold = player->deform_threshold; // m
-	float break_threshold = player->break_threshold; // m
-	for(size_t i = 0; i < player->beam_count; i++){
-		beam_p beam = &player->beams[i];
-		
-		if (beam->flags & BEAM_BROKEN)
-			continue;
-		
-		vec2_t p1_to_p2 = v2_sub(player->particles[beam->i2].pos, player->particles[beam->i1].pos);
-		float p1_to_p2_len = v2_length(p1_to_p2);
-		
-		float dilatation = beam->length - p1_to_p2_len;
-		float spring_constant = (modulus_of_elasticity * beam_profile_area) / beam->length;
-		float force = spring_constant * dilatation;
-		if (debug) printf("  beam %8.2f m, dl %6.2f m, force: %8.2f N", beam->length, dilatation, force);
-		
-		if (dilatation > break_threshold) {
-			beam->flags |= BEAM_BROKEN;
-			continue;
-		} else if (dilatation > deform_threshold) {
-			beam->length -= force / (modulus_of_elasticity * beam_profile_area) * beam->length;
-			if (beam->length < 0)
-				beam->length = 0;
-			if (debug) printf(" deformed to %8.2f m (force %8.2f N)", beam->length, force);
-		}
-		if (debug) printf("\n");
-		
-		vec2_t p1_to_p2_norm = v2_divs(p1_to_p2, p1_to_p2_len);
-		player->particles[beam->i1].force = v2_add(player->particles[beam->i1].force, v2_muls(p1_to_p2_norm, -force));
-		player->particles[beam->i2].force = v2_add(player->particles[beam->i2].force, v2_muls(p1_to_p2_norm, force));
-	}
-	
-	// Iterate over all particles to advance to the next time step. Delete all forces afterwards.
-	for(size_t i = 0; i < player->particle_count; i++){
-		/*
-		a = f / m;
-		v = v + a * dt;
-		s = s + v * dt;
-		*/
-		particle_p p = &player->particles[i];
-		
-		vec2_t acl;
-		acl.x = p->force.x / p->mass;
-		acl.y = p->force.y / p->mass;
-		p->vel.x += acl.x * dt;
-		p->vel.y += acl.y * dt;
-		p->pos.x += p->vel.x * dt;
-		p->pos.y += p->vel.y * dt;
-		
-		p->force = (vec2_t){0, 0};
-	}
+void history_scrub(ssize_t frames){
+	ssize_t frame_count = hist_frame_count(history);
+	if (frame_count == 0)
+		return;
+	
+	if (history_frame == -1)
+		history_frame = frame_count - 1;
+	history_frame += frames;
+	if (history_frame < 0)
+		history_frame = 0;
+	else if (history_frame > frame_count - 1)
+		history_frame = frame_count - 1;
+	
+	if ( hist_restore(history, history_frame, player) )
+		printf("rewind: %zd of %zd frames, %zu KiB used\n", history_frame - (frame_count - 1), frame_count, hist_bytes_used(history) / 1024);
 }
 
-typedef struct  {
-	particle_p particle;
-	size_t index;
-	float dist;
-	vec2_t to_particle;
-} closest_particle_t;
-
-closest_particle_t sim_nearest_particle(vec2_t pos){
-	size_t closest_idx = 0;
-	float closest_dist = INFINITY;
-	vec2_t to_closest;
-	for(size_t i = 0; i < player->particle_count; i++){
-		vec2_t to_particle = v2_sub(player->particles[i].pos, pos);
-		float dist = v2_length(to_particle);
-		if (dist < closest_dist){
-			closest_idx = i;
-			closest_dist = dist;
-			to_closest = to_particle;
-		}
+/**
+ * Simulates one step and records it. When the history was scrubbed the simulation continues from the
+ * shown frame and all frames after it are dropped.
+ */
+void history_step(float dt){
+	if (history_frame != -1){
+		hist_resume(history, history_frame);
+		history_frame = -1;
 	}
 	
-	return (closest_particle_t){ &player->particles[closest_idx], closest_idx, closest_dist, to_closest };
-}
-
-void sim_apply_force(){
-	vec2_t world_cursor = m3_v2_mul(viewport->screen_to_world, cursor_pos);
-	
-	// Find nearest particle
-	closest_particle_t cp = sim_nearest_particle(world_cursor);
-	
-	sim_grabbed_particle_idx = cp.index;
-	sim_grabbed_force = cp.to_particle;
-}
-
-void sim_retain_force(){
-	sim_grabbed_particle_idx = -1;
-	sim_grabbed_force = (vec2_t){0, 0};
+	simulate_rigid(player, dt);
+	hist_record(history, player);
 }
 
 
@@ -557,33 +143,63 @@ int main(int argc, char **argv){
 	uint32_t cycle_duration = 10.0; //1.0 / 60.0 * 1000;
 	uint16_t win_w = 640, win_h = 480;
 	
+	const char *title = "Grid";
+	
+	// Set TRACE to also trace startup (e.g. shader reflection)
+	trace_enabled = (getenv("TRACE") != NULL);
+	// Set PROFILE to a .csv or .json file to export the phase timings on exit
+	const char *profile_file = getenv("PROFILE");
+	// Set PERFCOUNT to print hardware counters per simulation phase on exit
+	perfcount_p perfcount = getenv("PERFCOUNT") ? pc_open() : NULL;
+	// Set MEMSTATS to print the allocations per subsystem on exit, MEM_ASSERT to abort as soon as the
+	// steady state part of a frame (drawing and simulation without input) allocates
+	bool mem_stats = (getenv("MEMSTATS") != NULL), mem_assert = (getenv("MEM_ASSERT") != NULL);
+	// Set JOBS to the number of threads that simulate (default one per CPU), JOB_PIN to pin them to CPUs
+	job_start(getenv("JOBS") ? strtoul(getenv("JOBS"), NULL, 10) : 0, getenv("JOB_PIN") != NULL);
+	for(size_t i = 1; perfcount && i < job_thread_count(); i++)
+		pc_attach(perfcount, job_thread_id(i));
+	// Set PROGRAM_CACHE to a directory to cache linked shader programs in (e.g. program_cache next to
+	// the shaders), without it every start compiles them
+	program_cache_dir = getenv("PROGRAM_CACHE");
+	// Set HUGEPAGES to the MiB per model array to take from the explicit huge page pool
+	if ( getenv("HUGEPAGES") )
+		arena_pool_configure(&model_arena_pool, strtoull(getenv("HUGEPAGES"), NULL, 10) * 1024 * 1024, ARENA_HUGETLB);
+	
 	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER);
-	renderer_load(win_w, win_h, "Grid");
+	window_load(win_w, win_h, title);
+	io_start();
 	
-	grid_load();
-	cursor_load();
-	particles_load();
-	thrusters_load();
+	overlay_budget_ms = cycle_duration;
+	// Set NO_GOVERNOR to always draw at full quality, the steps still follow real time
+	governor_t governor;
+	gov_init(&governor, cycle_duration, getenv("NO_GOVERNOR") == NULL);
 	
 	player = model_new();
 	model_load(player, argv[1]);
 	
+	// Keep the last 10 seconds, keyframe every second
+	history = hist_new(64 * 1024 * 1024, 10 * 1000 / cycle_duration, 1000 / cycle_duration);
+	
 	SDL_Event e;
 	bool quit = false, viewport_grabbed = false, paused = false, follow = false;
-	uint32_t ticks = SDL_GetTicks();
 	
 	prog_mode_t mode = MODE_SIM;
 	ssize_t selected_particles_idx[2] = {-1};
 	float default_thruster_force = 10;
+	int load_percent = -1;
+	// Frames since the last input or load, the first ones may still allocate (e.g. to grow buffers)
+	uint32_t steady_frames = 0;
 	
 	while (!quit) {
 		while ( SDL_PollEvent(&e) ) {
+			if (e.type != SDL_MOUSEMOTION)
+				steady_frames = 0;
 			switch(e.type){
 				case SDL_QUIT:
 					quit = true;
 					break;
 				case SDL_VIDEORESIZE:
-					renderer_resize(e.resize.w, e.resize.h);
+					window_resize(e.resize.w, e.resize.h);
 					break;
 				case SDL_KEYDOWN:
 					switch(e.key.keysym.sym){
@@ -630,16 +246,24 @@ int main(int argc, char **argv){
 								printf("continuing simulation\n");
 							break;
 						case SDLK_l:
-							// If shift is pressed load the save file mesh, otherwise the load file mesh
-							if ( (e.key.keysym.mod & KMOD_RSHIFT) || (e.key.keysym.mod & KMOD_LSHIFT) )
-								model_load(player, save_mesh);
-							else
-								model_load(player, argv[1]);
-							selected_particles_idx[0] = -1;
-							selected_particles_idx[1] = -1;
+							// If shift is pressed load the save file mesh, otherwise the load file mesh. The new model is
+							// swapped in once the I/O thread is done.
+							if ( (e.key.keysym.mod & KMOD_RSHIFT) || (e.key.keysym.mod & KMOD_LSHIFT) ) {
+								if ( io_load(save_mesh) )
+									load_percent = 0;
+								else
+									printf("still busy with last load or save\n");
+							} else {
+								if ( io_load(argv[1]) )
+									load_percent = 0;
+								else
+									printf("still busy with last load or save\n");
+							}
 							break;
 						case SDLK_k:
-							model_save(player, save_mesh);
+							// Appending to the journal is cheap, full saves are done by the I/O thread
+							if ( !model_sync_journal(player, save_mesh) && !io_save(player, save_mesh) )
+								printf("still busy with last load or save\n");
 							break;
 						case SDLK_m:
 							if (mode == MODE_EDIT) {
@@ -669,11 +293,40 @@ int main(int argc, char **argv){
 						case SDLK_f:
 							follow = !follow;
 							break;
-						case SDLK_v:  // verbose / debugging
-							debug = !debug;
+						case SDLK_v:  // verbose / debugging, record trace events and export them when done
+							trace_enabled = !trace_enabled;
+							if (trace_enabled) {
+								trace_clear();
+								printf("tracing enabled\n");
+							} else {
+								trace_export_json("trace.json");
+							}
+							break;
+						case SDLK_t:  // record telemetry of every step
+							if (sim_telemetry) {
+								tlm_close(sim_telemetry);
+								sim_telemetry = NULL;
+							} else {
+								sim_telemetry = tlm_open("telemetry.bin", TLM_BEAM_STRAIN | TLM_BEAM_FORCE | TLM_PARTICLE_ENERGY, 1, true);
+								if (sim_telemetry)
+									printf("recording telemetry to telemetry.bin\n");
+							}
 							break;
 						case SDLK_c:
-							simulate(cycle_duration / 1000.0);
+							history_step(cycle_duration / 1000.0);
+							break;
+						case SDLK_p:  // profiler overlay, print the phase timings when shown
+							overlay_visible = !overlay_visible;
+							if (overlay_visible)
+								overlay_print();
+							break;
+						case SDLK_LEFT: case SDLK_RIGHT:
+							// Scrub through the history, 0.1s per press or 1s with shift
+							paused = true;
+							{
+								ssize_t frames = ( (e.key.keysym.mod & KMOD_RSHIFT) || (e.key.keysym.mod & KMOD_LSHIFT) ) ? 1000 / cycle_duration : 100 / cycle_duration;
+								history_scrub( (e.key.keysym.sym == SDLK_LEFT) ? -frames : frames );
+							}
 							break;
 						case SDLK_a:
 							if (mode == MODE_EDIT) {
@@ -754,7 +407,7 @@ int main(int argc, char **argv){
 						case SDL_BUTTON_LEFT:
 							if (mode == MODE_EDIT) {
 								vec2_t world_cursor = m3_v2_mul(viewport->screen_to_world, cursor_pos);
-								closest_particle_t cp = sim_nearest_particle(world_cursor);
+								closest_particle_t cp = sim_nearest_particle(player, world_cursor);
 								
 								if (selected_particles_idx[0] == -1) {
 									selected_particles_idx[0] = cp.index;
@@ -823,28 +476,89 @@ int main(int argc, char **argv){
 			}
 		}
 		
-		if (follow){
-			viewport->pos = model_particle_center(player);
-			vp_changed(viewport);
+		// Pick up finished loads and saves between frames
+		io_job_p job = io_done();
+		if (job) {
+			steady_frames = 0;
+			if (job->op == IO_LOAD) {
+				if (job->model) {
+					model_destroy(player);
+					player = job->model;
+					job->model = NULL;
+					selected_particles_idx[0] = -1;
+					selected_particles_idx[1] = -1;
+					sim_retain_force();
+					hist_reset(history);
+					history_frame = -1;
+				} else {
+					printf("failed to load %s\n", job->filename);
+				}
+				load_percent = -1;
+				SDL_WM_SetCaption(title, NULL);
+			} else if (job->op == IO_SAVE && job->origin == player && job->generation != 0) {
+				model_journal_attach(player, job->filename, job->generation);
+			}
+			io_job_destroy(job);
+		}
+		
+		if (load_percent != -1 && (int)(io_progress() * 100) != load_percent) {
+			load_percent = io_progress() * 100;
+			char caption[64];
+			snprintf(caption, sizeof(caption), "%s - loading %d%%", title, load_percent);
+			SDL_WM_SetCaption(caption, NULL);
 		}
 		
-		renderer_draw();
-		SDL_GL_SwapBuffers();
-		if (mode == MODE_SIM && !paused)
-			simulate(cycle_duration / 1000.0);
+		mem_frame_begin();
+		// Simulate the steps that are due before drawing, so the input of this frame shows right away.
+		// While paused the due steps are skipped.
+		uint32_t steps = gov_steps_due(&governor, prof_now());
+		if (mode != MODE_SIM || paused)
+			steps = 0;
+		uint64_t sim_start = prof_now();
+		for(uint32_t i = 0; i < steps; i++)
+			history_step(cycle_duration / 1000.0);
 		
-		int32_t duration = cycle_duration - (SDL_GetTicks() - ticks);
-		if (duration > 0)
-			SDL_Delay(duration);
-		ticks = SDL_GetTicks();
+		uint64_t draw_start = prof_now();
+		bool draw = gov_render_due(&governor);
+		if (draw) {
+			if (follow){
+				viewport->pos = model_particle_center(player);
+				vp_changed(viewport);
+			}
+			
+			renderer_draw(player);
+			prof_begin(PROF_DRAW_SWAP);
+			SDL_GL_SwapBuffers();
+			prof_end(PROF_DRAW_SWAP);
+		}
+		uint64_t draw_end = prof_now();
+		mem_frame_end(mem_assert && steady_frames++ >= 2);
+		gov_frame(&governor, steps, draw_start - sim_start, draw, draw_end - draw_start);
+		
+		// Sleep until the next step is due, rounded up so the next frame has at least one step
+		uint64_t now = prof_now();
+		if (governor.next_step > now)
+			SDL_Delay((governor.next_step - now + 999999) / 1000000);
 	}
 	
 	// Cleanup time
+	io_stop();
+	job_stop();
+	if (trace_enabled)
+		trace_export_json("trace.json");
+	if (profile_file)
+		prof_export(profile_file);
+	if (perfcount) {
+		pc_report(perfcount, stdout, sim_step);
+		pc_close(perfcount);
+	}
+	if (sim_telemetry)
+		tlm_close(sim_telemetry);
+	if (mem_stats)
+		mem_report(stdout);
+	hist_destroy(history);
 	model_destroy(player);
-	thrusters_unload();
-	particles_unload();
-	cursor_unload();
-	grid_unload();
+	arena_pool_drain(&model_arena_pool);
 	renderer_unload();
 	
 	SDL_Quit();
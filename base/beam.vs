@@ -0,0 +1,18 @@
+#version 120
+#extension GL_ARB_uniform_buffer_object : require
+
+// Per frame data of the renderer, see frame_uniforms_t in renderer.c
+layout(std140) uniform frame_uniforms {
+	mat3 world_to_normal;
+	mat3 screen_to_normal;
+	vec2 screen_size;
+	float scale_exp;
+};
+
+// vertex position in world space
+attribute vec2 pos;
+
+void main(){
+	gl_Position.xyz = world_to_normal * vec3(pos, 1);
+	gl_Position.w = 1;
+}
\ No newline at end of file
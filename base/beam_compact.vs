@@ -0,0 +1,25 @@
+#version 120
+#extension GL_ARB_uniform_buffer_object : require
+
+// Per frame data of the renderer, see frame_uniforms_t in renderer.c
+layout(std140) uniform frame_uniforms {
+	mat3 world_to_normal;
+	mat3 screen_to_normal;
+	vec2 screen_size;
+	float scale_exp;
+};
+
+// Origin (xy) and size (zw) of each tile in world space, see TILE_FRAMES_MAX in renderer.c
+layout(std140) uniform tile_frames {
+	vec4 tile_frame[1024];
+};
+
+// vertex position relative to the frame of its tile and the tile index
+attribute vec2 pos;
+attribute float tile;
+
+void main(){
+	vec4 frame = tile_frame[int(tile)];
+	gl_Position.xyz = world_to_normal * vec3(frame.xy + pos * frame.zw, 1);
+	gl_Position.w = 1;
+}
\ No newline at end of file
@@ -0,0 +1,379 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+
+#include "model.h"
+#include "sim.h"
+#include "rigid.h"
+#include "meshgen.h"
+#include "renderer.h"
+#include "offscreen.h"
+#include "profile.h"
+#include "jobs.h"
+
+/*
+
+Micro and macro benchmarks of the simulation, loading/saving and rendering over the mesh size.
+	
+	benchmark [--record file] [--compare file] [--threshold percent] [--max-particles n] [--threads n] [--no-render]
+
+Every benchmark is calibrated to run at least BENCH_SAMPLE_NS per sample and reports the median of
+BENCH_SAMPLES samples in ns per operation. --record writes the results as baseline, --compare fails
+(exit code 1) if a result is more than threshold percent (default 10) slower than in the baseline.
+
+The multithreaded simulation step runs with 1, 2, 4, ... threads up to the number of CPUs (or
+--threads), the thread count is part of the key in the baseline.
+
+Workloads are triangular lattices from meshgen. Rendering goes to an offscreen framebuffer of a
+surfaceless EGL context (Mesa's llvmpipe without a GPU), every draw is followed by glFinish() so the
+time includes the rasterization.
+
+*/
+
+#define BENCH_SAMPLES 5
+#define BENCH_SAMPLE_NS 20000000
+#define BENCH_MAX_RESULTS 256
+// Steps times particles at most to get the islands of the simulate_rigid benchmark rigid
+#define BENCH_RIGID_WARMUP 20000000
+
+typedef struct {
+	char name[48];
+	size_t size, threads;
+	double ns_per_op;
+} bench_result_t, *bench_result_p;
+
+bench_result_t bench_results[BENCH_MAX_RESULTS];
+size_t bench_result_count = 0;
+
+typedef void (*bench_func_t)(void *data);
+
+
+static int bench_compare_double(const void *a, const void *b){
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static void bench_report(const char *name, size_t size, size_t threads, double ns_per_op){
+	printf("%-24s %10zu %3zu %14.0f ns/op %10.2f ns/particle\n", name, size, threads, ns_per_op, ns_per_op / size);
+	fflush(stdout);
+	
+	if (bench_result_count < BENCH_MAX_RESULTS) {
+		bench_result_p r = &bench_results[bench_result_count++];
+		snprintf(r->name, sizeof(r->name), "%s", name);
+		r->size = size;
+		r->threads = threads;
+		r->ns_per_op = ns_per_op;
+	}
+}
+
+/**
+ * Runs func until a sample takes at least BENCH_SAMPLE_NS and returns the median time per call in ns.
+ */
+static double bench_measure(bench_func_t func, void *data){
+	uint64_t iterations = 1;
+	while (true) {
+		uint64_t start = prof_now();
+		for(uint64_t i = 0; i < iterations; i++)
+			func(data);
+		uint64_t elapsed = prof_now() - start;
+		if (elapsed >= BENCH_SAMPLE_NS / 4 || iterations >= (1ull << 30))
+			break;
+		iterations *= (elapsed > 0) ? 4 : 16;
+	}
+	iterations *= 4;
+	
+	double samples[BENCH_SAMPLES];
+	for(size_t s = 0; s < BENCH_SAMPLES; s++){
+		uint64_t start = prof_now();
+		for(uint64_t i = 0; i < iterations; i++)
+			func(data);
+		samples[s] = (double)(prof_now() - start) / iterations;
+	}
+	qsort(samples, BENCH_SAMPLES, sizeof(double), bench_compare_double);
+	return samples[BENCH_SAMPLES / 2];
+}
+
+static void bench_run(const char *name, size_t size, bench_func_t func, void *data){
+	bench_report(name, size, job_thread_count(), bench_measure(func, data));
+}
+
+// model_load() and model_save() print each call, keep that out of the report
+static int bench_stdout = -1;
+
+static void bench_quiet(bool quiet){
+	fflush(stdout);
+	if (quiet) {
+		bench_stdout = dup(STDOUT_FILENO);
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		close(null);
+	} else if (bench_stdout != -1) {
+		dup2(bench_stdout, STDOUT_FILENO);
+		close(bench_stdout);
+		bench_stdout = -1;
+	}
+}
+
+
+//
+// Workloads
+//
+typedef struct {
+	model_p model;
+	const char *filename;
+	vec2_t pos;
+} bench_data_t, *bench_data_p;
+
+static void bench_simulate(void *data){
+	simulate( ((bench_data_p)data)->model, 10 / 1000.0 );
+}
+
+static void bench_simulate_jobs(void *data){
+	simulate_jobs( ((bench_data_p)data)->model, 10 / 1000.0 );
+}
+
+static void bench_simulate_rigid(void *data){
+	simulate_rigid( ((bench_data_p)data)->model, 10 / 1000.0 );
+}
+
+static bool bench_all_rigid(model_p model){
+	return model->rigid != NULL && model->rigid->rigid_island_count == model->rigid->island_count;
+}
+
+static void bench_nearest_particle(void *data){
+	bench_data_p d = data;
+	volatile size_t index = sim_nearest_particle(d->model, d->pos).index;
+	(void)index;
+}
+
+static void bench_particle_center(void *data){
+	volatile vec2_t center = model_particle_center( ((bench_data_p)data)->model );
+	(void)center;
+}
+
+static void bench_load(void *data){
+	bench_data_p d = data;
+	model_load(d->model, d->filename);
+}
+
+static void bench_save(void *data){
+	bench_data_p d = data;
+	model_save(d->model, d->filename);
+}
+
+static void bench_draw_grid(void *data){
+	(void)data;
+	grid_draw();
+	glFinish();
+}
+
+static void bench_draw_particles(void *data){
+	renderer_upload( ((bench_data_p)data)->model );
+	particles_draw( ((bench_data_p)data)->model );
+	glFinish();
+}
+
+static void bench_draw_thrusters(void *data){
+	renderer_upload( ((bench_data_p)data)->model );
+	thrusters_draw( ((bench_data_p)data)->model );
+	glFinish();
+}
+
+static void bench_draw_cursor(void *data){
+	(void)data;
+	cursor_draw();
+	glFinish();
+}
+
+static void bench_draw_frame(void *data){
+	renderer_draw( ((bench_data_p)data)->model );
+	glFinish();
+}
+
+
+//
+// Baseline
+//
+
+static bool bench_record(const char *filename){
+	FILE *f = fopen(filename, "w");
+	if (f == NULL) {
+		perror("fopen");
+		return false;
+	}
+	
+	fprintf(f, "# name size threads ns_per_op\n");
+	for(size_t i = 0; i < bench_result_count; i++)
+		fprintf(f, "%s %zu %zu %.1f\n", bench_results[i].name, bench_results[i].size, bench_results[i].threads, bench_results[i].ns_per_op);
+	
+	fclose(f);
+	printf("recorded baseline %s\n", filename);
+	return true;
+}
+
+/**
+ * Returns the number of regressions. Benchmarks missing in the baseline are ignored.
+ */
+static size_t bench_compare(const char *filename, double threshold){
+	FILE *f = fopen(filename, "r");
+	if (f == NULL) {
+		printf("no baseline %s, record one with --record\n", filename);
+		return 0;
+	}
+	
+	size_t regressions = 0;
+	char line[256], name[48];
+	size_t size, threads;
+	double baseline;
+	printf("\ncompared to %s (threshold %.0f%%):\n", filename, threshold);
+	while ( fgets(line, sizeof(line), f) != NULL ) {
+		if ( line[0] == '#' || sscanf(line, "%47s %zu %zu %lf", name, &size, &threads, &baseline) != 4 )
+			continue;
+		
+		for(size_t i = 0; i < bench_result_count; i++){
+			bench_result_p r = &bench_results[i];
+			if ( strcmp(r->name, name) != 0 || r->size != size || r->threads != threads )
+				continue;
+			
+			double change = (r->ns_per_op / baseline - 1) * 100;
+			bool regressed = (change > threshold);
+			if (regressed)
+				regressions++;
+			printf("%-24s %10zu %3zu %+7.1f%%%s\n", name, size, threads, change, regressed ? "  REGRESSION" : "");
+		}
+	}
+	
+	fclose(f);
+	printf("%zu regressions\n", regressions);
+	return regressions;
+}
+
+
+int main(int argc, char **argv){
+	const char *record = NULL, *compare = NULL;
+	double threshold = 10;
+	size_t max_particles = 1000000;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t max_threads = (cpus > 0) ? cpus : 1;
+	bool render = true;
+	
+	for(int i = 1; i < argc; i++){
+		if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+			record = argv[++i];
+		else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc)
+			compare = argv[++i];
+		else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+			threshold = strtod(argv[++i], NULL);
+		else if (strcmp(argv[i], "--max-particles") == 0 && i + 1 < argc)
+			max_particles = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+			max_threads = strtoull(argv[++i], NULL, 10);
+		else if (strcmp(argv[i], "--no-render") == 0)
+			render = false;
+		else {
+			fprintf(stderr, "usage: %s [--record file] [--compare file] [--threshold percent] [--max-particles n] [--threads n] [--no-render]\n", argv[0]);
+			return 1;
+		}
+	}
+	
+	if ( render && !offscreen_init(640, 480) ) {
+		printf("no offscreen GL context, skipping render benchmarks\n");
+		render = false;
+	}
+	if (render) {
+		renderer_load(640, 480);
+		prof_enabled = false;
+	}
+	
+	const char *filename = "bench.tmp.mesh";
+	printf("%-24s %10s %3s %20s\n", "benchmark", "particles", "thr", "time");
+	
+	for(size_t size = 1000; size <= max_particles; size *= 10){
+		mg_params_t params = mg_defaults(MG_LATTICE);
+		mg_size_for(&params, size);
+		bench_data_t data = { .model = mg_generate(&params), .filename = filename };
+		size_t particles = data.model->particle_count;
+		data.pos = model_particle_center(data.model);
+		
+		// Whole step and its phases, the phase times are the means of the profiler window
+		prof_enabled = true;
+		prof_reset();
+		bench_run("simulate", particles, bench_simulate, &data);
+		const char *phase_names[] = { "simulate/grab", "simulate/thrusters", "simulate/beams", "simulate/integration" };
+		for(size_t p = PROF_SIM_GRAB; p <= PROF_SIM_INTEGRATION; p++)
+			bench_report(phase_names[p - PROF_SIM_GRAB], particles, 1, prof_stats(p).mean * 1e6);
+		prof_enabled = false;
+		
+		for(size_t threads = 1; threads <= max_threads; threads *= 2){
+			job_start(threads, false);
+			bench_run("simulate_jobs", particles, bench_simulate_jobs, &data);
+			job_stop();
+		}
+		// Ship cruising at 5 m/s with its main thrusters on. It runs on a copy that is stepped until its
+		// islands are rigid, the other benchmarks keep the model in place. Large lattices don't get there
+		// within BENCH_RIGID_WARMUP and are timed as soft.
+		bench_data_t rigid_data = { .model = model_snapshot(data.model) };
+		for(size_t i = 0; i < rigid_data.model->particle_count; i++)
+			rigid_data.model->particles[i].vel = (vec2_t){ 5, 0 };
+		sim_enabled_thrusters = THRUSTER_BACK;
+		for(size_t step = 0; step * particles < BENCH_RIGID_WARMUP && !bench_all_rigid(rigid_data.model); step++)
+			simulate_rigid(rigid_data.model, 10 / 1000.0);
+		bench_run(bench_all_rigid(rigid_data.model) ? "simulate_rigid" : "simulate_rigid/soft", particles, bench_simulate_rigid, &rigid_data);
+		sim_enabled_thrusters = 0;
+		model_destroy(rigid_data.model);
+		
+		bench_run("nearest_particle", particles, bench_nearest_particle, &data);
+		bench_run("particle_center", particles, bench_particle_center, &data);
+		
+		// Files and draw calls get expensive quickly, stay at 100k particles unless asked for more
+		if (size <= 100000 || max_particles > 1000000) {
+			bench_quiet(true);
+			model_save(data.model, filename);
+			bench_quiet(false);
+			
+			model_p loaded = model_new();
+			bench_data_t io_data = { .model = loaded, .filename = filename };
+			bench_quiet(true);
+			double load_ns = bench_measure(bench_load, &io_data);
+			double save_ns = bench_measure(bench_save, &io_data);
+			bench_quiet(false);
+			bench_report("model_load", particles, 1, load_ns);
+			bench_report("model_save", particles, 1, save_ns);
+			model_destroy(loaded);
+			unlink(filename);
+		}
+		
+		if ( render && (size <= 100000 || max_particles > 1000000) ) {
+			viewport->pos = model_particle_center(data.model);
+			vp_changed(viewport);
+			bench_run("draw/grid", particles, bench_draw_grid, &data);
+			bench_run("draw/particles+beams", particles, bench_draw_particles, &data);
+			renderer_compact_streams = true;
+			bench_run("draw/compact", particles, bench_draw_particles, &data);
+			renderer_compact_streams = false;
+			bench_run("draw/thrusters", particles, bench_draw_thrusters, &data);
+			bench_run("draw/cursor", particles, bench_draw_cursor, &data);
+			bench_run("draw/frame", particles, bench_draw_frame, &data);
+		}
+		
+		model_destroy(data.model);
+	}
+	
+	if (render) {
+		renderer_unload();
+		offscreen_destroy();
+	}
+	
+	if (record)
+		bench_record(record);
+	if (compare && bench_compare(compare, threshold) > 0)
+		return 1;
+	return 0;
+}
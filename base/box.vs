@@ -0,0 +1,26 @@
+#version 120
+#extension GL_ARB_uniform_buffer_object : require
+
+// Per frame data of the renderer, see frame_uniforms_t in renderer.c
+layout(std140) uniform frame_uniforms {
+	mat3 world_to_normal;
+	mat3 screen_to_normal;
+	vec2 screen_size;
+	float scale_exp;
+};
+
+// vertex of the quad, one box per instance (lower left and upper right corner in world space and
+// color)
+attribute vec2 pos;
+attribute vec4 instance_corners;
+attribute vec4 instance_color;
+
+varying vec4 color;
+
+void main(){
+	vec2 center = (instance_corners.xy + instance_corners.zw) * 0.5;
+	vec2 size = instance_corners.zw - instance_corners.xy;
+	gl_Position.xyz = world_to_normal * vec3(center + pos * size, 1);
+	gl_Position.w = 1;
+	color = instance_color;
+}
\ No newline at end of file
@@ -0,0 +1,285 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+
+#include "capture.h"
+#include "alloc.h"
+
+
+// Readbacks in flight, used round robin
+typedef struct {
+	GLuint buffer;
+	GLsync fence;
+	uint64_t frame;
+} cap_readback_t;
+
+// Queue of frames for the encoder thread. The main thread owns the entries outside of head..count,
+// the encoder the entry at head while count > 0.
+typedef struct {
+	uint8_t *pixels;  // RGBA, bottom row first like glReadPixels()
+	uint64_t frame;
+} cap_entry_t;
+
+static char *cap_pattern = NULL;
+static bool cap_png;
+static uint16_t cap_width, cap_height;
+static uint64_t cap_frame_count, cap_errors;
+
+static cap_readback_t cap_readbacks[CAP_PIXEL_BUFFERS];
+static size_t cap_next_readback;
+
+static pthread_t cap_thread;
+static pthread_mutex_t cap_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cap_cond = PTHREAD_COND_INITIALIZER;
+static cap_entry_t cap_queue[CAP_QUEUE_SIZE];
+static size_t cap_head, cap_count;
+static bool cap_quit;
+
+
+//
+// Encoder
+//
+
+static void cap_png_chunk(FILE *f, const char *type, const uint8_t *data, size_t length){
+	uint8_t header[8] = { length >> 24, length >> 16, length >> 8, length, type[0], type[1], type[2], type[3] };
+	uint32_t crc = crc32(0, header + 4, 4);
+	// crc32() with a NULL buffer returns the initial value instead of continuing the checksum
+	if (length > 0)
+		crc = crc32(crc, data, length);
+	uint8_t footer[4] = { crc >> 24, crc >> 16, crc >> 8, crc };
+	fwrite(header, 1, sizeof(header), f);
+	if (length > 0)
+		fwrite(data, 1, length, f);
+	fwrite(footer, 1, sizeof(footer), f);
+}
+
+/**
+ * Writes an RGB PNG. Each row uses the "up" filter (difference to the row above), most of a frame is
+ * background or repeats the row above and compresses well that way. Compression uses the fastest zlib
+ * level, the encoder has to keep up with the renderer.
+ */
+static bool cap_write_png(FILE *f, const uint8_t *pixels){
+	size_t row_size = 1 + cap_width * 3;
+	size_t raw_size = row_size * cap_height;
+	uint8_t *raw = malloc(raw_size);
+	uLongf compressed_size = compressBound(raw_size);
+	uint8_t *compressed = malloc(compressed_size);
+	if (raw == NULL || compressed == NULL) {
+		free(raw);
+		free(compressed);
+		return false;
+	}
+	
+	for(size_t y = 0; y < cap_height; y++){
+		// glReadPixels() starts with the bottom row, PNG with the top one
+		const uint8_t *src = pixels + (cap_height - 1 - y) * cap_width * 4;
+		const uint8_t *above = pixels + (cap_height - y) * cap_width * 4;
+		uint8_t *dst = raw + y * row_size;
+		dst[0] = (y == 0) ? 0 : 2;
+		for(size_t x = 0; x < cap_width; x++){
+			for(size_t c = 0; c < 3; c++)
+				dst[1 + x*3 + c] = (y == 0) ? src[x*4 + c] : src[x*4 + c] - above[x*4 + c];
+		}
+	}
+	bool compressed_ok = (compress2(compressed, &compressed_size, raw, raw_size, Z_BEST_SPEED) == Z_OK);
+	
+	if (compressed_ok) {
+		const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+		const uint8_t ihdr[13] = {
+			cap_width >> 24, cap_width >> 16, cap_width >> 8, cap_width,
+			cap_height >> 24, cap_height >> 16, cap_height >> 8, cap_height,
+			8, 2, 0, 0, 0  // 8 bit, RGB, deflate, adaptive filtering, no interlace
+		};
+		fwrite(signature, 1, sizeof(signature), f);
+		cap_png_chunk(f, "IHDR", ihdr, sizeof(ihdr));
+		cap_png_chunk(f, "IDAT", compressed, compressed_size);
+		cap_png_chunk(f, "IEND", NULL, 0);
+	}
+	
+	free(raw);
+	free(compressed);
+	return compressed_ok;
+}
+
+static bool cap_write_ppm(FILE *f, const uint8_t *pixels){
+	uint8_t *row = malloc(cap_width * 3);
+	if (row == NULL)
+		return false;
+	
+	fprintf(f, "P6 %u %u 255\n", cap_width, cap_height);
+	for(size_t y = 0; y < cap_height; y++){
+		const uint8_t *src = pixels + (cap_height - 1 - y) * cap_width * 4;
+		for(size_t x = 0; x < cap_width; x++)
+			memcpy(row + x*3, src + x*4, 3);
+		fwrite(row, 1, cap_width * 3, f);
+	}
+	
+	free(row);
+	return true;
+}
+
+static void* cap_thread_main(void *arg){
+	(void)arg;
+	mem_thread_background();
+	pthread_mutex_lock(&cap_mutex);
+	while (true) {
+		while (cap_count == 0 && !cap_quit)
+			pthread_cond_wait(&cap_cond, &cap_mutex);
+		if (cap_count == 0 && cap_quit)
+			break;
+		
+		cap_entry_t *entry = &cap_queue[cap_head];
+		pthread_mutex_unlock(&cap_mutex);
+		
+		char filename[1024];
+		snprintf(filename, sizeof(filename), cap_pattern, (unsigned long)entry->frame);
+		FILE *f = fopen(filename, "wb");
+		bool written = false;
+		if (f) {
+			written = cap_png ? cap_write_png(f, entry->pixels) : cap_write_ppm(f, entry->pixels);
+			written = (fclose(f) == 0) && written;
+		}
+		if (!written)
+			perror(filename);
+		
+		pthread_mutex_lock(&cap_mutex);
+		if (!written)
+			cap_errors++;
+		cap_head = (cap_head + 1) % CAP_QUEUE_SIZE;
+		cap_count--;
+		pthread_cond_broadcast(&cap_cond);
+	}
+	pthread_mutex_unlock(&cap_mutex);
+	
+	return NULL;
+}
+
+
+//
+// Readback
+//
+
+/**
+ * Waits until the readback is done and queues its pixels for the encoder. Waits for the encoder if the
+ * queue is full.
+ */
+static void cap_collect(cap_readback_t *readback){
+	glClientWaitSync(readback->fence, GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+	glDeleteSync(readback->fence);
+	readback->fence = NULL;
+	
+	pthread_mutex_lock(&cap_mutex);
+	while (cap_count == CAP_QUEUE_SIZE)
+		pthread_cond_wait(&cap_cond, &cap_mutex);
+	cap_entry_t *entry = &cap_queue[(cap_head + cap_count) % CAP_QUEUE_SIZE];
+	pthread_mutex_unlock(&cap_mutex);
+	
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->buffer);
+	const void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (size_t)cap_width * cap_height * 4, GL_MAP_READ_BIT);
+	if (pixels) {
+		memcpy(entry->pixels, pixels, (size_t)cap_width * cap_height * 4);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	entry->frame = readback->frame;
+	
+	pthread_mutex_lock(&cap_mutex);
+	if (pixels) {
+		cap_count++;
+		pthread_cond_broadcast(&cap_cond);
+	} else {
+		cap_errors++;
+	}
+	pthread_mutex_unlock(&cap_mutex);
+}
+
+/**
+ * Starts writing frames of width x height pixels to files named by pattern (see capture.h). Returns
+ * false if memory for the queue isn't available.
+ */
+bool cap_start(const char *pattern, uint16_t width, uint16_t height){
+	const char *extension = strrchr(pattern, '.');
+	cap_png = !(extension && strcasecmp(extension, ".ppm") == 0);
+	cap_pattern = strdup(pattern);
+	cap_width = width;
+	cap_height = height;
+	cap_frame_count = cap_errors = 0;
+	
+	for(size_t i = 0; i < CAP_QUEUE_SIZE; i++){
+		cap_queue[i].pixels = malloc((size_t)width * height * 4);
+		if (cap_queue[i].pixels == NULL) {
+			for(size_t j = 0; j < i; j++)
+				free(cap_queue[j].pixels);
+			free(cap_pattern);
+			cap_pattern = NULL;
+			return false;
+		}
+	}
+	cap_head = cap_count = 0;
+	
+	for(size_t i = 0; i < CAP_PIXEL_BUFFERS; i++){
+		glGenBuffers(1, &cap_readbacks[i].buffer);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, cap_readbacks[i].buffer);
+		glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)width * height * 4, NULL, GL_STREAM_READ);
+		cap_readbacks[i].fence = NULL;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	cap_next_readback = 0;
+	
+	cap_quit = false;
+	pthread_create(&cap_thread, NULL, cap_thread_main, NULL);
+	return true;
+}
+
+/**
+ * Starts the readback of the current framebuffer. The buffer used for it is collected first if it's
+ * still in flight, that's the frame CAP_PIXEL_BUFFERS frames ago, so the GPU usually finished it long
+ * before.
+ */
+void cap_frame(){
+	cap_readback_t *readback = &cap_readbacks[cap_next_readback];
+	if (readback->fence)
+		cap_collect(readback);
+	
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback->buffer);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, cap_width, cap_height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	readback->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	readback->frame = cap_frame_count++;
+	
+	cap_next_readback = (cap_next_readback + 1) % CAP_PIXEL_BUFFERS;
+}
+
+/**
+ * Collects the readbacks still in flight, waits until the encoder wrote everything and stops it.
+ * Returns the number of frames that couldn't be read back or written.
+ */
+uint64_t cap_stop(){
+	for(size_t i = 0; i < CAP_PIXEL_BUFFERS; i++){
+		cap_readback_t *readback = &cap_readbacks[(cap_next_readback + i) % CAP_PIXEL_BUFFERS];
+		if (readback->fence)
+			cap_collect(readback);
+		glDeleteBuffers(1, &readback->buffer);
+	}
+	
+	pthread_mutex_lock(&cap_mutex);
+	cap_quit = true;
+	pthread_cond_broadcast(&cap_cond);
+	pthread_mutex_unlock(&cap_mutex);
+	pthread_join(cap_thread, NULL);
+	
+	for(size_t i = 0; i < CAP_QUEUE_SIZE; i++){
+		free(cap_queue[i].pixels);
+		cap_queue[i].pixels = NULL;
+	}
+	free(cap_pattern);
+	cap_pattern = NULL;
+	return cap_errors;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+
+Writes rendered frames to image files without stalling the renderer. cap_frame() starts an
+asynchronous readback of the current framebuffer into one of CAP_PIXEL_BUFFERS pixel buffer objects and
+returns. Readbacks the GPU finished are handed to an encoder thread that writes them as PNG or raw PPM
+(P6) files, depending on the extension of the file name pattern:
+	
+	cap_start("frames/%06lu.png", width, height);
+	for(...){
+		renderer_draw(model);
+		cap_frame();
+	}
+	cap_stop();
+
+The pattern gets the frame number (counting from 0) as unsigned long. The encoder works through a queue
+of CAP_QUEUE_SIZE frames, cap_frame() only waits when the encoder falls that far behind. cap_stop()
+writes all outstanding frames and returns the number of frames that couldn't be written.
+
+*/
+
+#define CAP_PIXEL_BUFFERS 3
+#define CAP_QUEUE_SIZE 8
+
+bool cap_start(const char *pattern, uint16_t width, uint16_t height);
+void cap_frame();
+uint64_t cap_stop();
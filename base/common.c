@@ -1,113 +1,375 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
 
-#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <fcntl.h>
 #include <unistd.h>
 
 #define GL_GLEXT_PROTOTYPES
 #include <GL/gl.h>
 
+#include "common.h"
+#include "trace.h"
+#include "alloc.h"
+
+
+// Directory of the program binary cache, NULL or "" disables it
+const char *program_cache_dir = NULL;
+
+bool gl_extension_supported(const char *name){
+	GLint extension_count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extension_count);
+	for(GLint i = 0; i < extension_count; i++){
+		if ( strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0 )
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Destorys the specified program and all shaders attached to it.
+ */
+void delete_program_and_shaders(GLuint program){
+	GLint shader_count = 0;
+	glGetProgramiv(program, GL_ATTACHED_SHADERS, &shader_count);
+	
+	GLuint shaders[shader_count];
+	glGetAttachedShaders(program, shader_count, NULL, shaders);
+	
+	glDeleteProgram(program);
+	for(GLint i = 0; i < shader_count; i++)
+		glDeleteShader(shaders[i]);
+}
+
+
+//
+// Program binary cache
+//
+
+// Cache files are named after the hash of both shader sources and the driver strings. A driver update
+// changes the hash, a binary the driver still rejects is compiled again.
+#define PROGRAM_CACHE_MAGIC 0x31475250  // "PRG1"
+
+typedef struct {
+	uint32_t magic;
+	uint32_t format;  // binary format of glGetProgramBinary()
+	uint64_t hash;
+	uint32_t length;  // bytes of binary data after the header
+} program_cache_header_t;
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size){
+	for(size_t i = 0; i < size; i++)
+		hash = (hash ^ ((const uint8_t*)data)[i]) * 0x100000001b3;
+	return hash;
+}
+
+static uint64_t program_hash(program_p program){
+	uint64_t hash = 0xcbf29ce484222325;
+	const GLenum driver_strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION };
+	for(size_t i = 0; i < sizeof(driver_strings) / sizeof(driver_strings[0]); i++){
+		const char *text = (const char*)glGetString(driver_strings[i]);
+		hash = fnv1a(hash, text, strlen(text) + 1);
+	}
+	hash = fnv1a(hash, program->vertex_source, program->vertex_source_size);
+	hash = fnv1a(hash, "", 1);
+	hash = fnv1a(hash, program->fragment_source, program->fragment_source_size);
+	return hash;
+}
+
+static bool program_cache_enabled(){
+	if (program_cache_dir == NULL || program_cache_dir[0] == '\0')
+		return false;
+	GLint format_count = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+	return (format_count > 0);
+}
 
 /**
- * Loads and compiles a source code file as a shader.
- * 
- * Returns the shaders GL object id on success or 0 on error.
+ * Creates program->id from a cached binary. Returns false if there is none, the link status tells
+ * if the driver accepted it.
  */
-GLint create_and_compile_shader(GLenum shader_type, const char *filename){
-	int fd = open(filename, O_RDONLY, 0);
-	struct stat file_stat;
-	fstat(fd, &file_stat);
-	char *code = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+static bool program_cache_load(program_p program){
+	char path[1024];
+	snprintf(path, sizeof(path), "%s/%016" PRIx64 ".bin", program_cache_dir, program->hash);
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		return false;
 	
-	GLint shader = glCreateShader(shader_type);
-	glShaderSource(shader, 1, (const char*[]){ code }, (const int[]){ file_stat.st_size });
+	program_cache_header_t header;
+	void *binary = NULL;
+	bool loaded = false;
+	if ( fread(&header, sizeof(header), 1, f) == 1 && header.magic == PROGRAM_CACHE_MAGIC && header.hash == program->hash ) {
+		binary = mem_malloc(MEM_PROGRAMS, header.length);
+		if ( binary && fread(binary, header.length, 1, f) == 1 ) {
+			program->id = glCreateProgram();
+			glProgramBinary(program->id, header.format, binary, header.length);
+			loaded = true;
+		}
+	}
 	
-	munmap(code, file_stat.st_size);
-	close(fd);
+	mem_free(MEM_PROGRAMS, binary);
+	fclose(f);
+	return loaded;
+}
+
+/**
+ * Writes the binary of a freshly linked program into the cache. Other processes might read the cache
+ * at the same time, so the file is written under a temporary name and renamed when complete.
+ */
+static void program_cache_save(program_p program){
+	GLint length = 0;
+	glGetProgramiv(program->id, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
 	
-	glCompileShader(shader);
+	program_cache_header_t header = { .magic = PROGRAM_CACHE_MAGIC, .hash = program->hash };
+	void *binary = mem_malloc(MEM_PROGRAMS, length);
+	GLsizei written = 0;
+	glGetProgramBinary(program->id, length, &written, &header.format, binary);
+	header.length = written;
 	
-	GLint result = GL_TRUE;
-	glGetShaderiv(shader, GL_COMPILE_STATUS, &result);
-	if (result == GL_FALSE){
-		char buffer[1024];
-		glGetShaderInfoLog(shader, 1024, NULL, buffer);
-		printf("shader compilation of %s failed:\n%s\n", filename, buffer);
-		return 0;
+	if ( mkdir(program_cache_dir, 0755) == -1 && errno != EEXIST ) {
+		trace_text(TRACE_INFO, "program cache", "can't create %s", program_cache_dir);
+		mem_free(MEM_PROGRAMS, binary);
+		return;
+	}
+	
+	char path[1024], temp_path[1100];
+	snprintf(path, sizeof(path), "%s/%016" PRIx64 ".bin", program_cache_dir, program->hash);
+	snprintf(temp_path, sizeof(temp_path), "%s.%d.tmp", path, getpid());
+	FILE *f = fopen(temp_path, "wb");
+	if (f) {
+		bool complete = ( fwrite(&header, sizeof(header), 1, f) == 1 && fwrite(binary, written, 1, f) == 1 );
+		complete = (fclose(f) == 0) && complete;
+		if ( !complete || rename(temp_path, path) != 0 )
+			unlink(temp_path);
+	}
+	mem_free(MEM_PROGRAMS, binary);
+}
+
+
+//
+// Programs with cached locations
+//
+
+static char* program_read_source(const char *filename, size_t *size){
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL) {
+		fprintf(stderr, "can't read shader %s\n", filename);
+		return NULL;
+	}
+	
+	fseek(f, 0, SEEK_END);
+	*size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char *source = mem_malloc(MEM_PROGRAMS, *size + 1);
+	if ( fread(source, 1, *size, f) != *size ) {
+		mem_free(MEM_PROGRAMS, source);
+		source = NULL;
+	} else {
+		source[*size] = '\0';
 	}
+	fclose(f);
+	return source;
+}
+
+/**
+ * Starts to compile and link the shaders of program without waiting for the result. With parallel
+ * shader compilation the driver works on it in the background.
+ */
+static void program_compile(program_p program){
+	GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(vertex_shader, 1, (const char*[]){ program->vertex_source }, (const int[]){ program->vertex_source_size });
+	glCompileShader(vertex_shader);
 	
-	return shader;
+	GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(fragment_shader, 1, (const char*[]){ program->fragment_source }, (const int[]){ program->fragment_source_size });
+	glCompileShader(fragment_shader);
+	
+	program->id = glCreateProgram();
+	glAttachShader(program->id, vertex_shader);
+	glAttachShader(program->id, fragment_shader);
+	if (program->cached)
+		glProgramParameteri(program->id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(program->id);
 }
 
+/**
+ * Prints the info log of a failed compile or link.
+ */
+static void program_print_errors(program_p program){
+	GLint shader_count = 0;
+	glGetProgramiv(program->id, GL_ATTACHED_SHADERS, &shader_count);
+	GLuint shaders[shader_count];
+	glGetAttachedShaders(program->id, shader_count, NULL, shaders);
+	
+	char buffer[1024];
+	for(GLint i = 0; i < shader_count; i++){
+		GLint result = GL_TRUE, type = 0;
+		glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &result);
+		glGetShaderiv(shaders[i], GL_SHADER_TYPE, &type);
+		if (result == GL_FALSE){
+			glGetShaderInfoLog(shaders[i], sizeof(buffer), NULL, buffer);
+			fprintf(stderr, "shader compilation of %s failed:\n%s\n", (type == GL_VERTEX_SHADER) ? program->vertex_shader_filename : program->fragment_shader_filename, buffer);
+		}
+	}
+	
+	glGetProgramInfoLog(program->id, sizeof(buffer), NULL, buffer);
+	fprintf(stderr, "vertex and pixel shader linking faild:\n%s\n", buffer);
+}
 
-GLuint load_and_link_program(const char *vertex_shader_filename, const char *fragment_shader_filename){
-	// Load shaders
-	GLint vertex_shader = create_and_compile_shader(GL_VERTEX_SHADER, vertex_shader_filename);
-	GLint pixel_shader = create_and_compile_shader(GL_FRAGMENT_SHADER, fragment_shader_filename);
-	assert(vertex_shader != 0 && pixel_shader != 0);
+/**
+ * Creates a program from a vertex and a fragment shader file. The program is taken from the binary
+ * cache if possible, otherwise its shaders are compiled and linked. This function doesn't wait for the
+ * driver: create all programs first, then call program_finish() for each, so drivers with parallel
+ * shader compilation work on all of them at once. The filenames have to stay valid until the program
+ * is finished.
+ *
+ * Returns NULL if a shader file can't be read.
+ */
+program_p program_create(const char *vertex_shader_filename, const char *fragment_shader_filename){
+	static bool compiler_threads_set = false;
+	if (!compiler_threads_set) {
+		if ( gl_extension_supported("GL_KHR_parallel_shader_compile") )
+			glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+		else if ( gl_extension_supported("GL_ARB_parallel_shader_compile") )
+			glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+		compiler_threads_set = true;
+	}
 	
-	GLint prog = glCreateProgram();
-	glAttachShader(prog, vertex_shader);
-	glAttachShader(prog, pixel_shader);
-	glLinkProgram(prog);
+	program_p program = mem_calloc(MEM_PROGRAMS, 1, sizeof(program_t));
+	program->vertex_shader_filename = vertex_shader_filename;
+	program->fragment_shader_filename = fragment_shader_filename;
+	program->vertex_source = program_read_source(vertex_shader_filename, &program->vertex_source_size);
+	program->fragment_source = program_read_source(fragment_shader_filename, &program->fragment_source_size);
+	if (program->vertex_source == NULL || program->fragment_source == NULL) {
+		mem_free(MEM_PROGRAMS, program->vertex_source);
+		mem_free(MEM_PROGRAMS, program->fragment_source);
+		mem_free(MEM_PROGRAMS, program);
+		return NULL;
+	}
+	
+	program->cached = program_cache_enabled();
+	if (program->cached) {
+		program->hash = program_hash(program);
+		program->from_cache = program_cache_load(program);
+	}
+	if (!program->from_cache)
+		program_compile(program);
 	
+	return program;
+}
+
+/**
+ * Waits until the program is linked and stores the locations and types of all its active attributes
+ * and uniforms. Draw code looks up the locations it needs once with program_attrib() and
+ * program_uniform() when it's loaded, not by name every frame. A freshly linked program is written to
+ * the binary cache.
+ *
+ * Returns false if compiling or linking failed, the errors are printed.
+ */
+bool program_finish(program_p program){
 	GLint result = GL_TRUE;
-	glGetProgramiv(prog, GL_LINK_STATUS, &result);
+	glGetProgramiv(program->id, GL_LINK_STATUS, &result);
+	if (result == GL_FALSE && program->from_cache) {
+		// Driver rejected the cached binary
+		trace_text(TRACE_INFO, "program cache", "%s %s: stale binary", program->vertex_shader_filename, program->fragment_shader_filename);
+		glDeleteProgram(program->id);
+		program->from_cache = false;
+		program_compile(program);
+		glGetProgramiv(program->id, GL_LINK_STATUS, &result);
+	}
+	
+	mem_free(MEM_PROGRAMS, program->vertex_source);
+	mem_free(MEM_PROGRAMS, program->fragment_source);
+	program->vertex_source = program->fragment_source = NULL;
+	
 	if (result == GL_FALSE){
-		char buffer[1024];
-		glGetProgramInfoLog(prog, 1024, NULL, buffer);
-		printf("vertex and pixel shader linking faild:\n%s\n", buffer);
-		glDeleteShader(vertex_shader);
-		glDeleteShader(pixel_shader);
-		return 0;
+		program_print_errors(program);
+		return false;
 	}
 	
-	printf("compiled program %s %s\n", vertex_shader_filename, fragment_shader_filename);
+	trace_text(TRACE_INFO, "program", "%s %s %s", program->vertex_shader_filename, program->fragment_shader_filename,
+		program->from_cache ? "from cache" : "compiled");
+	if (program->cached && !program->from_cache)
+		program_cache_save(program);
 	
-	// Enum attribs
 	GLint active_attrib_count = 0;
-	glGetProgramiv(prog, GL_ACTIVE_ATTRIBUTES, &active_attrib_count);
-	printf("%d attribs:\n", active_attrib_count);
-	for(size_t i = 0; i < active_attrib_count; i++){
-		char buffer[512];
-		GLint size;
-		GLenum type;
-		glGetActiveAttrib(prog, i, 512, NULL, &size, &type, buffer);
-		printf("- \"%s\": size %d, type %d\n", buffer, size, type);
+	glGetProgramiv(program->id, GL_ACTIVE_ATTRIBUTES, &active_attrib_count);
+	trace_text(TRACE_VERBOSE, "program", "%s %s: %d attribs", program->vertex_shader_filename, program->fragment_shader_filename, active_attrib_count);
+	program->attribs = mem_calloc(MEM_PROGRAMS, active_attrib_count, sizeof(program_var_t));
+	for(GLint i = 0; i < active_attrib_count; i++){
+		program_var_p var = &program->attribs[program->attrib_count++];
+		glGetActiveAttrib(program->id, i, sizeof(var->name), NULL, &var->size, &var->type, var->name);
+		var->location = glGetAttribLocation(program->id, var->name);
+		trace_text(TRACE_VERBOSE, "attrib", "%s: size %d, type %d, location %d", var->name, var->size, var->type, var->location);
 	}
 	
-	// Enum uniforms
+	// Members of uniform blocks are listed too but have no location, they're skipped
 	GLint active_uniform_count = 0;
-	glGetProgramiv(prog, GL_ACTIVE_UNIFORMS, &active_uniform_count);
-	printf("%d uniforms:\n", active_uniform_count);
-	for(size_t i = 0; i < active_uniform_count; i++){
-		char buffer[512];
-		GLint size;
-		GLenum type;
-		glGetActiveUniform(prog, i, 512, NULL, &size, &type, buffer);
-		printf("- \"%s\": size %d, type %d\n", buffer, size, type);
+	glGetProgramiv(program->id, GL_ACTIVE_UNIFORMS, &active_uniform_count);
+	trace_text(TRACE_VERBOSE, "program", "%s %s: %d uniforms", program->vertex_shader_filename, program->fragment_shader_filename, active_uniform_count);
+	program->uniforms = mem_calloc(MEM_PROGRAMS, active_uniform_count, sizeof(program_var_t));
+	for(GLint i = 0; i < active_uniform_count; i++){
+		program_var_p var = &program->uniforms[program->uniform_count];
+		glGetActiveUniform(program->id, i, sizeof(var->name), NULL, &var->size, &var->type, var->name);
+		var->location = glGetUniformLocation(program->id, var->name);
+		trace_text(TRACE_VERBOSE, "uniform", "%s: size %d, type %d, location %d", var->name, var->size, var->type, var->location);
+		if (var->location != -1)
+			program->uniform_count++;
+	}
+	
+	program->linked = true;
+	return true;
+}
+
+void program_destroy(program_p program){
+	delete_program_and_shaders(program->id);
+	mem_free(MEM_PROGRAMS, program->vertex_source);
+	mem_free(MEM_PROGRAMS, program->fragment_source);
+	mem_free(MEM_PROGRAMS, program->attribs);
+	mem_free(MEM_PROGRAMS, program->uniforms);
+	mem_free(MEM_PROGRAMS, program);
+}
+
+static GLint program_var_location(program_var_p vars, size_t count, const char *name, GLenum type){
+	for(size_t i = 0; i < count; i++){
+		if ( strcmp(vars[i].name, name) == 0 ) {
+			assert(vars[i].type == type);
+			return vars[i].location;
+		}
 	}
 	
-	return prog;
+	assert(0);
+	return -1;
 }
 
 /**
- * Destorys the specified program and all shaders attached to it.
+ * Returns the location of an active attribute. The attribute has to exist with the given type
+ * (e.g. GL_FLOAT_VEC2), so changes in the shaders don't go unnoticed.
  */
-void delete_program_and_shaders(GLuint program){
-	GLint shader_count = 0;
-	glGetProgramiv(program, GL_ATTACHED_SHADERS, &shader_count);
-	
-	GLuint shaders[shader_count];
-	glGetAttachedShaders(program, shader_count, NULL, shaders);
-	
-	glDeleteProgram(program);
-	for(size_t i = 0; i < shader_count; i++)
-		glDeleteShader(shaders[i]);
+GLint program_attrib(program_p program, const char *name, GLenum type){
+	return program_var_location(program->attribs, program->attrib_count, name, type);
+}
+
+/**
+ * Same as program_attrib() for uniforms outside of uniform blocks.
+ */
+GLint program_uniform(program_p program, const char *name, GLenum type){
+	return program_var_location(program->uniforms, program->uniform_count, name, type);
+}
+
+/**
+ * Connects a uniform block of the program to a uniform buffer binding point.
+ */
+void program_uniform_block(program_p program, const char *name, GLuint binding){
+	GLuint index = glGetUniformBlockIndex(program->id, name);
+	assert(index != GL_INVALID_INDEX);
+	glUniformBlockBinding(program->id, index, binding);
 }
 
 
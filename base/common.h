@@ -1,9 +1,42 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
 typedef struct { float r, g, b, a; } color_t;
 
-GLint create_and_compile_shader(GLenum shader_type, const char *filename);
-GLuint load_and_link_program(const char *vertex_shader_filename, const char *fragment_shader_filename);
+extern const char *program_cache_dir;
+
+bool gl_extension_supported(const char *name);
 void delete_program_and_shaders(GLuint program);
 
+typedef struct {
+	char name[64];
+	GLint location, size;
+	GLenum type;
+} program_var_t, *program_var_p;
+
+typedef struct {
+	GLuint id;
+	const char *vertex_shader_filename, *fragment_shader_filename;
+	bool cached, from_cache;  // binary cache used, binary taken from it
+	bool linked;  // finished successfully
+	uint64_t hash;
+	
+	// Sources, kept until the program is finished in case a cached binary is rejected
+	char *vertex_source, *fragment_source;
+	size_t vertex_source_size, fragment_source_size;
+	
+	size_t attrib_count, uniform_count;
+	program_var_p attribs, uniforms;
+} program_t, *program_p;
+
+program_p program_create(const char *vertex_shader_filename, const char *fragment_shader_filename);
+bool program_finish(program_p program);
+void program_destroy(program_p program);
+GLint program_attrib(program_p program, const char *name, GLenum type);
+GLint program_uniform(program_p program, const char *name, GLenum type);
+void program_uniform_block(program_p program, const char *name, GLuint binding);
+
 float rand_in(float lower, float upper);
\ No newline at end of file
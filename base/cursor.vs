@@ -1,14 +1,22 @@
 #version 120
+#extension GL_ARB_uniform_buffer_object : require
+
+// Per frame data of the renderer, see frame_uniforms_t in renderer.c
+layout(std140) uniform frame_uniforms {
+	mat3 world_to_normal;
+	mat3 screen_to_normal;
+	vec2 screen_size;
+	float scale_exp;
+};
 
 // vertex and cursor positions in screen space
 attribute vec2 pos;
 uniform vec2 cursor_pos;
-uniform mat3 projection;
 
 varying vec2 screen_coords;
 
 void main(){
 	screen_coords = cursor_pos + pos;
-	gl_Position.xyz = projection * vec3(screen_coords, 1);
+	gl_Position.xyz = screen_to_normal * vec3(screen_coords, 1);
 	gl_Position.w = 1;
 }
\ No newline at end of file
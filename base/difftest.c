@@ -0,0 +1,318 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#define __USE_XOPEN 1
+#include <math.h>
+
+#include "model.h"
+#include "sim.h"
+#include "meshgen.h"
+#include "jobs.h"
+#include "rigid.h"
+
+/*
+
+Differential test of the simulation kernels in sim_kernels against the reference simulate().
+	
+	difftest [--kernel name] [--steps n] [--every n] [--thrusters hex,...] [--velocity m_s] [--spin rad_s]
+		[--threads n] [workload...]
+
+A workload is a mesh file or a generated structure written as kind:key=value,... with the options of
+mkmesh, e.g. "hull:particles=20000,seed=3". Without workloads a small set of generated structures is
+used. Both models start from the same state and are stepped with the same input. Every step the
+particle positions, broken beams and total energy of the candidate are compared to the reference:
+
+- max and RMS distance between the positions of the same particle
+- number of beams broken in only one of the models
+- relative difference of the total (kinetic + elastic) energy
+
+A structure at rest without input never deforms, so every workload is run once for each of the
+--thrusters masks (default 0, 1, 4 and f: coasting, thrust, torque and everything at once). Before the
+first step the whole model gets a --velocity along x (default 5 m/s) and a --spin around its center of
+mass (default 0.1 rad/s), the centripetal forces load the structures even without thrusters.
+
+Without workloads the runs of default_cases follow, each with its own mask, velocity, spin and number
+of steps. They cover the rigid kernel on a slender truss: spinning slowly (with and without thrust) it
+freezes after a few thousand steps, starting at rest under thrust it has to stay soft until the dropped
+vibrations are small compared to its energy. Runs of kernels with rigid islands also report in how many
+steps islands were rigid.
+
+Every --every steps a line is printed, a workload fails as soon as one value exceeds the tolerance of
+the kernel. The exit code is 1 if any workload failed. Multithreaded kernels run on --threads workers
+of the job system (default 4, more than CPUs is fine and shakes out more orderings).
+
+*/
+
+typedef struct {
+	float max_divergence, rms_divergence, energy_drift;
+	size_t break_mismatches;
+} diff_t, *diff_p;
+
+const char *default_workloads[] = {
+	"truss:w=200,h=6",
+	"lattice:particles=10000",
+	"frigates:w=4,h=4",
+	"hull:particles=5000,seed=7"
+};
+
+typedef struct {
+	const char *workload;
+	uint8_t mask;
+	float velocity, spin;  // m_s, rad_s
+	uint64_t steps;
+} diff_case_t;
+
+const diff_case_t default_cases[] = {
+	{ "truss:w=200,h=6", 0, 5, 0.05, 5000 },
+	{ "truss:w=200,h=6", THRUSTER_BACK, 5, 0.05, 5000 },
+	{ "truss:w=200,h=6", THRUSTER_BACK, 0, 0, 6000 }
+};
+
+#define DIFF_MAX_MASKS 16
+const uint8_t default_masks[] = { 0, THRUSTER_BACK, THRUSTER_LEFT, THRUSTER_BACK | THRUSTER_FRONT | THRUSTER_LEFT | THRUSTER_RIGHT };
+
+
+/**
+ * Kinetic energy of all particles plus the elastic energy stored in all unbroken beams.
+ */
+static double diff_energy(model_p model){
+	double energy = 0;
+	for(size_t i = 0; i < model->particle_count; i++){
+		particle_p p = &model->particles[i];
+		energy += 0.5 * p->mass * (p->vel.x * p->vel.x + p->vel.y * p->vel.y);
+	}
+	
+	for(size_t i = 0; i < model->beam_count; i++){
+		beam_p beam = &model->beams[i];
+		if ( (beam->flags & BEAM_BROKEN) || beam->length <= 0 )
+			continue;
+		float length = v2_length( v2_sub(model->particles[beam->i2].pos, model->particles[beam->i1].pos) );
+		double spring_constant = model->modulus_of_elasticity * model->beam_profile_area / beam->length;
+		double dilatation = beam->length - length;
+		energy += 0.5 * spring_constant * dilatation * dilatation;
+	}
+	return energy;
+}
+
+static diff_t diff_compare(model_p reference, model_p candidate){
+	diff_t diff = { 0, 0, 0, 0 };
+	double sum = 0;
+	for(size_t i = 0; i < reference->particle_count; i++){
+		float d = v2_length( v2_sub(candidate->particles[i].pos, reference->particles[i].pos) );
+		// Particles that exploded in both models are equal, in only one of them infinitely far apart
+		if ( isnan(d) )
+			d = ( isnan(reference->particles[i].pos.x) && isnan(candidate->particles[i].pos.x) ) ? 0 : INFINITY;
+		if (d > diff.max_divergence)
+			diff.max_divergence = d;
+		sum += (double)d * d;
+	}
+	if (reference->particle_count > 0)
+		diff.rms_divergence = sqrt(sum / reference->particle_count);
+	
+	for(size_t i = 0; i < reference->beam_count; i++){
+		if ( (reference->beams[i].flags ^ candidate->beams[i].flags) & BEAM_BROKEN )
+			diff.break_mismatches++;
+	}
+	
+	double e_ref = diff_energy(reference), e_cand = diff_energy(candidate);
+	diff.energy_drift = (e_ref != e_cand) ? fabs(e_cand - e_ref) / fmax(fabs(e_ref), 1e-9) : 0;
+	return diff;
+}
+
+static bool diff_within(diff_p diff, sim_kernel_p kernel){
+	return diff->max_divergence <= kernel->max_divergence && diff->rms_divergence <= kernel->rms_divergence
+		&& diff->break_mismatches <= kernel->break_mismatches && diff->energy_drift <= kernel->energy_drift;
+}
+
+/**
+ * Loads a mesh file or generates "kind:key=value,..." into a new model. Returns NULL on errors.
+ */
+static model_p diff_workload(const char *workload){
+	const char *kinds[] = { "truss", "lattice", "frigates", "hull" };
+	for(size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++){
+		size_t len = strlen(kinds[k]);
+		if ( strncmp(workload, kinds[k], len) != 0 || (workload[len] != ':' && workload[len] != '\0') )
+			continue;
+		
+		mg_params_t params = mg_defaults(k);
+		char options[256];
+		snprintf(options, sizeof(options), "%s", workload[len] ? workload + len + 1 : "");
+		for(char *option = strtok(options, ","); option != NULL; option = strtok(NULL, ",")){
+			if ( !mg_parse(&params, option) ){
+				fprintf(stderr, "unknown option %s\n", option);
+				return NULL;
+			}
+		}
+		return mg_generate(&params);
+	}
+	
+	model_p model = model_new();
+	if ( !model_load_progress(model, workload, NULL, NULL) ){
+		model_destroy(model);
+		return NULL;
+	}
+	return model;
+}
+
+/**
+ * Sets the velocity of every particle to that of the whole model moving with velocity along x and
+ * rotating with spin around its center of mass.
+ */
+static void diff_perturb(model_p model, float velocity, float spin){
+	vec2_t center = model_particle_center(model);
+	for(size_t i = 0; i < model->particle_count; i++){
+		particle_p p = &model->particles[i];
+		float rx = p->pos.x - center.x, ry = p->pos.y - center.y;
+		p->vel = (vec2_t){ velocity - spin * ry, spin * rx };
+	}
+}
+
+static bool diff_run(sim_kernel_p kernel, const char *workload, model_p initial, uint64_t steps, uint64_t every){
+	model_p reference = model_snapshot(initial), candidate = model_snapshot(initial);
+	float dt = 10 / 1000.0;
+	diff_t worst = { 0, 0, 0, 0 };
+	uint64_t failed_step = 0, rigid_steps = 0;
+	
+	printf("%s on %s: %zu particles, %zu beams, %zu thrusters, mask %x\n", kernel->name, workload,
+		initial->particle_count, initial->beam_count, initial->thruster_count, sim_enabled_thrusters);
+	printf("  %8s %12s %12s %10s %12s\n", "step", "max m", "rms m", "breaks", "energy");
+	
+	for(uint64_t step = 1; step <= steps; step++){
+		simulate(reference, dt);
+		kernel->step(candidate, dt);
+		if (candidate->rigid && candidate->rigid->rigid_island_count > 0)
+			rigid_steps++;
+		
+		diff_t diff = diff_compare(reference, candidate);
+		worst.max_divergence = fmaxf(worst.max_divergence, diff.max_divergence);
+		worst.rms_divergence = fmaxf(worst.rms_divergence, diff.rms_divergence);
+		worst.energy_drift = fmaxf(worst.energy_drift, diff.energy_drift);
+		if (diff.break_mismatches > worst.break_mismatches)
+			worst.break_mismatches = diff.break_mismatches;
+		
+		bool ok = diff_within(&diff, kernel);
+		if (!ok && failed_step == 0)
+			failed_step = step;
+		if (step % every == 0 || step == steps || (!ok && failed_step == step))
+			printf("  %8" PRIu64 " %12.3g %12.3g %10zu %12.3g%s\n", step, diff.max_divergence, diff.rms_divergence,
+				diff.break_mismatches, diff.energy_drift, ok ? "" : "  out of tolerance");
+	}
+	
+	if (failed_step)
+		printf("  FAIL since step %" PRIu64 ", worst: max %.3g m, rms %.3g m, %zu breaks, energy %.3g\n", failed_step,
+			worst.max_divergence, worst.rms_divergence, worst.break_mismatches, worst.energy_drift);
+	else
+		printf("  PASS, worst: max %.3g m, rms %.3g m, %zu breaks, energy %.3g\n",
+			worst.max_divergence, worst.rms_divergence, worst.break_mismatches, worst.energy_drift);
+	if (candidate->rigid)
+		printf("  rigid islands in %" PRIu64 " of %" PRIu64 " steps\n", rigid_steps, steps);
+	printf("\n");
+	
+	model_destroy(reference);
+	model_destroy(candidate);
+	return failed_step == 0;
+}
+
+
+int main(int argc, char **argv){
+	const char *kernel_name = NULL;
+	uint64_t steps = 1000, every = 100;
+	size_t threads = 4;
+	float velocity = 5, spin = 0.1;
+	uint8_t masks[DIFF_MAX_MASKS];
+	size_t mask_count = sizeof(default_masks);
+	memcpy(masks, default_masks, sizeof(default_masks));
+	const char **workloads = default_workloads;
+	size_t workload_count = sizeof(default_workloads) / sizeof(default_workloads[0]);
+	size_t case_count = sizeof(default_cases) / sizeof(default_cases[0]);
+	
+	int arg = 1;
+	for(; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++){
+		if (strcmp(argv[arg], "--kernel") == 0 && arg + 1 < argc)
+			kernel_name = argv[++arg];
+		else if (strcmp(argv[arg], "--steps") == 0 && arg + 1 < argc)
+			steps = strtoull(argv[++arg], NULL, 10);
+		else if (strcmp(argv[arg], "--every") == 0 && arg + 1 < argc)
+			every = strtoull(argv[++arg], NULL, 10);
+		else if (strcmp(argv[arg], "--thrusters") == 0 && arg + 1 < argc) {
+			char *mask = argv[++arg];
+			for(mask_count = 0; mask_count < DIFF_MAX_MASKS && *mask != '\0'; mask_count++){
+				masks[mask_count] = strtoul(mask, &mask, 16);
+				if (*mask == ',')
+					mask++;
+			}
+		} else if (strcmp(argv[arg], "--velocity") == 0 && arg + 1 < argc)
+			velocity = strtof(argv[++arg], NULL);
+		else if (strcmp(argv[arg], "--spin") == 0 && arg + 1 < argc)
+			spin = strtof(argv[++arg], NULL);
+		else if (strcmp(argv[arg], "--threads") == 0 && arg + 1 < argc)
+			threads = strtoul(argv[++arg], NULL, 10);
+		else {
+			fprintf(stderr, "usage: %s [--kernel name] [--steps n] [--every n] [--thrusters hex,...] [--velocity m_s] [--spin rad_s] [--threads n] [workload...]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (arg < argc) {
+		workloads = (const char**)argv + arg;
+		workload_count = argc - arg;
+		case_count = 0;
+	}
+	if (every < 1)
+		every = 1;
+	
+	sim_kernel_p kernel = NULL;
+	if (kernel_name && (kernel = sim_kernel(kernel_name)) == NULL) {
+		fprintf(stderr, "unknown kernel %s, available:", kernel_name);
+		for(size_t i = 0; i < sim_kernel_count; i++)
+			fprintf(stderr, " %s", sim_kernels[i].name);
+		fprintf(stderr, "\n");
+		return 1;
+	}
+	
+	job_start(threads, false);
+	size_t failed = 0, runs = 0;
+	for(size_t w = 0; w < workload_count; w++){
+		model_p initial = diff_workload(workloads[w]);
+		if (initial == NULL)
+			return 1;
+		diff_perturb(initial, velocity, spin);
+		
+		for(size_t m = 0; m < mask_count; m++){
+			sim_enabled_thrusters = masks[m];
+			for(size_t k = 0; k < sim_kernel_count; k++){
+				if (kernel && kernel != &sim_kernels[k])
+					continue;
+				if ( !diff_run(&sim_kernels[k], workloads[w], initial, steps, every) )
+					failed++;
+				runs++;
+			}
+		}
+		model_destroy(initial);
+	}
+	
+	for(size_t c = 0; c < case_count; c++){
+		const diff_case_t *run = &default_cases[c];
+		model_p initial = diff_workload(run->workload);
+		if (initial == NULL)
+			return 1;
+		diff_perturb(initial, run->velocity, run->spin);
+		printf("velocity %g m/s, spin %g rad/s\n", run->velocity, run->spin);
+		
+		sim_enabled_thrusters = run->mask;
+		for(size_t k = 0; k < sim_kernel_count; k++){
+			if (kernel && kernel != &sim_kernels[k])
+				continue;
+			if ( !diff_run(&sim_kernels[k], run->workload, initial, run->steps, every) )
+				failed++;
+			runs++;
+		}
+		model_destroy(initial);
+	}
+	
+	job_stop();
+	printf("%zu of %zu runs within tolerance\n", runs - failed, runs);
+	return (failed > 0) ? 1 : 0;
+}
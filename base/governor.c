@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "governor.h"
+#include "profile.h"
+
+
+static const struct {
+	const char *name;
+	bool grid;
+	float lod_scale;
+	uint32_t render_interval;
+} gov_levels[GOV_LEVEL_COUNT] = {
+	[GOV_FULL]         = { "full quality",           true,  1, 1 },
+	[GOV_NO_GRID]      = { "grid skipped",           false, 1, 1 },
+	[GOV_LOD_HALF]     = { "level of detail halved", false, 2, 1 },
+	[GOV_LOD_QUARTER]  = { "level of detail / 4",    false, 4, 1 },
+	[GOV_HALF_RATE]    = { "every 2nd frame drawn",  false, 4, 2 },
+	[GOV_QUARTER_RATE] = { "every 4th frame drawn",  false, 4, 4 }
+};
+
+static void gov_set_level(governor_p gov, gov_level_t level){
+	gov->level = level;
+	gov->over_frames = 0;
+	gov->under_frames = 0;
+	
+	float s = gov_levels[level].lod_scale;
+	grid_visible = gov_levels[level].grid;
+	renderer_lod = (renderer_lod_t){
+		gov->lod.particles_begin * s, gov->lod.particles_end * s,
+		gov->lod.tiles_begin * s, gov->lod.tiles_end * s
+	};
+}
+
+/**
+ * Takes the current renderer_lod as full quality and schedules the first step for now.
+ */
+void gov_init(governor_p gov, float step_ms, bool enabled){
+	*gov = (governor_t){
+		.enabled = enabled,
+		.step_ms = step_ms,
+		.next_step = prof_now(),
+		.lod = renderer_lod,
+		.restore_frames = GOV_RESTORE_FRAMES
+	};
+	gov_set_level(gov, GOV_FULL);
+}
+
+/**
+ * Returns the number of steps due at now (prof_now() time) and schedules the next one. Call it every
+ * frame, also while the simulation is paused (just don't run the steps then), so paused time doesn't
+ * pile up as steps to catch up.
+ */
+uint32_t gov_steps_due(governor_p gov, uint64_t now){
+	uint64_t step_ns = gov->step_ms * 1000000;
+	uint32_t steps = 0;
+	while (gov->next_step <= now && steps < GOV_MAX_STEPS) {
+		gov->next_step += step_ns;
+		steps++;
+	}
+	
+	if (gov->next_step <= now) {
+		uint64_t late = (now - gov->next_step) / step_ns + 1;
+		gov->late_steps += late;
+		gov->next_step += late * step_ns;
+	}
+	
+	return steps;
+}
+
+bool gov_render_due(governor_p gov){
+	return gov->frame % gov_levels[gov->level].render_interval == 0;
+}
+
+/**
+ * Updates the smoothed costs with the steps simulated and the frame rendered (if any) in this frame and
+ * changes the level when the budget was exceeded or left enough room for long enough.
+ */
+void gov_frame(governor_p gov, uint32_t steps, uint64_t sim_ns, bool rendered, uint64_t render_ns){
+	gov->frame++;
+	if (steps > 0)
+		gov->sim_ms += (sim_ns / 1000000.0 / steps - gov->sim_ms) * GOV_SMOOTHING;
+	if (rendered)
+		gov->render_ms += (render_ns / 1000000.0 - gov->render_ms) * GOV_SMOOTHING;
+	
+	// Report dropped steps at most once a second
+	if (gov->late_steps != gov->reported_late_steps && gov->frame - gov->reported_frame >= 1000 / gov->step_ms) {
+		printf("governor: simulation behind real time, %" PRIu64 " steps dropped, %.1f ms per step of %.1f ms\n",
+			gov->late_steps - gov->reported_late_steps, gov->sim_ms, gov->step_ms);
+		gov->reported_late_steps = gov->late_steps;
+		gov->reported_frame = gov->frame;
+	}
+	
+	if (!gov->enabled)
+		return;
+	
+	float cost = gov->sim_ms + gov->render_ms / gov_levels[gov->level].render_interval;
+	if (cost > gov->step_ms) {
+		gov->over_frames++;
+		gov->under_frames = 0;
+	} else if (cost < gov->step_ms * GOV_RESTORE_FRACTION) {
+		gov->under_frames++;
+		gov->over_frames = 0;
+	} else {
+		gov->over_frames = 0;
+		gov->under_frames = 0;
+	}
+	
+	gov_level_t level = gov->level;
+	if (gov->over_frames >= GOV_DEGRADE_FRAMES && level < GOV_LEVEL_COUNT - 1) {
+		// Back off when the level that was just restored doesn't fit
+		if (gov->restored_frame > 0 && gov->frame - gov->restored_frame < gov->restore_frames)
+			gov->restore_frames = (gov->restore_frames * 2 < GOV_RESTORE_FRAMES_MAX) ? gov->restore_frames * 2 : GOV_RESTORE_FRAMES_MAX;
+		else
+			gov->restore_frames = GOV_RESTORE_FRAMES;
+		gov_set_level(gov, level + 1);
+	} else if (gov->under_frames >= gov->restore_frames && level > GOV_FULL) {
+		gov->restored_frame = gov->frame;
+		gov_set_level(gov, level - 1);
+	}
+	
+	if (gov->level != level)
+		printf("governor: %s, %.1f ms per step and %.1f ms per drawn frame of %.1f ms\n",
+			gov_levels[gov->level].name, gov->sim_ms, gov->render_ms, gov->step_ms);
+}
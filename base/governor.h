@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "renderer.h"
+
+/**
+
+Frame budget governor of the main loop. The simulation runs fixed steps of step_ms in real time, the
+renderer gets whatever is left of each step. gov_steps_due() tells the loop how many steps are due (at
+most GOV_MAX_STEPS to catch up after a slow frame), gov_render_due() whether to draw in this frame and
+gov_frame() takes the measured costs:
+	
+	uint32_t steps = gov_steps_due(&gov, prof_now());
+	// simulate the steps, input is handled every frame
+	if ( gov_render_due(&gov) )
+		// draw and swap
+	gov_frame(&gov, steps, sim_ns, rendered, render_ns);
+	// sleep until gov.next_step
+
+The cost of a frame is estimated from smoothed costs: one simulation step plus a rendered frame divided
+by the render interval. When it stays above the budget for GOV_DEGRADE_FRAMES the governor moves one
+level down, when it stays below GOV_RESTORE_FRACTION of the budget for restore_frames one level up:
+	
+	GOV_FULL          grid, full level of detail, every frame rendered
+	GOV_NO_GRID       grid skipped
+	GOV_LOD_HALF      renderer_lod thresholds doubled (particles and tiles fade out twice as early)
+	GOV_LOD_QUARTER   renderer_lod thresholds times 4
+	GOV_HALF_RATE     only every second frame rendered
+	GOV_QUARTER_RATE  only every fourth frame rendered
+
+Restoring a level that has to be given up again right away doubles restore_frames (up to
+GOV_RESTORE_FRAMES_MAX), so a scene at the edge of the budget doesn't flicker between levels.
+
+The simulation step is never degraded. If a step alone takes longer than the budget the simulation
+falls behind real time: steps beyond GOV_MAX_STEPS per frame are dropped and counted in late_steps
+instead of piling up.
+
+*/
+
+#define GOV_MAX_STEPS 4
+#define GOV_SMOOTHING 0.25
+#define GOV_DEGRADE_FRAMES 8
+#define GOV_RESTORE_FRACTION 0.5
+#define GOV_RESTORE_FRAMES 200
+#define GOV_RESTORE_FRAMES_MAX 3200
+
+typedef enum {
+	GOV_FULL,
+	GOV_NO_GRID,
+	GOV_LOD_HALF,
+	GOV_LOD_QUARTER,
+	GOV_HALF_RATE,
+	GOV_QUARTER_RATE,
+	GOV_LEVEL_COUNT
+} gov_level_t;
+
+typedef struct {
+	bool enabled;  // false keeps GOV_FULL, steps are still scheduled
+	float step_ms;
+	uint64_t next_step;  // ns, prof_now() time the next step is due
+	uint64_t frame;
+	
+	gov_level_t level;
+	renderer_lod_t lod;  // renderer_lod at GOV_FULL
+	float sim_ms, render_ms;  // smoothed cost of a step and of a rendered frame
+	uint32_t over_frames, under_frames;
+	uint32_t restore_frames;
+	uint64_t restored_frame;  // frame the level was last raised
+	
+	uint64_t late_steps;  // steps dropped because the simulation couldn't keep up
+	uint64_t reported_late_steps, reported_frame;
+} governor_t, *governor_p;
+
+
+void gov_init(governor_p gov, float step_ms, bool enabled);
+uint32_t gov_steps_due(governor_p gov, uint64_t now);
+bool gov_render_due(governor_p gov);
+void gov_frame(governor_p gov, uint32_t steps, uint64_t sim_ns, bool rendered, uint64_t render_ns);
@@ -1,5 +1,6 @@
 #version 120
 
+// vertex of a grid line quad in normalized device coordinates
 attribute vec2 pos;
 
 void main(){
@@ -0,0 +1,145 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+
+#include "model.h"
+#include "sim.h"
+#include "profile.h"
+#include "perfcount.h"
+#include "jobs.h"
+#include "common.h"
+#include "renderer.h"
+#include "offscreen.h"
+#include "capture.h"
+
+/*
+
+Runs the simulation of a mesh without a window and reports where the time went: wall clock timings of
+each phase of the last steps and the hardware counters per phase (if available).
+	
+	headless load.mesh [steps] [thrusters]
+
+thrusters is a hex mask of enabled thruster groups (1 back, 2 front, 4 left, 8 right), e.g. 4 to fly
+forward the whole time. Set JOBS to simulate with that many threads of the job system (JOB_PIN pins
+them to CPUs), by default the single threaded reference step is used. KERNEL selects another kernel of
+sim_kernels by name, e.g. KERNEL=rigid for the rigid body fast path.
+
+Set FRAMES to render the model offscreen every FRAME_STEPS steps (default 10) and write the frames as
+images, e.g. FRAMES=frames/%06lu.png (or .ppm for raw PPM files, see capture.h). FRAME_SIZE sets the
+size in pixels (default 1280x720), FRAME_SCALE the zoom exponent of the viewport (default 0). The view
+stays centered on where the model was at the start. A background thread writes the frames, the
+simulation isn't paced to real time.
+
+*/
+
+int main(int argc, char **argv){
+	if (argc < 2 || argc > 4){
+		fprintf(stderr, "usage: %s load.mesh [steps] [thrusters]\n", argv[0]);
+		return 1;
+	}
+	
+	uint64_t steps = (argc > 2) ? strtoull(argv[2], NULL, 10) : 1000;
+	sim_enabled_thrusters = (argc > 3) ? strtoul(argv[3], NULL, 16) : 0;
+	float dt = 10 / 1000.0;
+	
+	perfcount_p pc = pc_open();
+	if (pc == NULL)
+		printf("hardware counters unavailable, only reporting wall clock timings\n");
+	
+	size_t threads = getenv("JOBS") ? strtoul(getenv("JOBS"), NULL, 10) : 1;
+	if (threads != 1)
+		job_start(threads, getenv("JOB_PIN") != NULL);
+	for(size_t i = 1; pc && i < job_thread_count(); i++)
+		pc_attach(pc, job_thread_id(i));
+	sim_kernel_func_t step = (threads != 1) ? simulate_jobs : simulate;
+	if ( getenv("KERNEL") ) {
+		sim_kernel_p kernel = sim_kernel(getenv("KERNEL"));
+		if (kernel == NULL) {
+			fprintf(stderr, "unknown kernel %s\n", getenv("KERNEL"));
+			return 1;
+		}
+		step = kernel->step;
+	}
+	
+	model_p model = model_new();
+	if ( !model_load_progress(model, argv[1], NULL, NULL) )
+		return 1;
+	
+	const char *frames = getenv("FRAMES");
+	uint64_t frame_steps = getenv("FRAME_STEPS") ? strtoull(getenv("FRAME_STEPS"), NULL, 10) : 10;
+	unsigned int frame_width = 1280, frame_height = 720;
+	if ( getenv("FRAME_SIZE") && sscanf(getenv("FRAME_SIZE"), "%ux%u", &frame_width, &frame_height) != 2 ) {
+		fprintf(stderr, "FRAME_SIZE has to be WIDTHxHEIGHT, e.g. 1280x720\n");
+		return 1;
+	}
+	if (frames) {
+		if (frame_steps == 0)
+			frame_steps = 1;
+		if ( !offscreen_init(frame_width, frame_height) ) {
+			fprintf(stderr, "no offscreen GL context available\n");
+			return 1;
+		}
+		program_cache_dir = getenv("PROGRAM_CACHE");
+		renderer_load(frame_width, frame_height);
+		// Upload bandwidth matters with software GL, the compact streams fall back to floats where they
+		// aren't precise enough
+		renderer_compact_streams = true;
+		cursor_visible = false;
+		viewport->scale_exp = getenv("FRAME_SCALE") ? strtof(getenv("FRAME_SCALE"), NULL) : 0;
+		viewport->pos = model_particle_center(model);
+		vp_changed(viewport);
+		if ( !cap_start(frames, frame_width, frame_height) ) {
+			fprintf(stderr, "not enough memory for the frame queue\n");
+			return 1;
+		}
+	}
+	
+	uint64_t start = prof_now(), frame_count = 0;
+	for(uint64_t i = 0; i < steps; i++){
+		if (frames && i % frame_steps == 0) {
+			renderer_draw(model);
+			cap_frame();
+			frame_count++;
+		}
+		step(model, dt);
+	}
+	uint64_t frame_errors = 0;
+	if (frames) {
+		frame_errors = cap_stop();
+		renderer_unload();
+		offscreen_destroy();
+	}
+	double elapsed = (prof_now() - start) / 1e9;
+	
+	size_t broken = 0;
+	for(size_t i = 0; i < model->beam_count; i++){
+		if (model->beams[i].flags & BEAM_BROKEN)
+			broken++;
+	}
+	printf("%" PRIu64 " steps in %.3f s, %.1f steps/s with %zu threads, %zu of %zu beams broken\n", steps, elapsed, steps / elapsed,
+		job_thread_count(), broken, model->beam_count);
+	if (frames)
+		printf("%" PRIu64 " of %" PRIu64 " frames written to %s\n", frame_count - frame_errors, frame_count, frames);
+	printf("\n");
+	
+	printf("%-20s %8s %8s %8s  (last %d steps)\n", "phase", "min ms", "mean ms", "p99 ms", PROF_WINDOW);
+	for(size_t i = PROF_SIMULATE; i <= PROF_SIM_RIGID; i++){
+		prof_stats_t s = prof_stats(i);
+		printf("%-20s %8.4f %8.4f %8.4f\n", prof_timers[i].name, s.min, s.mean, s.p99);
+	}
+	
+	if (pc) {
+		printf("\nhardware counters per step (model load per call):\n");
+		pc_report(pc, stdout, steps);
+		pc_close(pc);
+	}
+	
+	model_destroy(model);
+	job_stop();
+	return 0;
+}
@@ -0,0 +1,468 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "history.h"
+
+
+//
+// Encoding helpers
+//
+
+static inline uint8_t* put_varint(uint8_t *p, uint64_t value){
+	while (value >= 0x80) {
+		*p++ = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	*p++ = value;
+	return p;
+}
+
+static inline const uint8_t* get_varint(const uint8_t *p, uint64_t *value){
+	uint64_t result = 0;
+	int shift = 0;
+	while (*p & 0x80) {
+		result |= (uint64_t)(*p++ & 0x7f) << shift;
+		shift += 7;
+	}
+	result |= (uint64_t)(*p++) << shift;
+	*value = result;
+	return p;
+}
+
+// Maps signed to unsigned values so that small negative numbers become small positive ones
+static inline uint64_t zigzag(int64_t value){
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t value){
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static inline int32_t quantize(float value, float inv_quantum){
+	float q = value * inv_quantum;
+	if (q > 2147483520.0f)
+		return INT32_MAX;
+	if (q < -2147483520.0f)
+		return INT32_MIN;
+	return lrintf(q);
+}
+
+static inline uint8_t* put_float(uint8_t *p, float value){
+	memcpy(p, &value, sizeof(float));
+	return p + sizeof(float);
+}
+
+static inline const uint8_t* get_float(const uint8_t *p, float *value){
+	memcpy(value, p, sizeof(float));
+	return p + sizeof(float);
+}
+
+
+//
+// Frame ring management
+//
+
+static history_frame_p hist_frame(history_p hist, size_t frame){
+	return &hist->frames[(hist->frame_first + frame) % hist->frame_limit];
+}
+
+/**
+ * Drops the oldest keyframe and all delta frames that depend on it.
+ */
+static void hist_evict_group(history_p hist){
+	do {
+		hist->frame_first = (hist->frame_first + 1) % hist->frame_limit;
+		hist->frame_count--;
+	} while (hist->frame_count > 0 && !hist_frame(hist, 0)->keyframe);
+	hist->dec_frame = -1;
+}
+
+/**
+ * Finds a place for a frame of size bytes in the byte ring and evicts the frames in the way.
+ * Returns false if the frame is larger than the entire ring.
+ */
+static bool hist_make_room(history_p hist, size_t size, size_t *offset){
+	if (size > hist->byte_limit)
+		return false;
+	
+	if (hist->frame_count == hist->frame_limit)
+		hist_evict_group(hist);
+	
+	// Frames are stored in one piece, start at the beginning if the frame doesn't fit at the end
+	size_t head = hist->data_head;
+	if (head + size > hist->byte_limit)
+		head = 0;
+	
+	while (hist->frame_count > 0) {
+		history_frame_p oldest = hist_frame(hist, 0);
+		if ( oldest->offset < head + size && oldest->offset + oldest->size > head )
+			hist_evict_group(hist);
+		else
+			break;
+	}
+	
+	*offset = head;
+	return true;
+}
+
+/**
+ * Adapts the buffers to the layout of model. All recorded frames are dropped since they don't fit the
+ * model anymore.
+ */
+static void hist_layout(history_p hist, model_p model){
+	hist_reset(hist);
+	
+	size_t n = model->particle_count, b = model->beam_count;
+	hist->particle_count = n;
+	hist->beam_count = b;
+	
+	// Worst case size of a keyframe and a delta frame (varints of 33 bit zigzag values take 5 bytes)
+	size_t keyframe_size = n * 4 * sizeof(float) + b * (sizeof(float) + 1);
+	size_t delta_size = n * 4 * 5 + 1 + (b + 7) / 8 + b + 4 + b * (5 + sizeof(float));
+	hist->scratch_size = (keyframe_size > delta_size) ? keyframe_size : delta_size;
+	hist->scratch = realloc(hist->scratch, hist->scratch_size);
+	
+	hist->enc_quant = realloc(hist->enc_quant, sizeof(int32_t) * 4 * n);
+	hist->enc_flags = realloc(hist->enc_flags, b);
+	hist->enc_length = realloc(hist->enc_length, sizeof(float) * b);
+	hist->dec_quant = realloc(hist->dec_quant, sizeof(int32_t) * 4 * n);
+	hist->dec_flags = realloc(hist->dec_flags, b);
+	hist->dec_length = realloc(hist->dec_length, sizeof(float) * b);
+}
+
+
+//
+// Encoding and decoding of frames
+//
+
+static size_t hist_encode_keyframe(history_p hist, model_p model){
+	float inv_pos = 1 / hist->pos_quantum, inv_vel = 1 / hist->vel_quantum;
+	uint8_t *p = hist->scratch;
+	
+	for(size_t i = 0; i < hist->particle_count; i++){
+		particle_p particle = &model->particles[i];
+		p = put_float(p, particle->pos.x);
+		p = put_float(p, particle->pos.y);
+		p = put_float(p, particle->vel.x);
+		p = put_float(p, particle->vel.y);
+		
+		int32_t *q = &hist->enc_quant[i*4];
+		q[0] = quantize(particle->pos.x, inv_pos);
+		q[1] = quantize(particle->pos.y, inv_pos);
+		q[2] = quantize(particle->vel.x, inv_vel);
+		q[3] = quantize(particle->vel.y, inv_vel);
+	}
+	
+	for(size_t i = 0; i < hist->beam_count; i++){
+		p = put_float(p, model->beams[i].length);
+		*p++ = model->beams[i].flags;
+		hist->enc_length[i] = model->beams[i].length;
+		hist->enc_flags[i] = model->beams[i].flags;
+	}
+	
+	return p - hist->scratch;
+}
+
+static size_t hist_encode_delta(history_p hist, model_p model){
+	float inv_pos = 1 / hist->pos_quantum, inv_vel = 1 / hist->vel_quantum;
+	uint8_t *p = hist->scratch;
+	
+	for(size_t i = 0; i < hist->particle_count; i++){
+		particle_p particle = &model->particles[i];
+		int32_t *q = &hist->enc_quant[i*4];
+		int32_t now[4] = {
+			quantize(particle->pos.x, inv_pos),
+			quantize(particle->pos.y, inv_pos),
+			quantize(particle->vel.x, inv_vel),
+			quantize(particle->vel.y, inv_vel)
+		};
+		
+		for(size_t j = 0; j < 4; j++){
+			p = put_varint(p, zigzag((int64_t)now[j] - q[j]));
+			q[j] = now[j];
+		}
+	}
+	
+	// Bitset of beams with changed flags followed by their new flags. Only present if a flag changed.
+	uint8_t *flags_present = p++;
+	uint8_t *bitset = p;
+	size_t bitset_size = (hist->beam_count + 7) / 8;
+	memset(bitset, 0, bitset_size);
+	p += bitset_size;
+	
+	for(size_t i = 0; i < hist->beam_count; i++){
+		uint8_t flags = model->beams[i].flags;
+		if (flags != hist->enc_flags[i]){
+			bitset[i / 8] |= 1 << (i % 8);
+			*p++ = flags;
+			hist->enc_flags[i] = flags;
+		}
+	}
+	
+	*flags_present = (p != bitset + bitset_size);
+	if (!*flags_present)
+		p = bitset;
+	
+	// List of deformed beams
+	uint8_t *deformed_count_ptr = p;
+	uint32_t deformed_count = 0;
+	size_t last_idx = 0;
+	p += sizeof(uint32_t);
+	
+	for(size_t i = 0; i < hist->beam_count; i++){
+		float length = model->beams[i].length;
+		if (length != hist->enc_length[i]){
+			p = put_varint(p, i - last_idx);
+			p = put_float(p, length);
+			last_idx = i;
+			deformed_count++;
+			hist->enc_length[i] = length;
+		}
+	}
+	memcpy(deformed_count_ptr, &deformed_count, sizeof(uint32_t));
+	
+	return p - hist->scratch;
+}
+
+static void hist_decode(history_p hist, history_frame_p frame){
+	float inv_pos = 1 / hist->pos_quantum, inv_vel = 1 / hist->vel_quantum;
+	const uint8_t *p = hist->data + frame->offset;
+	
+	if (frame->keyframe) {
+		for(size_t i = 0; i < hist->particle_count; i++){
+			float pos_x, pos_y, vel_x, vel_y;
+			p = get_float(p, &pos_x);
+			p = get_float(p, &pos_y);
+			p = get_float(p, &vel_x);
+			p = get_float(p, &vel_y);
+			
+			int32_t *q = &hist->dec_quant[i*4];
+			q[0] = quantize(pos_x, inv_pos);
+			q[1] = quantize(pos_y, inv_pos);
+			q[2] = quantize(vel_x, inv_vel);
+			q[3] = quantize(vel_y, inv_vel);
+		}
+		
+		for(size_t i = 0; i < hist->beam_count; i++){
+			p = get_float(p, &hist->dec_length[i]);
+			hist->dec_flags[i] = *p++;
+		}
+		
+		return;
+	}
+	
+	for(size_t i = 0; i < hist->particle_count * 4; i++){
+		uint64_t delta;
+		p = get_varint(p, &delta);
+		hist->dec_quant[i] += unzigzag(delta);
+	}
+	
+	if (*p++) {
+		const uint8_t *bitset = p;
+		p += (hist->beam_count + 7) / 8;
+		for(size_t i = 0; i < hist->beam_count; i++){
+			if ( bitset[i / 8] & (1 << (i % 8)) )
+				hist->dec_flags[i] = *p++;
+		}
+	}
+	
+	uint32_t deformed_count;
+	memcpy(&deformed_count, p, sizeof(uint32_t));
+	p += sizeof(uint32_t);
+	size_t idx = 0;
+	for(size_t i = 0; i < deformed_count; i++){
+		uint64_t idx_delta;
+		p = get_varint(p, &idx_delta);
+		idx += idx_delta;
+		p = get_float(p, &hist->dec_length[idx]);
+	}
+}
+
+/**
+ * Brings the decoder state to frame. Continues from the last decoded frame if possible, otherwise
+ * starts at the keyframe before frame.
+ */
+static void hist_decode_to(history_p hist, size_t frame){
+	size_t keyframe = frame;
+	while ( !hist_frame(hist, keyframe)->keyframe )
+		keyframe--;
+	
+	size_t start = keyframe;
+	if (hist->dec_frame != -1 && (size_t)hist->dec_frame >= keyframe && (size_t)hist->dec_frame <= frame)
+		start = hist->dec_frame + 1;
+	
+	for(size_t i = start; i <= frame; i++)
+		hist_decode(hist, hist_frame(hist, i));
+	hist->dec_frame = frame;
+}
+
+
+//
+// Public interface
+//
+
+/**
+ * Creates a rewind buffer that uses at most byte_limit bytes for frame data and keeps at most
+ * frame_limit frames (e.g. seconds times steps per second).
+ */
+history_p hist_new(size_t byte_limit, size_t frame_limit, size_t keyframe_interval){
+	history_p hist = malloc(sizeof(history_t));
+	*hist = (history_t){
+		.byte_limit = byte_limit,
+		.frame_limit = frame_limit,
+		.keyframe_interval = keyframe_interval,
+		.pos_quantum = 1.0 / 1024,
+		.vel_quantum = 1.0 / 1024,
+		
+		.data = malloc(byte_limit),
+		.data_head = 0,
+		.frames = malloc(sizeof(history_frame_t) * frame_limit),
+		.frame_first = 0, .frame_count = 0, .frames_since_keyframe = 0,
+		
+		.particle_count = 0, .beam_count = 0,
+		.scratch = NULL, .scratch_size = 0,
+		.enc_quant = NULL, .enc_flags = NULL, .enc_length = NULL,
+		.dec_quant = NULL, .dec_flags = NULL, .dec_length = NULL,
+		.dec_frame = -1
+	};
+	return hist;
+}
+
+void hist_destroy(history_p hist){
+	free(hist->data);
+	free(hist->frames);
+	free(hist->scratch);
+	free(hist->enc_quant);
+	free(hist->enc_flags);
+	free(hist->enc_length);
+	free(hist->dec_quant);
+	free(hist->dec_flags);
+	free(hist->dec_length);
+	free(hist);
+}
+
+/**
+ * Drops all recorded frames. The next recorded frame will be a keyframe.
+ */
+void hist_reset(history_p hist){
+	hist->data_head = 0;
+	hist->frame_first = 0;
+	hist->frame_count = 0;
+	hist->frames_since_keyframe = 0;
+	hist->dec_frame = -1;
+}
+
+/**
+ * Records the current state of model as the newest frame. If the number of particles or beams changed
+ * (edits, loads) all older frames are dropped.
+ */
+void hist_record(history_p hist, model_p model){
+	if (model->particle_count != hist->particle_count || model->beam_count != hist->beam_count || hist->scratch == NULL)
+		hist_layout(hist, model);
+	
+	bool keyframe = (hist->frame_count == 0 || hist->frames_since_keyframe >= hist->keyframe_interval);
+	size_t size = keyframe ? hist_encode_keyframe(hist, model) : hist_encode_delta(hist, model);
+	
+	size_t offset;
+	if ( !hist_make_room(hist, size, &offset) ){
+		// Doesn't fit at all. The encoder state is ahead of the stored frames now so start over.
+		hist_reset(hist);
+		return;
+	}
+	
+	if (!keyframe && hist->frame_count == 0){
+		// Making room evicted the keyframe this delta depends on, store a keyframe instead
+		keyframe = true;
+		size = hist_encode_keyframe(hist, model);
+		if ( !hist_make_room(hist, size, &offset) ){
+			hist_reset(hist);
+			return;
+		}
+	}
+	
+	memcpy(hist->data + offset, hist->scratch, size);
+	*hist_frame(hist, hist->frame_count) = (history_frame_t){ .offset = offset, .size = size, .keyframe = keyframe };
+	hist->frame_count++;
+	hist->data_head = offset + size;
+	hist->frames_since_keyframe = keyframe ? 1 : hist->frames_since_keyframe + 1;
+}
+
+/**
+ * Sets the particles and beams of model to the state of frame (0 is the oldest frame). Particles of
+ * delta frames are restored with the quantization precision.
+ */
+bool hist_restore(history_p hist, size_t frame, model_p model){
+	if (frame >= hist->frame_count || model->particle_count != hist->particle_count || model->beam_count != hist->beam_count)
+		return false;
+	
+	hist_decode_to(hist, frame);
+	
+	history_frame_p f = hist_frame(hist, frame);
+	if (f->keyframe) {
+		// Keyframes contain the exact state, use it
+		const uint8_t *p = hist->data + f->offset;
+		for(size_t i = 0; i < hist->particle_count; i++){
+			particle_p particle = &model->particles[i];
+			p = get_float(p, &particle->pos.x);
+			p = get_float(p, &particle->pos.y);
+			p = get_float(p, &particle->vel.x);
+			p = get_float(p, &particle->vel.y);
+			particle->force = (vec2_t){0, 0};
+		}
+	} else {
+		for(size_t i = 0; i < hist->particle_count; i++){
+			particle_p particle = &model->particles[i];
+			int32_t *q = &hist->dec_quant[i*4];
+			particle->pos = (vec2_t){ q[0] * hist->pos_quantum, q[1] * hist->pos_quantum };
+			particle->vel = (vec2_t){ q[2] * hist->vel_quantum, q[3] * hist->vel_quantum };
+			particle->force = (vec2_t){0, 0};
+		}
+	}
+	
+	for(size_t i = 0; i < hist->beam_count; i++){
+		model->beams[i].length = hist->dec_length[i];
+		model->beams[i].flags = hist->dec_flags[i];
+	}
+	model_changed(model);
+	model_journal_invalidate(model);
+	
+	return true;
+}
+
+/**
+ * Drops all frames newer than frame so recording continues from there. Call after the model was
+ * restored to frame with hist_restore().
+ */
+void hist_resume(history_p hist, size_t frame){
+	if (frame >= hist->frame_count)
+		return;
+	
+	hist_decode_to(hist, frame);
+	memcpy(hist->enc_quant, hist->dec_quant, sizeof(int32_t) * 4 * hist->particle_count);
+	memcpy(hist->enc_flags, hist->dec_flags, hist->beam_count);
+	memcpy(hist->enc_length, hist->dec_length, sizeof(float) * hist->beam_count);
+	
+	history_frame_p f = hist_frame(hist, frame);
+	hist->frame_count = frame + 1;
+	hist->data_head = f->offset + f->size;
+	
+	size_t keyframe = frame;
+	while ( !hist_frame(hist, keyframe)->keyframe )
+		keyframe--;
+	hist->frames_since_keyframe = frame - keyframe + 1;
+}
+
+size_t hist_frame_count(history_p hist){
+	return hist->frame_count;
+}
+
+/**
+ * Number of bytes occupied by the recorded frames.
+ */
+size_t hist_bytes_used(history_p hist){
+	size_t bytes = 0;
+	for(size_t i = 0; i < hist->frame_count; i++)
+		bytes += hist_frame(hist, i)->size;
+	return bytes;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "model.h"
+
+/**
+
+Rewind buffer of recent simulation states.
+
+Frames are stored in one fixed size byte ring so memory use never exceeds byte_limit. Every
+keyframe_interval frames a keyframe with the raw particle and beam state is stored. Frames in between
+only store deltas to the previous frame:
+
+- Particle positions and velocities are quantized (pos_quantum, vel_quantum) and the differences to the
+  previous quantized values are written as zigzag varints. Usually that's one byte per component.
+- A bitset of beams whose flags changed (only present if any did) followed by their new flags.
+- A list of beams whose length changed (deformation) with their new length.
+
+Restoring a delta frame decodes everything from the keyframe before it. Frames are evicted a whole
+keyframe group at a time since deltas are useless without their keyframe.
+
+*/
+
+typedef struct {
+	size_t offset, size;
+	bool keyframe;
+} history_frame_t, *history_frame_p;
+
+typedef struct {
+	// Configuration, quanta can be changed before the first frame is recorded
+	size_t byte_limit, frame_limit, keyframe_interval;
+	float pos_quantum, vel_quantum;  // m, m_s
+	
+	// Byte ring with the encoded frames and the ring of frame descriptors
+	uint8_t *data;
+	size_t data_head;
+	history_frame_p frames;
+	size_t frame_first, frame_count, frames_since_keyframe;
+	
+	// Model layout the recorded frames belong to
+	size_t particle_count, beam_count;
+	
+	// Scratch buffer for encoding one frame
+	uint8_t *scratch;
+	size_t scratch_size;
+	
+	// Quantized state of the newest frame, deltas are calculated against it
+	int32_t *enc_quant;
+	uint8_t *enc_flags;
+	float *enc_length;
+	
+	// Quantized state of the frame last decoded by hist_restore()
+	int32_t *dec_quant;
+	uint8_t *dec_flags;
+	float *dec_length;
+	ssize_t dec_frame;
+} history_t, *history_p;
+
+
+history_p hist_new(size_t byte_limit, size_t frame_limit, size_t keyframe_interval);
+void hist_destroy(history_p hist);
+void hist_reset(history_p hist);
+
+void hist_record(history_p hist, model_p model);
+bool hist_restore(history_p hist, size_t frame, model_p model);
+void hist_resume(history_p hist, size_t frame);
+
+size_t hist_frame_count(history_p hist);
+size_t hist_bytes_used(history_p hist);
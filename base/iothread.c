@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "iothread.h"
+#include "alloc.h"
+
+
+typedef enum { IO_IDLE, IO_QUEUED, IO_RUNNING, IO_FINISHED } io_state_t;
+
+static pthread_t io_thread;
+static pthread_mutex_t io_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t io_cond = PTHREAD_COND_INITIALIZER;
+static io_state_t io_state = IO_IDLE;
+static io_job_p io_job = NULL;
+static bool io_quit = false;
+// Progress of the running load in per mille, written by the I/O thread only
+static volatile uint32_t io_permille = 0;
+// Snapshot of the last save, reused by the next one so its memory is already faulted in
+static model_p io_spare_snapshot = NULL;
+
+
+static void io_load_progress(size_t bytes_done, size_t bytes_total, void *data){
+	(void)data;
+	io_permille = (bytes_total > 0) ? (uint64_t)bytes_done * 1000 / bytes_total : 1000;
+}
+
+static void* io_thread_main(void *arg){
+	(void)arg;
+	mem_thread_background();
+	pthread_mutex_lock(&io_mutex);
+	while (true) {
+		while (io_state != IO_QUEUED && !io_quit)
+			pthread_cond_wait(&io_cond, &io_mutex);
+		if (io_quit)
+			break;
+		
+		io_job_p job = io_job;
+		io_state = IO_RUNNING;
+		pthread_mutex_unlock(&io_mutex);
+		
+		switch(job->op){
+			case IO_LOAD:
+				job->model = model_new();
+				if ( !model_load_progress(job->model, job->filename, io_load_progress, NULL) ){
+					model_destroy(job->model);
+					job->model = NULL;
+				}
+				break;
+			case IO_SAVE:
+				job->generation = model_write(job->model, job->filename);
+				break;
+		}
+		
+		pthread_mutex_lock(&io_mutex);
+		io_state = IO_FINISHED;
+	}
+	pthread_mutex_unlock(&io_mutex);
+	
+	return NULL;
+}
+
+static bool io_queue(io_job_p job){
+	pthread_mutex_lock(&io_mutex);
+	if (io_state != IO_IDLE){
+		pthread_mutex_unlock(&io_mutex);
+		return false;
+	}
+	
+	io_job = job;
+	io_state = IO_QUEUED;
+	io_permille = 0;
+	pthread_cond_signal(&io_cond);
+	pthread_mutex_unlock(&io_mutex);
+	return true;
+}
+
+
+void io_start(){
+	io_quit = false;
+	io_state = IO_IDLE;
+	pthread_create(&io_thread, NULL, io_thread_main, NULL);
+}
+
+/**
+ * Waits for the current job to complete and stops the I/O thread. A job that finished but wasn't picked
+ * up by io_done() is discarded.
+ */
+void io_stop(){
+	pthread_mutex_lock(&io_mutex);
+	io_quit = true;
+	pthread_cond_signal(&io_cond);
+	pthread_mutex_unlock(&io_mutex);
+	pthread_join(io_thread, NULL);
+	
+	if (io_job != NULL){
+		io_job_destroy(io_job);
+		io_job = NULL;
+	}
+	if (io_spare_snapshot != NULL){
+		model_destroy(io_spare_snapshot);
+		io_spare_snapshot = NULL;
+	}
+}
+
+/**
+ * Queues loading filename into a new model. Returns false if another job is still in progress.
+ */
+bool io_load(const char *filename){
+	io_job_p job = malloc(sizeof(io_job_t));
+	*job = (io_job_t){ .op = IO_LOAD, .filename = strdup(filename), .model = NULL, .origin = NULL, .generation = 0 };
+	
+	if ( !io_queue(job) ){
+		io_job_destroy(job);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Queues saving model as it is now to filename. The model is copied into the snapshot of the previous
+ * save (see model_snapshot_update()), so after the first save this only costs copying the particles
+ * (and the beams if the structure changed) into memory that is already mapped. A new journal for filename is started right away so
+ * edits done while the snapshot is written are not lost. Once the save is picked up by io_done() the
+ * journal has to be attached with model_journal_attach().
+ * 
+ * Returns false if another job is still in progress.
+ */
+bool io_save(model_p model, const char *filename){
+	pthread_mutex_lock(&io_mutex);
+	bool busy = (io_state != IO_IDLE);
+	pthread_mutex_unlock(&io_mutex);
+	if (busy)
+		return false;
+	
+	io_job_p job = malloc(sizeof(io_job_t));
+	*job = (io_job_t){ .op = IO_SAVE, .filename = strdup(filename), .model = NULL, .origin = model, .generation = 0 };
+	job->model = model_snapshot_update(io_spare_snapshot ? io_spare_snapshot : model_new(), model);
+	io_spare_snapshot = NULL;
+	model_journal_begin(model, filename);
+	
+	// Only the main thread queues jobs so the I/O thread can't have become busy in the meantime
+	io_queue(job);
+	return true;
+}
+
+bool io_busy(){
+	pthread_mutex_lock(&io_mutex);
+	bool busy = (io_state != IO_IDLE);
+	pthread_mutex_unlock(&io_mutex);
+	return busy;
+}
+
+/**
+ * Progress of the current load in the range [0, 1].
+ */
+float io_progress(){
+	return io_permille / 1000.0;
+}
+
+/**
+ * Returns the finished job or NULL if there is none. The caller owns the job afterwards and frees it
+ * with io_job_destroy(). job->model of a load is NULL if loading failed. Set it to NULL when taking
+ * over the model.
+ */
+io_job_p io_done(){
+	io_job_p job = NULL;
+	
+	pthread_mutex_lock(&io_mutex);
+	if (io_state == IO_FINISHED){
+		job = io_job;
+		io_job = NULL;
+		io_state = IO_IDLE;
+	}
+	pthread_mutex_unlock(&io_mutex);
+	
+	return job;
+}
+
+void io_job_destroy(io_job_p job){
+	// Keep the snapshot of a save for the next one
+	if (job->op == IO_SAVE && io_spare_snapshot == NULL) {
+		io_spare_snapshot = job->model;
+		job->model = NULL;
+	}
+	if (job->model != NULL)
+		model_destroy(job->model);
+	free(job->filename);
+	free(job);
+}
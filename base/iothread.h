@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include "model.h"
+
+/**
+
+Background thread for model loading and saving. Only one job runs at a time. The main loop queues a
+job with io_load() or io_save() and calls io_done() between frames to pick up the result.
+
+Saves copy the model on the main thread and write the copy on the I/O thread, so the simulation can
+continue while the file is written. The copy reuses the snapshot of the previous save, only the
+particles (and the beams after structural changes) are copied into memory that is already faulted in.
+Loads build a new model that the main loop swaps in once io_done() returns it.
+
+*/
+
+typedef enum { IO_LOAD, IO_SAVE } io_op_t;
+
+typedef struct {
+	io_op_t op;
+	char *filename;
+	// Load: the newly loaded model. Save: the snapshot that was written.
+	model_p model;
+	// Save: the model that was saved and the generation written (0 on error)
+	model_p origin;
+	uint32_t generation;
+} io_job_t, *io_job_p;
+
+
+void io_start();
+void io_stop();
+
+bool io_load(const char *filename);
+bool io_save(model_p model, const char *filename);
+
+bool io_busy();
+float io_progress();
+io_job_p io_done();
+void io_job_destroy(io_job_p job);
@@ -0,0 +1,444 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "jobs.h"
+
+
+// Spins of an idle worker before it goes to sleep
+#define JOB_SPINS 2048
+
+typedef struct {
+	// Chase-Lev deque: the owner pushes and pops at bottom, thieves take from top
+	int64_t top;
+	char pad1[56];
+	int64_t bottom;
+	char pad2[56];
+	job_p slots[JOB_DEQUE_SIZE];
+	
+	pthread_t thread;
+	pid_t tid;  // kernel thread id, 0 until the worker started
+	size_t index;
+	uint32_t rng;  // victim selection
+} __attribute__((aligned(64))) job_worker_t, *job_worker_p;
+
+static job_worker_p job_workers = NULL;
+static size_t job_threads = 1;  // workers including the thread that called job_start()
+static bool job_pin = false;
+static volatile bool job_quit = false;
+
+// Idle workers sleep on this condition, pushes wake them if job_sleepers isn't 0
+static pthread_mutex_t job_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+static uint32_t job_sleepers = 0;
+
+static __thread job_worker_p job_self = NULL;
+static __thread job_p job_pool = NULL;
+static __thread size_t job_pool_next = 0;
+
+
+static void job_relax(){
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#else
+	sched_yield();
+#endif
+}
+
+static void job_lock(job_p job){
+	while ( __atomic_test_and_set(&job->lock, __ATOMIC_ACQUIRE) )
+		job_relax();
+}
+
+static void job_unlock(job_p job){
+	__atomic_clear(&job->lock, __ATOMIC_RELEASE);
+}
+
+
+//
+// Deque
+//
+
+static bool job_push(job_worker_p w, job_p job){
+	int64_t b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED);
+	int64_t t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+	if (b - t >= JOB_DEQUE_SIZE)
+		return false;
+	
+	__atomic_store_n(&w->slots[b & (JOB_DEQUE_SIZE - 1)], job, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+static job_p job_pop(job_worker_p w){
+	int64_t b = __atomic_load_n(&w->bottom, __ATOMIC_RELAXED) - 1;
+	__atomic_store_n(&w->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int64_t t = __atomic_load_n(&w->top, __ATOMIC_RELAXED);
+	
+	if (t > b) {
+		__atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	
+	job_p job = __atomic_load_n(&w->slots[b & (JOB_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+	if (t == b) {
+		// Last job, race the thieves for it
+		if ( !__atomic_compare_exchange_n(&w->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED) )
+			job = NULL;
+		__atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+	}
+	return job;
+}
+
+static job_p job_steal(job_worker_p w){
+	int64_t t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	int64_t b = __atomic_load_n(&w->bottom, __ATOMIC_ACQUIRE);
+	if (t >= b)
+		return NULL;
+	
+	job_p job = __atomic_load_n(&w->slots[t & (JOB_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+	if ( !__atomic_compare_exchange_n(&w->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED) )
+		return NULL;
+	return job;
+}
+
+static bool job_available(){
+	for(size_t i = 0; i < job_threads; i++){
+		if ( __atomic_load_n(&job_workers[i].top, __ATOMIC_ACQUIRE) < __atomic_load_n(&job_workers[i].bottom, __ATOMIC_ACQUIRE) )
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Returns a job of the own deque or one stolen from another worker, NULL if there is none.
+ */
+static job_p job_next(){
+	job_worker_p self = job_self;
+	if (self) {
+		job_p job = job_pop(self);
+		if (job)
+			return job;
+	}
+	if (job_workers == NULL)
+		return NULL;
+	
+	uint32_t r = self ? (self->rng = self->rng * 1664525 + 1013904223) >> 8 : 0;
+	for(size_t i = 0; i < job_threads; i++){
+		job_worker_p victim = &job_workers[(r + i) % job_threads];
+		if (victim == self)
+			continue;
+		job_p job = job_steal(victim);
+		if (job)
+			return job;
+	}
+	return NULL;
+}
+
+
+//
+// Execution
+//
+
+static void job_submit(job_p job);
+
+static void job_finish(job_p job){
+	if ( __atomic_sub_fetch(&job->unfinished, 1, __ATOMIC_ACQ_REL) != 0 )
+		return;
+	
+	job_lock(job);
+	job->closed = true;
+	size_t dependent_count = job->dependent_count;
+	job_unlock(job);
+	
+	for(size_t i = 0; i < dependent_count; i++)
+		job_run(job->dependents[i]);
+	
+	// The job can be recycled as soon as it's done, read everything needed before
+	job_p parent = job->parent;
+	__atomic_store_n(&job->done, true, __ATOMIC_RELEASE);
+	if (parent)
+		job_finish(parent);
+}
+
+static void job_execute(job_p job){
+	if (job->func)
+		job->func(job, job->data);
+	job_finish(job);
+}
+
+/**
+ * Queues a job whose dependencies are finished. Threads that aren't workers and workers with a full
+ * deque run it right away.
+ */
+static void job_submit(job_p job){
+	if ( job_self == NULL || !job_push(job_self, job) ) {
+		job_execute(job);
+		return;
+	}
+	
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if ( __atomic_load_n(&job_sleepers, __ATOMIC_RELAXED) > 0 ) {
+		pthread_mutex_lock(&job_mutex);
+		pthread_cond_signal(&job_cond);
+		pthread_mutex_unlock(&job_mutex);
+	}
+}
+
+static void job_pin_thread(size_t index){
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(index % (cpus > 0 ? cpus : 1), &set);
+	if ( pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0 )
+		fprintf(stderr, "jobs: failed to pin worker %zu\n", index);
+}
+
+static void* job_worker_main(void *arg){
+	job_worker_p self = arg;
+	job_self = self;
+	__atomic_store_n(&self->tid, (pid_t)syscall(SYS_gettid), __ATOMIC_RELEASE);
+	if (job_pin)
+		job_pin_thread(self->index);
+	
+	size_t spins = 0;
+	while ( !__atomic_load_n(&job_quit, __ATOMIC_ACQUIRE) ) {
+		job_p job = job_next();
+		if (job) {
+			job_execute(job);
+			spins = 0;
+			continue;
+		}
+		
+		if (++spins < JOB_SPINS) {
+			job_relax();
+			continue;
+		}
+		
+		// Sleep until a push wakes us. Counting ourselves as sleeper before checking the deques again
+		// makes sure a push in between either sees us or is seen by us.
+		pthread_mutex_lock(&job_mutex);
+		__atomic_add_fetch(&job_sleepers, 1, __ATOMIC_SEQ_CST);
+		if ( !job_available() && !__atomic_load_n(&job_quit, __ATOMIC_ACQUIRE) )
+			pthread_cond_wait(&job_cond, &job_mutex);
+		__atomic_sub_fetch(&job_sleepers, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&job_mutex);
+		spins = 0;
+	}
+	
+	free(job_pool);
+	job_pool = NULL;
+	return NULL;
+}
+
+
+//
+// Public interface
+//
+
+/**
+ * Starts threads - 1 workers, the calling thread is the first one. 0 threads uses one per CPU. pin
+ * binds each worker to one CPU.
+ */
+bool job_start(size_t threads, bool pin){
+	if (job_workers)
+		job_stop();
+	if (threads == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (cpus > 0) ? cpus : 1;
+	}
+	
+	if ( posix_memalign((void**)&job_workers, 64, sizeof(job_worker_t) * threads) != 0 ) {
+		job_workers = NULL;
+		return false;
+	}
+	memset(job_workers, 0, sizeof(job_worker_t) * threads);
+	job_threads = threads;
+	job_pin = pin;
+	job_quit = false;
+	
+	for(size_t i = 0; i < threads; i++){
+		job_workers[i].index = i;
+		job_workers[i].rng = 0x9e3779b9 * (i + 1);
+	}
+	
+	job_self = &job_workers[0];
+	job_workers[0].tid = syscall(SYS_gettid);
+	if (pin)
+		job_pin_thread(0);
+	for(size_t i = 1; i < threads; i++){
+		if ( pthread_create(&job_workers[i].thread, NULL, job_worker_main, &job_workers[i]) != 0 ) {
+			fprintf(stderr, "jobs: failed to start worker %zu\n", i);
+			job_threads = i;
+			break;
+		}
+	}
+	return job_threads == threads;
+}
+
+/**
+ * Stops all workers. No jobs may be queued anymore.
+ */
+void job_stop(){
+	if (job_workers == NULL)
+		return;
+	
+	pthread_mutex_lock(&job_mutex);
+	__atomic_store_n(&job_quit, true, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&job_cond);
+	pthread_mutex_unlock(&job_mutex);
+	for(size_t i = 1; i < job_threads; i++)
+		pthread_join(job_workers[i].thread, NULL);
+	
+	free(job_workers);
+	job_workers = NULL;
+	job_self = NULL;
+	job_threads = 1;
+}
+
+size_t job_thread_count(){
+	return job_threads;
+}
+
+/**
+ * Kernel thread id of worker index (e.g. to count it with pc_attach()), 0 without started workers.
+ * Waits until the worker is running.
+ */
+pid_t job_thread_id(size_t index){
+	if (job_workers == NULL || index >= job_threads)
+		return 0;
+	
+	pid_t tid;
+	while ( (tid = __atomic_load_n(&job_workers[index].tid, __ATOMIC_ACQUIRE)) == 0 )
+		job_relax();
+	return tid;
+}
+
+/**
+ * Creates a job that runs func(job, data) once job_run() was called and all its dependencies are
+ * finished. If parent isn't NULL the parent only finishes after this job.
+ */
+job_p job_create(job_func_t func, void *data, job_p parent){
+	if (job_pool == NULL) {
+		if ( posix_memalign((void**)&job_pool, 64, sizeof(job_t) * JOB_POOL_SIZE) != 0 ) {
+			fprintf(stderr, "jobs: out of memory\n");
+			abort();
+		}
+		for(size_t i = 0; i < JOB_POOL_SIZE; i++)
+			job_pool[i].done = true;
+	}
+	
+	// Only happens with more than JOB_POOL_SIZE jobs of this thread in flight
+	job_p job = &job_pool[job_pool_next++ & (JOB_POOL_SIZE - 1)];
+	job_wait(job);
+	
+	job->func = func;
+	job->data = data;
+	job->begin = job->end = 0;
+	job->parent = parent;
+	job->unfinished = 1;
+	job->dependencies = 1;
+	job->done = false;
+	job->lock = 0;
+	job->closed = false;
+	job->dependent_count = 0;
+	if (parent)
+		__atomic_add_fetch(&parent->unfinished, 1, __ATOMIC_RELAXED);
+	return job;
+}
+
+/**
+ * job is run only after dependency (including its children) is finished. Has to be called before
+ * job_run(job).
+ */
+void job_after(job_p job, job_p dependency){
+	job_lock(dependency);
+	if ( !dependency->closed ) {
+		if (dependency->dependent_count >= JOB_MAX_DEPENDENTS) {
+			fprintf(stderr, "jobs: more than %d jobs depend on one job\n", JOB_MAX_DEPENDENTS);
+			abort();
+		}
+		dependency->dependents[dependency->dependent_count++] = job;
+		__atomic_add_fetch(&job->dependencies, 1, __ATOMIC_RELAXED);
+	}
+	job_unlock(dependency);
+}
+
+void job_run(job_p job){
+	if ( __atomic_sub_fetch(&job->dependencies, 1, __ATOMIC_ACQ_REL) == 0 )
+		job_submit(job);
+}
+
+/**
+ * Waits until job is finished and executes other jobs in the meantime.
+ */
+void job_wait(job_p job){
+	while ( !__atomic_load_n(&job->done, __ATOMIC_ACQUIRE) ) {
+		job_p other = job_next();
+		if (other)
+			job_execute(other);
+		else
+			job_relax();
+	}
+}
+
+
+//
+// Parallel for
+//
+
+typedef struct {
+	job_range_func_t func;
+	void *data;
+	size_t grain;
+	job_p root;
+} job_for_t, *job_for_p;
+
+// Hands the upper half to another job until the range is small enough, then runs the rest
+static void job_for_split(job_p job, void *data){
+	job_for_p f = data;
+	size_t begin = job->begin, end = job->end;
+	while (end - begin > f->grain) {
+		size_t middle = begin + (end - begin) / 2;
+		job_p upper = job_create(job_for_split, f, f->root);
+		upper->begin = middle;
+		upper->end = end;
+		job_run(upper);
+		end = middle;
+	}
+	f->func(begin, end, f->data);
+}
+
+/**
+ * Calls func(begin, end, data) for pieces of [0, count) in parallel and returns once all are done.
+ * min_chunk keeps pieces from getting smaller than the per job overhead is worth.
+ */
+void job_parallel_for(size_t count, size_t min_chunk, job_range_func_t func, void *data){
+	if (count == 0)
+		return;
+	
+	size_t grain = count / (job_threads * JOB_CHUNKS_PER_THREAD);
+	if (grain < min_chunk)
+		grain = min_chunk;
+	if (grain < 1)
+		grain = 1;
+	if (job_threads <= 1 || job_self == NULL || count <= grain) {
+		func(0, count, data);
+		return;
+	}
+	
+	job_for_t f = { func, data, grain, NULL };
+	f.root = job_create(job_for_split, &f, NULL);
+	f.root->begin = 0;
+	f.root->end = count;
+	job_run(f.root);
+	job_wait(f.root);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+
+Work stealing job system. job_start() turns the calling thread into worker 0 and starts the other
+workers. Every worker has a deque of jobs: it pushes and pops its own jobs at the bottom (LIFO, the
+data is still in the cache), idle workers steal from the top of a random other deque (FIFO, the
+biggest pieces of work). Workers spin for a short while before they sleep, so bursts of small jobs
+don't pay for a wakeup each.
+	
+	job_p root = job_create(func, data, NULL);
+	job_run(root);
+	job_wait(root);
+
+A job is finished when its function returned and all its children (jobs created with it as parent)
+are finished. job_after() makes a job wait for another one before it's run. job_wait() executes other
+jobs while it waits, so it can be called from within jobs.
+
+Jobs come from a per thread ring of JOB_POOL_SIZE jobs and are recycled once finished, creating one
+never allocates. Don't use a job after it was waited for.
+
+job_parallel_for() is the common case: it splits a range in halves until the pieces are small enough
+(about JOB_CHUNKS_PER_THREAD pieces per thread, at least min_chunk elements) and waits until all of
+them are done. Without started workers, or when called from a thread that isn't a worker, everything
+runs inline on the calling thread.
+
+*/
+
+#define JOB_POOL_SIZE 4096
+#define JOB_DEQUE_SIZE 4096
+#define JOB_MAX_DEPENDENTS 8
+#define JOB_CHUNKS_PER_THREAD 8
+
+typedef struct job_s job_t, *job_p;
+typedef void (*job_func_t)(job_p job, void *data);
+typedef void (*job_range_func_t)(size_t begin, size_t end, void *data);
+
+struct job_s {
+	job_func_t func;
+	void *data;
+	size_t begin, end;  // range of job_parallel_for(), free to use by other jobs
+	job_p parent;
+	uint32_t unfinished;  // the job itself and its unfinished children
+	uint32_t dependencies;  // unfinished dependencies, +1 until job_run() is called
+	bool done;
+	
+	// Jobs waiting for this one, closed once it's finished
+	char lock;
+	bool closed;
+	size_t dependent_count;
+	job_p dependents[JOB_MAX_DEPENDENTS];
+} __attribute__((aligned(64)));
+
+
+bool job_start(size_t threads, bool pin);
+void job_stop();
+size_t job_thread_count();
+pid_t job_thread_id(size_t index);
+
+job_p job_create(job_func_t func, void *data, job_p parent);
+void job_after(job_p job, job_p dependency);
+void job_run(job_p job);
+void job_wait(job_p job);
+
+void job_parallel_for(size_t count, size_t min_chunk, job_range_func_t func, void *data);
@@ -0,0 +1,415 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#define __USE_XOPEN 1
+#include <math.h>
+
+#include "meshgen.h"
+
+
+static const char *mg_kind_names[] = { "truss", "lattice", "frigates", "hull" };
+
+// Grid points of one structure and the particles created for them
+typedef struct {
+	model_p model;
+	size_t cols, rows;  // points
+	size_t *index;  // particle index of each point, SIZE_MAX if the point is unused
+	vec2_t *pos;
+} mg_grid_t, *mg_grid_p;
+
+
+mg_params_t mg_defaults(mg_kind_t kind){
+	mg_params_t params = {
+		.kind = kind,
+		.w = 100, .h = 4,
+		.frigate_length = 8,
+		.spacing = 1, .jitter = 0.15,
+		.thrusters = THRUSTER_BACK | THRUSTER_FRONT | THRUSTER_LEFT | THRUSTER_RIGHT,
+		.thruster_every = 4,
+		.seed = 1,
+		.modulus_of_elasticity = 210e5, .beam_profile_area = 0.0001,
+		.deform_threshold = 0.05, .break_threshold = 0.075,
+		.mass = 1, .thruster_force = 10
+	};
+	
+	switch(kind){
+		case MG_TRUSS:    params.w = 100; params.h = 4;   break;
+		case MG_LATTICE:  params.w = 100; params.h = 100; break;
+		case MG_FRIGATES: params.w = 10;  params.h = 10;  break;
+		case MG_HULL:     params.w = 120; params.h = 40;  break;
+	}
+	return params;
+}
+
+/**
+ * Picks w and h so the structure has roughly the given number of particles.
+ */
+void mg_size_for(mg_params_p params, size_t particles){
+	switch(params->kind){
+		case MG_TRUSS:
+			params->w = particles / (params->h + 1);
+			break;
+		case MG_LATTICE:
+			params->w = params->h = sqrt(particles);
+			break;
+		case MG_FRIGATES: {
+			size_t per_frigate = (params->frigate_length + 1) * 4;
+			size_t tiles = particles / per_frigate;
+			params->w = ceil(sqrt(tiles));
+			params->h = (params->w > 0) ? tiles / params->w : 0;
+			} break;
+		case MG_HULL:
+			// w = 3h and about half of the bounding box is inside the outline
+			params->h = sqrt(particles / (0.5 * 3));
+			params->w = params->h * 3;
+			break;
+	}
+	
+	if (params->w < 1) params->w = 1;
+	if (params->h < 1) params->h = 1;
+}
+
+/**
+ * Parses one "key=value" option into params. particles=n has to come after the kind specific options
+ * it depends on (e.g. h for trusses). Returns false for unknown keys.
+ */
+bool mg_parse(mg_params_p params, const char *arg){
+	const char *eq = strchr(arg, '=');
+	if (eq == NULL)
+		return false;
+	
+	size_t key_len = eq - arg;
+	const char *value = eq + 1;
+	#define KEY(name) (key_len == strlen(name) && strncmp(arg, name, key_len) == 0)
+	
+	if      ( KEY("w") )         params->w = strtoull(value, NULL, 10);
+	else if ( KEY("h") )         params->h = strtoull(value, NULL, 10);
+	else if ( KEY("length") )    params->frigate_length = strtoull(value, NULL, 10);
+	else if ( KEY("particles") ) mg_size_for(params, strtoull(value, NULL, 10));
+	else if ( KEY("spacing") )   params->spacing = strtof(value, NULL);
+	else if ( KEY("jitter") )    params->jitter = strtof(value, NULL);
+	else if ( KEY("thrusters") ) params->thrusters = strtoul(value, NULL, 16);
+	else if ( KEY("every") )     params->thruster_every = strtoull(value, NULL, 10);
+	else if ( KEY("seed") )      params->seed = strtoul(value, NULL, 10);
+	else if ( KEY("E") )         params->modulus_of_elasticity = strtof(value, NULL);
+	else if ( KEY("A") )         params->beam_profile_area = strtof(value, NULL);
+	else if ( KEY("deform") )    params->deform_threshold = strtof(value, NULL);
+	else if ( KEY("break") )     params->break_threshold = strtof(value, NULL);
+	else if ( KEY("mass") )      params->mass = strtof(value, NULL);
+	else if ( KEY("force") )     params->thruster_force = strtof(value, NULL);
+	else
+		return false;
+	
+	#undef KEY
+	if (params->thruster_every < 1)
+		params->thruster_every = 1;
+	return true;
+}
+
+
+//
+// Grid helpers
+//
+
+static uint32_t mg_random(uint32_t *state){
+	// xorshift32, good enough for jitter and outlines and reproducible across platforms
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static float mg_random_float(uint32_t *state, float min, float max){
+	return min + (max - min) * (mg_random(state) / 4294967296.0);
+}
+
+static void mg_grid_init(mg_grid_p grid, model_p model, size_t cols, size_t rows){
+	grid->model = model;
+	grid->cols = cols;
+	grid->rows = rows;
+	grid->index = realloc(grid->index, sizeof(size_t) * cols * rows);
+	grid->pos = realloc(grid->pos, sizeof(vec2_t) * cols * rows);
+	for(size_t i = 0; i < cols * rows; i++)
+		grid->index[i] = SIZE_MAX;
+}
+
+static size_t mg_at(mg_grid_p grid, size_t i, size_t j){
+	if (i >= grid->cols || j >= grid->rows)
+		return SIZE_MAX;
+	return grid->index[j * grid->cols + i];
+}
+
+static void mg_point(mg_grid_p grid, size_t i, size_t j, float mass){
+	vec2_t pos = grid->pos[j * grid->cols + i];
+	grid->index[j * grid->cols + i] = grid->model->particle_count;
+	model_add_particle(grid->model, pos.x, pos.y, mass);
+}
+
+static void mg_link(mg_grid_p grid, size_t i1, size_t j1, size_t i2, size_t j2){
+	size_t a = mg_at(grid, i1, j1), b = mg_at(grid, i2, j2);
+	if (a != SIZE_MAX && b != SIZE_MAX)
+		model_add_beam(grid->model, a, b);
+}
+
+static bool mg_thruster(mg_grid_p grid, size_t i1, size_t j1, size_t i2, size_t j2, mg_params_p params, uint8_t group){
+	size_t a = mg_at(grid, i1, j1), b = mg_at(grid, i2, j2);
+	if (a == SIZE_MAX || b == SIZE_MAX)
+		return false;
+	model_add_thruster(grid->model, a, b, params->thruster_force, group);
+	return true;
+}
+
+/**
+ * Places the thruster groups of params->thrusters on the used points of the grid. The thrust points
+ * from the first to the second particle, so back thrusters go from the rear point of a row to its
+ * neighbour and so on.
+ */
+static void mg_place_thrusters(mg_grid_p grid, mg_params_p params){
+	for(size_t j = 0; j < grid->rows; j += params->thruster_every){
+		size_t first = SIZE_MAX, last = SIZE_MAX;
+		for(size_t i = 0; i < grid->cols; i++){
+			if (mg_at(grid, i, j) == SIZE_MAX)
+				continue;
+			if (first == SIZE_MAX)
+				first = i;
+			last = i;
+		}
+		if (first == SIZE_MAX || first == last)
+			continue;
+		
+		if (params->thrusters & THRUSTER_BACK)
+			mg_thruster(grid, first, j, first + 1, j, params, THRUSTER_BACK);
+		if (params->thrusters & THRUSTER_FRONT)
+			mg_thruster(grid, last, j, last - 1, j, params, THRUSTER_FRONT);
+	}
+	
+	// Steering thrusters on the frontmost column that has a vertical pair of points
+	bool left = !(params->thrusters & THRUSTER_LEFT), right = !(params->thrusters & THRUSTER_RIGHT);
+	for(size_t i = grid->cols; i-- > 0 && !(left && right); ){
+		for(size_t j = 0; j + 1 < grid->rows && !left; j++)
+			left = mg_thruster(grid, i, j, i, j + 1, params, THRUSTER_LEFT);
+		for(size_t j = grid->rows - 1; j > 0 && !right; j--)
+			right = mg_thruster(grid, i, j, i, j - 1, params, THRUSTER_RIGHT);
+	}
+}
+
+
+//
+// Structures
+//
+
+static void mg_truss(mg_grid_p grid, mg_params_p params, vec2_t origin, size_t w, size_t h, bool cross_braced){
+	mg_grid_init(grid, grid->model, w + 1, h + 1);
+	for(size_t j = 0; j <= h; j++){
+		for(size_t i = 0; i <= w; i++){
+			grid->pos[j * grid->cols + i] = (vec2_t){ origin.x + i * params->spacing, origin.y + j * params->spacing };
+			mg_point(grid, i, j, params->mass);
+		}
+	}
+	
+	for(size_t j = 0; j <= h; j++){
+		for(size_t i = 0; i <= w; i++){
+			mg_link(grid, i, j, i + 1, j);
+			mg_link(grid, i, j, i, j + 1);
+			if (i == w || j == h)
+				continue;
+			
+			if (cross_braced || i % 2 == 0)
+				mg_link(grid, i, j, i + 1, j + 1);
+			if (cross_braced || i % 2 == 1)
+				mg_link(grid, i + 1, j, i, j + 1);
+		}
+	}
+	
+	mg_place_thrusters(grid, params);
+}
+
+static void mg_lattice(mg_grid_p grid, mg_params_p params){
+	size_t w = params->w, h = params->h;
+	float row_height = params->spacing * sqrt(3) / 2;
+	
+	mg_grid_init(grid, grid->model, w + 1, h + 1);
+	for(size_t j = 0; j <= h; j++){
+		for(size_t i = 0; i <= w; i++){
+			grid->pos[j * grid->cols + i] = (vec2_t){ (i + (j % 2) * 0.5) * params->spacing, j * row_height };
+			mg_point(grid, i, j, params->mass);
+		}
+	}
+	
+	// Odd rows are shifted right, so their upper neighbours are i and i + 1. Even rows connect to i - 1
+	// and i.
+	for(size_t j = 0; j <= h; j++){
+		for(size_t i = 0; i <= w; i++){
+			mg_link(grid, i, j, i + 1, j);
+			mg_link(grid, i, j, i, j + 1);
+			if (j % 2 == 1)
+				mg_link(grid, i, j, i + 1, j + 1);
+			else if (i > 0)
+				mg_link(grid, i, j, i - 1, j + 1);
+		}
+	}
+	
+	mg_place_thrusters(grid, params);
+}
+
+/**
+ * Positive if d lies inside the circumcircle of the counter clockwise triangle a, b, c.
+ */
+static double mg_incircle(vec2_t a, vec2_t b, vec2_t c, vec2_t d){
+	double adx = a.x - d.x, ady = a.y - d.y;
+	double bdx = b.x - d.x, bdy = b.y - d.y;
+	double cdx = c.x - d.x, cdy = c.y - d.y;
+	return (adx * adx + ady * ady) * (bdx * cdy - cdx * bdy)
+		- (bdx * bdx + bdy * bdy) * (adx * cdy - cdx * ady)
+		+ (cdx * cdx + cdy * cdy) * (adx * bdy - bdx * ady);
+}
+
+static void mg_hull(mg_grid_p grid, mg_params_p params){
+	size_t w = params->w, h = params->h, cols = w + 1, rows = h + 1;
+	uint32_t rng = params->seed ? params->seed : 1;
+	mg_grid_init(grid, grid->model, cols, rows);
+	
+	// Outline: ellipse around the grid whose radius varies by a few random harmonics between 0.6 and 1
+	float amplitude[4], phase[4];
+	for(size_t k = 0; k < 4; k++){
+		amplitude[k] = mg_random_float(&rng, 0, 0.05);
+		phase[k] = mg_random_float(&rng, 0, 2 * M_PI);
+	}
+	vec2_t center = { w * params->spacing / 2, h * params->spacing / 2 };
+	
+	bool *inside = malloc(sizeof(bool) * cols * rows);
+	for(size_t j = 0; j < rows; j++){
+		for(size_t i = 0; i < cols; i++){
+			vec2_t pos = {
+				(i + mg_random_float(&rng, -params->jitter, params->jitter)) * params->spacing,
+				(j + mg_random_float(&rng, -params->jitter, params->jitter)) * params->spacing
+			};
+			grid->pos[j * cols + i] = pos;
+			
+			vec2_t q = { (pos.x - center.x) / center.x, (pos.y - center.y) / center.y };
+			float angle = atan2f(q.y, q.x), radius = 0.8;
+			for(size_t k = 0; k < 4; k++)
+				radius += amplitude[k] * cosf((k + 2) * angle + phase[k]);
+			inside[j * cols + i] = (v2_length(q) < radius);
+		}
+	}
+	
+	// A cell is part of the hull if all its corners are inside, points are only used by such cells
+	bool *cell = calloc(cols * rows, sizeof(bool));
+	for(size_t j = 0; j < h; j++){
+		for(size_t i = 0; i < w; i++)
+			cell[j * cols + i] = inside[j * cols + i] && inside[j * cols + i + 1] && inside[(j + 1) * cols + i] && inside[(j + 1) * cols + i + 1];
+	}
+	#define CELL(i, j) ( (i) < w && (j) < h && cell[(j) * cols + (i)] )
+	
+	for(size_t j = 0; j < rows; j++){
+		for(size_t i = 0; i < cols; i++){
+			if ( CELL(i, j) || CELL(i - 1, j) || CELL(i, j - 1) || CELL(i - 1, j - 1) )
+				mg_point(grid, i, j, params->mass);
+		}
+	}
+	
+	for(size_t j = 0; j < rows; j++){
+		for(size_t i = 0; i < cols; i++){
+			if ( CELL(i, j) || CELL(i, j - 1) )
+				mg_link(grid, i, j, i + 1, j);
+			if ( CELL(i, j) || CELL(i - 1, j) )
+				mg_link(grid, i, j, i, j + 1);
+			
+			if ( !CELL(i, j) )
+				continue;
+			vec2_t a = grid->pos[j * cols + i], b = grid->pos[j * cols + i + 1];
+			vec2_t c = grid->pos[(j + 1) * cols + i + 1], d = grid->pos[(j + 1) * cols + i];
+			if (mg_incircle(a, b, c, d) > 0)
+				mg_link(grid, i + 1, j, i, j + 1);
+			else
+				mg_link(grid, i, j, i + 1, j + 1);
+		}
+	}
+	
+	#undef CELL
+	free(cell);
+	free(inside);
+	mg_place_thrusters(grid, params);
+}
+
+
+/**
+ * Builds a new model from params. The material parameters are set like model_load() would set them
+ * from the "g" line.
+ */
+model_p mg_generate(mg_params_p params){
+	model_p model = model_new();
+	model->modulus_of_elasticity = params->modulus_of_elasticity;
+	model->beam_profile_area = params->beam_profile_area;
+	model->deform_threshold = params->deform_threshold;
+	model->break_threshold = params->break_threshold;
+	
+	mg_grid_t grid = { .model = model, .index = NULL, .pos = NULL };
+	switch(params->kind){
+		case MG_TRUSS:
+			mg_truss(&grid, params, (vec2_t){0, 0}, params->w, params->h, false);
+			break;
+		case MG_LATTICE:
+			mg_lattice(&grid, params);
+			break;
+		case MG_FRIGATES:
+			// Two cells of space between the frigates
+			for(size_t y = 0; y < params->h; y++){
+				for(size_t x = 0; x < params->w; x++){
+					vec2_t origin = { x * (params->frigate_length + 2) * params->spacing, y * (3 + 2) * params->spacing };
+					mg_truss(&grid, params, origin, params->frigate_length, 3, true);
+				}
+			}
+			break;
+		case MG_HULL:
+			mg_hull(&grid, params);
+			break;
+	}
+	
+	free(grid.index);
+	free(grid.pos);
+	return model;
+}
+
+/**
+ * Writes the model as mesh file with a "g" line built from params.
+ */
+bool mg_write(model_p model, mg_params_p params, const char *filename){
+	FILE *file = fopen(filename, "w");
+	if (file == NULL){
+		perror("mg_write: fopen");
+		return false;
+	}
+	setvbuf(file, NULL, _IOFBF, 1024 * 1024);
+	
+	fprintf(file, "# %s %zu x %zu, spacing %g, seed %u: %zu particles, %zu beams, %zu thrusters\n",
+		mg_kind_names[params->kind], params->w, params->h, params->spacing, params->seed,
+		model->particle_count, model->beam_count, model->thruster_count);
+	fprintf(file, "# modulus_of_elasticity (N_m2), beam_profile_area (m2), deform_threshold (m), break_threshold (m), particle_mass (kg), thruster_force (N)\n");
+	fprintf(file, "g %g %g %g %g %g %g\n", params->modulus_of_elasticity, params->beam_profile_area,
+		params->deform_threshold, params->break_threshold, params->mass, params->thruster_force);
+	
+	for(size_t i = 0; i < model->particle_count; i++){
+		particle_p p = &model->particles[i];
+		fprintf(file, "p %f %f %f\n", p->pos.x, p->pos.y, p->mass);
+	}
+	
+	for(size_t i = 0; i < model->beam_count; i++){
+		beam_p beam = &model->beams[i];
+		fprintf(file, "b %zu %zu\n", beam->i1, beam->i2);
+	}
+	
+	for(size_t i = 0; i < model->thruster_count; i++){
+		thruster_p t = &model->thrusters[i];
+		fprintf(file, "t %zu %zu %f %x\n", t->i1, t->i2, t->force, t->controlled_by);
+	}
+	
+	if ( fclose(file) != 0 ){
+		perror("mg_write: fclose");
+		return false;
+	}
+	return true;
+}
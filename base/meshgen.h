@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "model.h"
+
+/**
+
+Procedural meshes for benchmarks at production scale. All kinds are built on a grid of points, w x h
+is the number of cells:
+
+- MG_TRUSS: Rectangular truss, one diagonal per cell alternating between columns.
+- MG_LATTICE: Triangular lattice, every row is shifted by half the spacing. Each point is connected to
+  its up to 6 neighbours.
+- MG_FRIGATES: w x h separate frigates, each a cross braced truss of frigate_length x 3 cells.
+- MG_HULL: Delaunay triangulation of a jittered grid inside a random star shaped outline. Each cell
+  is split along the diagonal that satisfies the empty circumcircle condition, which gives the exact
+  Delaunay triangulation as long as the jitter stays below 0.2 of the spacing.
+
+The front of every structure points to +x. Thrusters are placed on the grid points of the structure
+(of each frigate): back thrusters on the rear edge pointing forward, front thrusters on the front edge
+pointing backwards and left/right thrusters at the front pointing sideways. Back and front thrusters
+are placed every thruster_every rows.
+
+Particle mass and thruster force are the values model_load() uses for every particle and thruster.
+They are written into the "g" line together with the material parameters.
+
+*/
+
+typedef enum { MG_TRUSS, MG_LATTICE, MG_FRIGATES, MG_HULL } mg_kind_t;
+
+typedef struct {
+	mg_kind_t kind;
+	size_t w, h;  // cells (frigates: tiles)
+	size_t frigate_length;  // cells
+	float spacing, jitter;  // m, jitter relative to spacing
+	uint8_t thrusters;  // THRUSTER_* flags of the groups to place
+	size_t thruster_every;
+	uint32_t seed;
+	
+	// Written into the "g" line
+	float modulus_of_elasticity, beam_profile_area, deform_threshold, break_threshold;
+	float mass, thruster_force;
+} mg_params_t, *mg_params_p;
+
+
+mg_params_t mg_defaults(mg_kind_t kind);
+bool mg_parse(mg_params_p params, const char *arg);
+void mg_size_for(mg_params_p params, size_t particles);
+
+model_p mg_generate(mg_params_p params);
+bool mg_write(model_p model, mg_params_p params, const char *filename);
@@ -0,0 +1,54 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "model.h"
+#include "meshgen.h"
+
+/*
+
+Writes procedurally generated meshes, see meshgen.h for the structures.
+
+	mkmesh truss|lattice|frigates|hull out.mesh [key=value...]
+
+Keys: w, h (cells or frigate tiles), length (cells per frigate), particles (picks w and h for about that
+many particles), spacing, jitter, thrusters (hex THRUSTER_* flags), every, seed and the "g" line
+parameters E, A, deform, break, mass and force. For example:
+
+	mkmesh lattice lattice_1m.mesh particles=1000000
+	mkmesh frigates fleet.mesh w=20 h=20 length=12 thrusters=1
+
+*/
+
+int main(int argc, char **argv){
+	const char *kinds[] = { "truss", "lattice", "frigates", "hull" };
+	mg_kind_t kind = MG_TRUSS;
+	size_t kind_count = sizeof(kinds) / sizeof(kinds[0]), k = kind_count;
+	if (argc >= 3) {
+		for(k = 0; k < kind_count; k++){
+			if (strcmp(argv[1], kinds[k]) == 0)
+				break;
+		}
+	}
+	if (k == kind_count){
+		fprintf(stderr, "usage: %s truss|lattice|frigates|hull out.mesh [key=value...]\n", argv[0]);
+		return 1;
+	}
+	kind = k;
+	
+	mg_params_t params = mg_defaults(kind);
+	for(int i = 3; i < argc; i++){
+		if ( !mg_parse(&params, argv[i]) ){
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	
+	model_p model = mg_generate(&params);
+	printf("%s %zu x %zu: %zu particles, %zu beams, %zu thrusters\n", kinds[kind], params.w, params.h,
+		model->particle_count, model->beam_count, model->thruster_count);
+	
+	bool written = mg_write(model, &params, argv[2]);
+	model_destroy(model);
+	return written ? 0 : 1;
+}
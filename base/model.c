@@ -1,29 +1,197 @@
 #include <stdlib.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "model.h"
+#include "rigid.h"
+#include "trace.h"
+#include "perfcount.h"
+#include "alloc.h"
+
+
+arena_pool_t model_arena_pool = ARENA_POOL_INITIALIZER(MODEL_ARENA_REGIONS, MODEL_ARENA_REGION_SIZE, ARENA_THP,
+	MODEL_ARENA_POOL_MAX, MODEL_ARENA_POOL_KEEP);
+
+static uint32_t model_revisions = 0;
+
+static void journal_close(model_p model);
+static void journal_record(model_p model, const char *format, ...);
+
+// Bytes committed for the arrays of an arena model, accounted as MEM_MODEL
+static size_t model_arena_bytes(model_p model){
+	return sizeof(particle_t) * model->particle_capacity + sizeof(beam_t) * model->beam_capacity
+		+ sizeof(thruster_t) * model->thruster_capacity;
+}
 
 model_p model_new(){
-	model_p m = malloc(sizeof(model_t));
+	model_p m = mem_malloc(MEM_MODEL, sizeof(model_t));
 	*m = (model_t){
-		.particle_count = 0,
+		.particle_count = 0, .particle_capacity = 0,
 		.particles = NULL,
-		.beam_count = 0,
+		.beam_count = 0, .beam_capacity = 0,
 		.beams = NULL,
-		.thruster_count = 0,
-		.thrusters = NULL
+		.thruster_count = 0, .thruster_capacity = 0,
+		.thrusters = NULL,
+		.journal = NULL,
+		.arena = arena_pool_get(&model_arena_pool),
+		.beam_breaks = 0, .rigid = NULL,
+		.tile_bounds = NULL, .tile_bounds_capacity = 0, .tile_bounds_count = 0
 	};
+	
+	model_changed(m);
+	
+	// Without an arena the arrays stay NULL until they're allocated on the heap
+	if (m->arena) {
+		m->particles = arena_region(m->arena, MODEL_ARENA_PARTICLES);
+		m->beams = arena_region(m->arena, MODEL_ARENA_BEAMS);
+		m->thrusters = arena_region(m->arena, MODEL_ARENA_THRUSTERS);
+	}
 	return m;
 }
 
 void model_destroy(model_p model){
-	free(model);
+	// Edits not synced yet are discarded, same as without a journal
+	journal_close(model);
+	rigid_destroy(model->rigid);
+	mem_free(MEM_MODEL, model->tile_bounds);
+	if (model->arena) {
+		mem_track_free(MEM_MODEL, model_arena_bytes(model));
+		arena_pool_put(&model_arena_pool, model->arena);
+	} else {
+		mem_free(MEM_MODEL, model->particles);
+		mem_free(MEM_MODEL, model->beams);
+		mem_free(MEM_MODEL, model->thrusters);
+	}
+	mem_free(MEM_MODEL, model);
+}
+
+/**
+ * Gives the model a new revision after its particles or beams were added, removed, loaded or restored.
+ * Revisions are unique across all models, data derived from one model is never mistaken as up to date
+ * for another one that happens to get the same address.
+ */
+void model_changed(model_p model){
+	model->revision = __atomic_add_fetch(&model_revisions, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Creates a consistent copy of the model that other threads can work with (e.g. to save it) while the
+ * original continues to change. The journal is not copied.
+ */
+model_p model_snapshot(model_p model){
+	return model_snapshot_update(model_new(), model);
+}
+
+/**
+ * Same as model_snapshot() but copies the model into snapshot, an earlier snapshot that is no longer
+ * used. Its arrays are already backed by memory and the beams are only copied if the revision of the
+ * model changed since then. Beam flags and lengths of a reused snapshot may therefore be outdated, only
+ * use it to save the model. Returns snapshot.
+ */
+model_p model_snapshot_update(model_p snapshot, model_p model){
+	model_p s = snapshot;
+	s->modulus_of_elasticity = model->modulus_of_elasticity;
+	s->beam_profile_area = model->beam_profile_area;
+	s->deform_threshold = model->deform_threshold;
+	s->break_threshold = model->break_threshold;
+	
+	model_reserve(s, model->particle_count, model->beam_count, model->thruster_count);
+	s->particle_count = model->particle_count;
+	s->thruster_count = model->thruster_count;
+	memcpy(s->particles, model->particles, sizeof(particle_t) * model->particle_count);
+	if (s->revision != model->revision) {
+		s->beam_count = model->beam_count;
+		memcpy(s->beams, model->beams, sizeof(beam_t) * model->beam_count);
+		s->revision = model->revision;
+	}
+	memcpy(s->thrusters, model->thrusters, sizeof(thruster_t) * model->thruster_count);
+	
+	return s;
 }
 
 
+//
+// Editing
+//
+
+static size_t model_min(size_t a, size_t b){
+	return (a < b) ? a : b;
+}
+
+/**
+ * Moves the arrays out of the arena onto the heap. Only used when an array outgrows its region.
+ */
+static void model_leave_arena(model_p model){
+	// model_load() sets the counts before it reserves, only the reserved part is valid
+	particle_p particles = mem_malloc(MEM_MODEL, sizeof(particle_t) * model->particle_capacity);
+	memcpy(particles, model->particles, sizeof(particle_t) * model_min(model->particle_count, model->particle_capacity));
+	beam_p beams = mem_malloc(MEM_MODEL, sizeof(beam_t) * model->beam_capacity);
+	memcpy(beams, model->beams, sizeof(beam_t) * model_min(model->beam_count, model->beam_capacity));
+	thruster_p thrusters = mem_malloc(MEM_MODEL, sizeof(thruster_t) * model->thruster_capacity);
+	memcpy(thrusters, model->thrusters, sizeof(thruster_t) * model_min(model->thruster_count, model->thruster_capacity));
+	
+	mem_track_free(MEM_MODEL, model_arena_bytes(model));
+	arena_pool_put(&model_arena_pool, model->arena);
+	model->arena = NULL;
+	model->particles = particles;
+	model->beams = beams;
+	model->thrusters = thrusters;
+}
+
+/**
+ * Makes sure *array has room for required elements. Unless exact the capacity is at least doubled so
+ * appending one element at a time has amortized constant cost. Arrays in the arena never move, growing
+ * them only commits more of their region.
+ */
+static void model_grow(model_p model, size_t region, void **array, size_t element_size, size_t *capacity, size_t required, bool exact){
+	if (required <= *capacity)
+		return;
+	
+	size_t new_capacity = required;
+	if (!exact) {
+		new_capacity = (*capacity < 16) ? 16 : *capacity;
+		while (new_capacity < required)
+			new_capacity *= 2;
+	}
+	
+	if (model->arena) {
+		size_t region_capacity = model->arena->region_size / element_size;
+		if (new_capacity > region_capacity && required <= region_capacity)
+			new_capacity = region_capacity;
+		if ( arena_commit(model->arena, region, element_size * new_capacity) ) {
+			mem_track_alloc(MEM_MODEL, element_size * (new_capacity - *capacity));
+			*capacity = new_capacity;
+			return;
+		}
+		model_leave_arena(model);
+	}
+	
+	*capacity = new_capacity;
+	*array = mem_realloc(MEM_MODEL, *array, element_size * new_capacity);
+}
+
+/**
+ * Reserves room for at least the given total number of elements so adding up to that many doesn't
+ * reallocate.
+ */
+void model_reserve(model_p model, size_t particles, size_t beams, size_t thrusters){
+	model_grow(model, MODEL_ARENA_PARTICLES, (void**)&model->particles, sizeof(particle_t), &model->particle_capacity, particles, true);
+	model_grow(model, MODEL_ARENA_BEAMS, (void**)&model->beams, sizeof(beam_t), &model->beam_capacity, beams, true);
+	model_grow(model, MODEL_ARENA_THRUSTERS, (void**)&model->thrusters, sizeof(thruster_t), &model->thruster_capacity, thrusters, true);
+}
+
 void model_add_particle(model_p model, float x, float y, float mass){
+	model_grow(model, MODEL_ARENA_PARTICLES, (void**)&model->particles, sizeof(particle_t), &model->particle_capacity, model->particle_count + 1, false);
 	model->particle_count++;
-	model->particles = realloc(model->particles, sizeof(particle_t) * model->particle_count);
+	model_changed(model);
 	
 	model->particles[model->particle_count-1] = (particle_t){
 		.pos = (vec2_t){ x, y },
@@ -31,37 +199,440 @@ void model_add_particle(model_p model, float x, float y, float mass){
 		.force = (vec2_t){0, 0},
 		.mass = mass
 	};
+	journal_record(model, "p %f %f %f\n", x, y, mass);
 }
 
 void model_add_beam(model_p model, size_t from_idx, size_t to_idx){
+	model_grow(model, MODEL_ARENA_BEAMS, (void**)&model->beams, sizeof(beam_t), &model->beam_capacity, model->beam_count + 1, false);
 	model->beam_count++;
-	model->beams = realloc(model->beams, sizeof(beam_t) * model->beam_count);
+	model_changed(model);
 	
 	model->beams[model->beam_count-1] = (beam_t){
 		.i1 = from_idx, .i2 = to_idx,
 		.length = v2_length( v2_sub(model->particles[to_idx].pos, model->particles[from_idx].pos) )
 	};
+	journal_record(model, "b %zu %zu\n", from_idx, to_idx);
 }
 
 void model_add_thruster(model_p model, size_t from_idx, size_t to_idx, float force, uint8_t controlled_by){
+	model_grow(model, MODEL_ARENA_THRUSTERS, (void**)&model->thrusters, sizeof(thruster_t), &model->thruster_capacity, model->thruster_count + 1, false);
 	model->thruster_count++;
-	model->thrusters = realloc(model->thrusters, sizeof(thruster_t) * model->thruster_count);
 	
 	model->thrusters[model->thruster_count-1] = (thruster_t){
 		.i1 = from_idx, .i2 = to_idx,
 		.force = force,
 		.controlled_by = controlled_by
 	};
+	journal_record(model, "t %zu %zu %f %x\n", from_idx, to_idx, force, controlled_by);
 }
 
+/**
+ * Appends count particles as they are (including velocity and flags). Returns the index of the first
+ * one.
+ */
+size_t model_add_particles(model_p model, const particle_t *particles, size_t count){
+	size_t first = model->particle_count;
+	model_grow(model, MODEL_ARENA_PARTICLES, (void**)&model->particles, sizeof(particle_t), &model->particle_capacity, first + count, false);
+	memcpy(model->particles + first, particles, sizeof(particle_t) * count);
+	model->particle_count += count;
+	model_changed(model);
+	
+	for(size_t i = 0; i < count; i++)
+		journal_record(model, "p %f %f %f\n", particles[i].pos.x, particles[i].pos.y, particles[i].mass);
+	return first;
+}
 
-void model_save(model_p model, const char *filename){
-	FILE *file = fopen(filename, "w");
+/**
+ * Appends count beams between the particles given by i1 and i2. Like model_add_beam() the length is
+ * the current distance of the particles and the flags are cleared. Returns the index of the first one.
+ */
+size_t model_add_beams(model_p model, const beam_t *beams, size_t count){
+	size_t first = model->beam_count;
+	model_grow(model, MODEL_ARENA_BEAMS, (void**)&model->beams, sizeof(beam_t), &model->beam_capacity, first + count, false);
+	
+	for(size_t i = 0; i < count; i++){
+		size_t i1 = beams[i].i1, i2 = beams[i].i2;
+		model->beams[first + i] = (beam_t){
+			.i1 = i1, .i2 = i2,
+			.length = v2_length( v2_sub(model->particles[i2].pos, model->particles[i1].pos) )
+		};
+		journal_record(model, "b %zu %zu\n", i1, i2);
+	}
+	
+	model->beam_count += count;
+	model_changed(model);
+	return first;
+}
+
+size_t model_add_thrusters(model_p model, const thruster_t *thrusters, size_t count){
+	size_t first = model->thruster_count;
+	model_grow(model, MODEL_ARENA_THRUSTERS, (void**)&model->thrusters, sizeof(thruster_t), &model->thruster_capacity, first + count, false);
+	memcpy(model->thrusters + first, thrusters, sizeof(thruster_t) * count);
+	model->thruster_count += count;
+	
+	for(size_t i = 0; i < count; i++){
+		const thruster_t *t = &thrusters[i];
+		journal_record(model, "t %zu %zu %f %x\n", t->i1, t->i2, t->force, t->controlled_by);
+	}
+	return first;
+}
+
+/**
+ * Returns a zeroed array with a mark for each index in indices that is below limit.
+ */
+static uint8_t* model_marks(const size_t *indices, size_t count, size_t limit){
+	uint8_t *marks = mem_calloc(MEM_MODEL, limit ? limit : 1, sizeof(uint8_t));
+	for(size_t i = 0; i < count; i++){
+		if (indices[i] < limit)
+			marks[indices[i]] = 1;
+	}
+	return marks;
+}
+
+/**
+ * Removes the beams whose index is marked and keeps the order of the others.
+ */
+static size_t model_compact_beams(model_p model, const uint8_t *marks){
+	size_t kept = 0;
+	for(size_t i = 0; i < model->beam_count; i++){
+		if ( !marks[i] )
+			model->beams[kept++] = model->beams[i];
+	}
+	
+	size_t removed = model->beam_count - kept;
+	model->beam_count = kept;
+	model_changed(model);
+	return removed;
+}
+
+static size_t model_compact_thrusters(model_p model, const uint8_t *marks){
+	size_t kept = 0;
+	for(size_t i = 0; i < model->thruster_count; i++){
+		if ( !marks[i] )
+			model->thrusters[kept++] = model->thrusters[i];
+	}
+	
+	size_t removed = model->thruster_count - kept;
+	model->thruster_count = kept;
+	return removed;
+}
+
+/**
+ * Removes the particles with the given indices together with all beams and thrusters connected to them.
+ * The remaining elements keep their order and the particle indices of beams and thrusters are remapped.
+ * If remap isn't NULL it has to hold the old particle count and receives the new index of each particle
+ * (SIZE_MAX for removed ones). Indices out of range or given twice are ignored.
+ * 
+ * Returns the number of removed particles.
+ */
+size_t model_remove_particles(model_p model, const size_t *indices, size_t count, size_t *remap){
+	uint8_t *marks = model_marks(indices, count, model->particle_count);
+	size_t *new_index = remap ? remap : mem_malloc(MEM_MODEL, sizeof(size_t) * (model->particle_count ? model->particle_count : 1));
+	
+	size_t kept = 0;
+	for(size_t i = 0; i < model->particle_count; i++){
+		if (marks[i]) {
+			new_index[i] = SIZE_MAX;
+		} else {
+			new_index[i] = kept;
+			model->particles[kept++] = model->particles[i];
+		}
+	}
+	size_t removed = model->particle_count - kept;
+	model->particle_count = kept;
+	model_changed(model);
+	
+	// Remove the beams and thrusters that lost a particle
+	uint8_t *element_marks = mem_calloc(MEM_MODEL, 1 + (model->beam_count > model->thruster_count ? model->beam_count : model->thruster_count), sizeof(uint8_t));
+	for(size_t i = 0; i < model->beam_count; i++){
+		beam_p b = &model->beams[i];
+		b->i1 = new_index[b->i1];
+		b->i2 = new_index[b->i2];
+		element_marks[i] = (b->i1 == SIZE_MAX || b->i2 == SIZE_MAX);
+	}
+	model_compact_beams(model, element_marks);
+	
+	for(size_t i = 0; i < model->thruster_count; i++){
+		thruster_p t = &model->thrusters[i];
+		t->i1 = new_index[t->i1];
+		t->i2 = new_index[t->i2];
+		element_marks[i] = (t->i1 == SIZE_MAX || t->i2 == SIZE_MAX);
+	}
+	model_compact_thrusters(model, element_marks);
+	
+	mem_free(MEM_MODEL, element_marks);
+	if (new_index != remap)
+		mem_free(MEM_MODEL, new_index);
+	mem_free(MEM_MODEL, marks);
+	
+	if (removed > 0)
+		journal_close(model);
+	return removed;
+}
+
+size_t model_remove_beams(model_p model, const size_t *indices, size_t count){
+	uint8_t *marks = model_marks(indices, count, model->beam_count);
+	size_t removed = model_compact_beams(model, marks);
+	mem_free(MEM_MODEL, marks);
+	
+	if (removed > 0)
+		journal_close(model);
+	return removed;
+}
+
+size_t model_remove_thrusters(model_p model, const size_t *indices, size_t count){
+	uint8_t *marks = model_marks(indices, count, model->thruster_count);
+	size_t removed = model_compact_thrusters(model, marks);
+	mem_free(MEM_MODEL, marks);
+	
+	if (removed > 0)
+		journal_close(model);
+	return removed;
+}
+
+
+//
+// Edit journal
+//
+
+static char* journal_copy_string(const char *string){
+	size_t size = strlen(string) + 1;
+	char *copy = mem_malloc(MEM_MODEL, size);
+	memcpy(copy, string, size);
+	return copy;
+}
+
+static char* journal_filename_for(const char *filename){
+	size_t len = strlen(filename);
+	char *journal_filename = mem_malloc(MEM_MODEL, len + sizeof(".journal"));
+	memcpy(journal_filename, filename, len);
+	memcpy(journal_filename + len, ".journal", sizeof(".journal"));
+	return journal_filename;
+}
+
+static uint32_t journal_new_generation(){
+	static uint32_t save_count = 0;
+	uint32_t generation;
+	do {
+		save_count++;
+		generation = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16) ^ (save_count * 2654435761u);
+	} while (generation == 0);
+	return generation;
+}
+
+static int write_all(int fd, const char *buffer, size_t size){
+	while (size > 0) {
+		ssize_t written = write(fd, buffer, size);
+		if (written < 0)
+			return -1;
+		buffer += written;
+		size -= written;
+	}
+	return 0;
+}
+
+/**
+ * Starts a fresh journal for filename. From now on all edits are recorded but they can't be synced
+ * until model_journal_attach() connected the journal to a mesh written with model_write().
+ */
+void model_journal_begin(model_p model, const char *filename){
+	journal_close(model);
+	
+	journal_p journal = mem_malloc(MEM_MODEL, sizeof(journal_t));
+	*journal = (journal_t){
+		.filename = journal_copy_string(filename),
+		.fd = -1,
+		.generation = 0,
+		.entry_count = 0,
+		.outdated = false,
+		.pending = NULL,
+		.pending_len = 0, .pending_size = 0, .pending_count = 0
+	};
+	model->journal = journal;
+}
+
+/**
+ * Creates the journal file of a journal started with model_journal_begin(). The file is truncated and
+ * stamped with generation so it only applies to the mesh saved with the same generation. Entries
+ * recorded in the meantime stay pending and are written by the next sync.
+ */
+void model_journal_attach(model_p model, const char *filename, uint32_t generation){
+	journal_p journal = model->journal;
+	if (journal == NULL || journal->fd != -1 || strcmp(journal->filename, filename) != 0)
+		return;
+	
+	char *journal_filename = journal_filename_for(filename);
+	int fd = open(journal_filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	mem_free(MEM_MODEL, journal_filename);
+	if (fd == -1){
+		perror("model_journal_attach: open");
+		journal_close(model);
+		return;
+	}
+	
+	char header[32];
+	int header_len = snprintf(header, sizeof(header), "j %08x\n", generation);
+	if ( write_all(fd, header, header_len) == -1 || fdatasync(fd) == -1 ){
+		perror("model_journal_attach: write");
+		close(fd);
+		journal_close(model);
+		return;
+	}
+	
+	journal->fd = fd;
+	journal->generation = generation;
+}
+
+/**
+ * Marks the journal as outdated after the model changed in a way the journal can't record (simulated
+ * steps, restored states). Cheap enough to call every step, the next sync is a full save.
+ */
+void model_journal_invalidate(model_p model){
+	if (model->journal != NULL)
+		model->journal->outdated = true;
+}
+
+static void journal_close(model_p model){
+	journal_p journal = model->journal;
+	if (journal == NULL)
+		return;
+	
+	if (journal->fd != -1)
+		close(journal->fd);
+	mem_free(MEM_MODEL, journal->pending);
+	mem_free(MEM_MODEL, journal->filename);
+	mem_free(MEM_MODEL, journal);
+	model->journal = NULL;
+}
+
+/**
+ * Appends one entry to the in-memory list of pending entries. Nothing is written to disk until the next
+ * model_sync(). This keeps the cost of an edit independent of the model size.
+ */
+static void journal_record(model_p model, const char *format, ...){
+	journal_p journal = model->journal;
+	if (journal == NULL)
+		return;
+	
+	// Format into the free space. If the entry doesn't fit grow the buffer until it does and format it
+	// again. Entries that can't be recorded drop the journal like removals do, the next save is a full
+	// save then.
+	for(int attempt = 0; attempt < 2; attempt++){
+		va_list args;
+		va_start(args, format);
+		size_t free_space = journal->pending_size - journal->pending_len;
+		int len = vsnprintf(journal->pending + journal->pending_len, free_space, format, args);
+		va_end(args);
+		if (len < 0)
+			break;
+		if ((size_t)len < free_space) {
+			journal->pending_len += len;
+			journal->pending_count++;
+			return;
+		}
+		
+		size_t new_size = (journal->pending_size == 0) ? 4096 : journal->pending_size;
+		while (new_size - journal->pending_len <= (size_t)len)
+			new_size *= 2;
+		char *pending = mem_realloc(MEM_MODEL, journal->pending, new_size);
+		if (pending == NULL)
+			break;
+		journal->pending = pending;
+		journal->pending_size = new_size;
+	}
+	
+	fprintf(stderr, "journal_record: failed to record an entry, the next save is a full save\n");
+	journal_close(model);
+}
+
+/**
+ * Writes all pending entries to the journal file and waits until they are on disk.
+ */
+static int journal_sync(journal_p journal){
+	if ( write_all(journal->fd, journal->pending, journal->pending_len) == -1 || fdatasync(journal->fd) == -1 ){
+		perror("journal_sync: write");
+		return -1;
+	}
+	
+	journal->entry_count += journal->pending_count;
+	journal->pending_len = 0;
+	journal->pending_count = 0;
+	return 0;
+}
+
+/**
+ * Replays the journal of filename on top of the already loaded model. Only entries of a journal with
+ * the same generation as the mesh are applied. Stops at the first incomplete or invalid line.
+ */
+static size_t journal_replay(model_p model, const char *filename, uint32_t generation){
+	const size_t line_limit = 512;
+	char line[line_limit];
+	
+	char *journal_filename = journal_filename_for(filename);
+	FILE *file = fopen(journal_filename, "r");
+	mem_free(MEM_MODEL, journal_filename);
+	if (file == NULL)
+		return 0;
+	
+	unsigned int journal_generation;
+	if ( fgets(line, line_limit, file) == NULL || sscanf(line, "j %x", &journal_generation) != 1 || journal_generation != generation ){
+		fclose(file);
+		return 0;
+	}
+	
+	size_t entry_count = 0;
+	float x, y, mass, force;
+	size_t i1, i2;
+	unsigned int controlled_by;
+	
+	while( fgets(line, line_limit, file) != NULL ){
+		// A line without newline was torn by a crash while writing it
+		if (line[strlen(line) - 1] != '\n')
+			break;
+		
+		if ( line[0] == 'p' && sscanf(line, "p %f %f %f", &x, &y, &mass) == 3 ) {
+			model_add_particle(model, x, y, mass);
+		} else if ( line[0] == 'b' && sscanf(line, "b %zu %zu", &i1, &i2) == 2 && i1 < model->particle_count && i2 < model->particle_count ) {
+			model_add_beam(model, i1, i2);
+		} else if ( line[0] == 't' && sscanf(line, "t %zu %zu %f %x", &i1, &i2, &force, &controlled_by) == 4 && i1 < model->particle_count && i2 < model->particle_count ) {
+			model_add_thruster(model, i1, i2, force, controlled_by);
+		} else {
+			break;
+		}
+		entry_count++;
+	}
+	
+	fclose(file);
+	return entry_count;
+}
+
+
+//
+// Loading and saving
+//
+
+/**
+ * Writes the entire model to filename. The model is written to a temporary file first and then renamed
+ * so a crash never leaves a half written mesh behind. Doesn't touch the journal and therefore works on
+ * snapshots in other threads, too.
+ * 
+ * Returns the generation stamped into the mesh or 0 on error.
+ */
+uint32_t model_write(model_p model, const char *filename){
+	size_t len = strlen(filename);
+	char temp_filename[len + sizeof(".tmp")];
+	memcpy(temp_filename, filename, len);
+	memcpy(temp_filename + len, ".tmp", sizeof(".tmp"));
+	
+	FILE *file = fopen(temp_filename, "w");
 	if (file == NULL){
 		perror("model_save: fopen");
-		return;
+		return 0;
 	}
 	
+	uint32_t generation = journal_new_generation();
+	fprintf(file, "j %08x\n", generation);
+	
 	for(size_t i = 0; i < model->particle_count; i++){
 		particle_p p = &model->particles[i];
 		fprintf(file, "p %f %f %f\n", p->pos.x, p->pos.y, p->mass);
@@ -77,19 +648,109 @@ void model_save(model_p model, const char *filename){
 		fprintf(file, "t %zu %zu %f %x\n", t->i1, t->i2, t->force, t->controlled_by);
 	}
 	
+	if ( fflush(file) != 0 || fsync(fileno(file)) != 0 ){
+		perror("model_save: write");
+		fclose(file);
+		unlink(temp_filename);
+		return 0;
+	}
 	fclose(file);
+	
+	if ( rename(temp_filename, filename) != 0 ){
+		perror("model_save: rename");
+		unlink(temp_filename);
+		return 0;
+	}
+	
 	printf("saved model %p to %s\n", model, filename);
+	return generation;
+}
+
+/**
+ * Saves the entire model to filename. If the edit journal records for filename it is reset since all
+ * its entries are part of the full save now.
+ */
+void model_save(model_p model, const char *filename){
+	bool journaled = (model->journal != NULL && strcmp(model->journal->filename, filename) == 0);
+	if (journaled)
+		model_journal_begin(model, filename);
+	
+	uint32_t generation = model_write(model, filename);
+	if (journaled && generation != 0)
+		model_journal_attach(model, filename, generation);
+}
+
+/**
+ * Appends the edits recorded since the last sync to the journal of filename. Only possible if the
+ * journal already records for filename, didn't grow too large and isn't outdated.
+ * 
+ * Returns false if a full save is necessary instead.
+ */
+bool model_sync_journal(model_p model, const char *filename){
+	journal_p journal = model->journal;
+	size_t element_count = model->particle_count + model->beam_count + model->thruster_count;
+	
+	if ( journal == NULL || journal->fd == -1 || journal->outdated || strcmp(journal->filename, filename) != 0 )
+		return false;
+	if ( journal->entry_count + journal->pending_count >= JOURNAL_COMPACT_MIN_ENTRIES + element_count / 4 )
+		return false;
+	
+	size_t pending_count = journal->pending_count;
+	if ( journal_sync(journal) != 0 )
+		return false;
+	
+	printf("synced %zu edits of model %p to %s.journal\n", pending_count, model, filename);
+	return true;
+}
+
+/**
+ * Saves the model to filename. When the edit journal already records for filename only the edits since
+ * the last sync are appended to it. Otherwise, or if the journal grew too large, the full model is
+ * written (compaction) and a new journal started.
+ */
+void model_sync(model_p model, const char *filename){
+	if ( model_sync_journal(model, filename) )
+		return;
+	
+	model_journal_begin(model, filename);
+	uint32_t generation = model_write(model, filename);
+	if (generation != 0)
+		model_journal_attach(model, filename, generation);
+	else
+		journal_close(model);
 }
 
 void model_load(model_p model, const char *filename){
+	model_load_progress(model, filename, NULL, NULL);
+}
+
+/**
+ * Same as model_load() but calls progress every few thousand lines. Since the file is read twice (once
+ * to count, once to parse) bytes_total is twice the file size.
+ * 
+ * Returns false if the file could not be opened. The model is left untouched in that case.
+ */
+bool model_load_progress(model_p model, const char *filename, model_progress_func_t progress, void *data){
 	const size_t line_limit = 512;
 	char line[line_limit];
+	const size_t lines_per_progress = 4096;
+	size_t line_count = 0;
 	
 	FILE* file = fopen(filename, "r");
 	if (file == NULL){
 		perror("model_load: fopen");
-		return;
+		return false;
 	}
+	pc_begin(PC_MODEL_LOAD);
+	
+	struct stat file_stat;
+	fstat(fileno(file), &file_stat);
+	size_t bytes_total = file_stat.st_size * 2;
+	if (progress)
+		progress(0, bytes_total, data);
+	
+	// The loaded model replaces all edits recorded so far
+	journal_close(model);
 	
 	// Init global model params
 	model->modulus_of_elasticity = 50000;  // N_m2 (elastic modulus of steel)
@@ -98,11 +759,15 @@ void model_load(model_p model, const char *filename){
 	model->break_threshold = 0.075; // m
 	
 	// First count the number of each element type
+	model_changed(model);
 	model->particle_count = 0;
 	model->beam_count = 0;
 	model->thruster_count = 0;
 	
 	while( fgets(line, line_limit, file) != NULL ){
+		if (progress && ++line_count % lines_per_progress == 0)
+			progress(ftell(file), bytes_total, data);
+		
 		switch(line[0]){
 			case 'p':  // particle
 				model->particle_count++;
@@ -117,11 +782,23 @@ void model_load(model_p model, const char *filename){
 	}
 	printf("model %s: %zu particles, %zu beams, %zu thrusters\n", filename,
 		model->particle_count, model->beam_count, model->thruster_count);
+	trace_begin(TRACE_INFO, "model_load");
 	
-	// Now we know how many particles and beams we need, allocate them
-	model->particles = realloc(model->particles, sizeof(particle_t) * model->particle_count);
-	model->beams = realloc(model->beams, sizeof(beam_t) * model->beam_count);
-	model->thrusters = realloc(model->thrusters, sizeof(thruster_t) * model->thruster_count);
+	// Now we know how many particles and beams we need, allocate them. An arena is reset in O(1) and
+	// the pages of the previous mesh are reused.
+	if (model->arena) {
+		mem_track_free(MEM_MODEL, model_arena_bytes(model));
+		arena_reset(model->arena);
+		model->particle_capacity = model->beam_capacity = model->thruster_capacity = 0;
+		model_reserve(model, model->particle_count, model->beam_count, model->thruster_count);
+	} else {
+		model->particles = mem_realloc(MEM_MODEL, model->particles, sizeof(particle_t) * model->particle_count);
+		model->beams = mem_realloc(MEM_MODEL, model->beams, sizeof(beam_t) * model->beam_count);
+		model->thrusters = mem_realloc(MEM_MODEL, model->thrusters, sizeof(thruster_t) * model->thruster_count);
+		model->particle_capacity = model->particle_count;
+		model->beam_capacity = model->beam_count;
+		model->thruster_capacity = model->thruster_count;
+	}
 	
 	// Load the model again but this time we're not counting but extracting all values to build
 	// all elements of the model.
@@ -132,9 +809,16 @@ void model_load(model_p model, const char *filename){
 	float x, y, mass, force;
 	size_t i1, i2;
 	int controlled_by;
+	unsigned int generation = 0;
 	
 	while( fgets(line, line_limit, file) != NULL ){
+		if (progress && ++line_count % lines_per_progress == 0)
+			progress(file_stat.st_size + ftell(file), bytes_total, data);
+		
 		switch(line[0]){
+			case 'j':  // generation of the edit journal that belongs to this mesh
+				sscanf(line, "j %x", &generation);
+				break;
 			case 'g':  // global model properties
 				sscanf(line, "g %f %f %f %f %f %f", &model->modulus_of_elasticity, &model->beam_profile_area,
 					&model->deform_threshold, &model->break_threshold, &global_mass, &thruster_force);
@@ -143,7 +827,7 @@ void model_load(model_p model, const char *filename){
 				if (particle_idx >= model->particle_count)
 					break;
 				sscanf(line, "p %f %f %f", &x, &y, &mass);
-				printf("particles[%zu] at %f %f mass %f\n", particle_idx, x, y, mass);
+				trace_instant(TRACE_VERBOSE, "particle", "index x y mass", particle_idx, x, y, mass);
 				model->particles[particle_idx] = (particle_t){
 					.pos = (vec2_t){ x, y },
 					.vel = (vec2_t){ 0, 0 },
@@ -156,7 +840,7 @@ void model_load(model_p model, const char *filename){
 				if (beam_idx >= model->beam_count)
 					break;
 				sscanf(line, "b %zu %zu", &i1, &i2);
-				printf("beams[%zu] from %zu to %zu\n", beam_idx, i1, i2);
+				trace_instant(TRACE_VERBOSE, "beam", "index from to", beam_idx, i1, i2);
 				model->beams[beam_idx] = (beam_t){
 					.i1 = i1, .i2 = i2,
 					.length = v2_length( v2_sub(model->particles[i2].pos, model->particles[i1].pos) )
@@ -167,8 +851,7 @@ void model_load(model_p model, const char *filename){
 				if (thruster_idx >= model->thruster_count)
 					break;
 				sscanf(line, "t %zu %zu %f %x", &i1, &i2, &force, &controlled_by);
-				printf("thrusters[%zu] from %zu to %zu with force %f, controll mask 0x%02x\n",
-					thruster_idx, i1, i2, force, controlled_by);
+				trace_instant(TRACE_VERBOSE, "thruster", "index from to force controlled_by", thruster_idx, i1, i2, force, controlled_by);
 				model->thrusters[thruster_idx] = (thruster_t){
 					.i1 = i1, .i2 = i2,
 					.force = thruster_force, //force,
@@ -179,8 +862,19 @@ void model_load(model_p model, const char *filename){
 	}
 	
 	fclose(file);
+	trace_end(TRACE_INFO, "model_load");
+	
+	if (generation != 0){
+		size_t entry_count = journal_replay(model, filename, generation);
+		if (entry_count > 0)
+			printf("replayed %zu edits from %s.journal\n", entry_count, filename);
+	}
+	pc_end(PC_MODEL_LOAD);
 	
+	if (progress)
+		progress(bytes_total, bytes_total, data);
 	printf("loaded model %p from %s\n", model, filename);
+	return true;
 }
 
 
@@ -191,4 +885,51 @@ vec2_t model_particle_center(model_p model){
 		center.y += model->particles[i].pos.y / model->particle_count;
 	}
 	return center;
-}
\ No newline at end of file
+}
+
+
+//
+// Tile bounds
+//
+
+/**
+ * Makes room in model->tile_bounds for all tiles. Writers then store the bounds of every tile and call
+ * model_tile_bounds_commit(). Has to be called before the tiles are written in parallel.
+ */
+void model_tile_bounds_reserve(model_p model){
+	size_t tile_count = model_tile_count(model);
+	if (tile_count > model->tile_bounds_capacity) {
+		model->tile_bounds_capacity = tile_count;
+		model->tile_bounds = mem_realloc(MEM_MODEL, model->tile_bounds, sizeof(tile_bounds_t) * model->tile_bounds_capacity);
+	}
+}
+
+/**
+ * Marks the bounds of all tiles as up to date for the current revision.
+ */
+void model_tile_bounds_commit(model_p model){
+	model->tile_bounds_count = model_tile_count(model);
+	model->tile_bounds_revision = model->revision;
+}
+
+bool model_tile_bounds_valid(model_p model){
+	return (model->tile_bounds_revision == model->revision && model->tile_bounds_count == model_tile_count(model));
+}
+
+/**
+ * Calculates the bounds of all tiles from the particle positions. For models that weren't simulated
+ * since they changed.
+ */
+void model_tile_bounds_update(model_p model){
+	model_tile_bounds_reserve(model);
+	for(size_t t = 0; t < model_tile_count(model); t++){
+		tile_bounds_t bounds = tile_bounds_empty();
+		size_t end = (t + 1) * MODEL_TILE_SIZE;
+		if (end > model->particle_count)
+			end = model->particle_count;
+		for(size_t i = t * MODEL_TILE_SIZE; i < end; i++)
+			tile_bounds_include(&bounds, model->particles[i].pos);
+		model->tile_bounds[t] = bounds;
+	}
+	model_tile_bounds_commit(model);
+}
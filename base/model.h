@@ -2,7 +2,10 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
 #include "math.h"
+#include "arena.h"
 
 /**
 
@@ -10,6 +13,22 @@ Notes:
 - Beams and thrusters use indices of the particles instead pointers. Otherwise we would have to
   adjust each pointer when the particles array is moved by realloc() and the memory addresses
   change.
+- The arrays grow by doubling their capacity so adding n elements one by one costs O(n). Use
+  model_reserve() or the bulk functions if the number of elements is known up front.
+- Removing elements compacts the arrays and remaps the indices of the remaining elements. Removals
+  can't be recorded in the edit journal, the next save after one is a full save.
+- The arrays of a model live in one arena from model_arena_pool (see arena.h), one region per array.
+  They never move while they grow, loading a mesh into a model resets the arena in O(1) and destroyed
+  models return their arena to the pool for the next one. If no arena can be reserved or an array
+  outgrows its region the arrays are moved to the heap instead.
+- revision changes whenever particles or beams are added, removed, loaded or restored (see
+  model_changed(), revisions are unique across models). Data derived from the structure of a model
+  (e.g. the islands of rigid.h) is rebuilt when it differs. beam_breaks counts the beams broken by the
+  simulation, together both tell when the set of unbroken beams changed.
+- Particles are grouped into tiles of MODEL_TILE_SIZE consecutive particles. The simulation stores the
+  bounding box of each tile as a by-product of the integration, so the renderer can skip tiles outside
+  of the viewport without looking at their particles. The bounds are only valid for the revision they
+  were calculated for, model_tile_bounds_update() calculates them if nobody did.
 
 */
 
@@ -46,23 +65,128 @@ typedef struct {
 #define THRUSTER_RIGHT	1<<3
 
 
+/**
+
+Edit journal: Every model_add_*() call is recorded as a line in the mesh format. model_sync() only
+appends these lines to "<mesh>.journal" instead of rewriting the whole mesh. model_load() replays the
+journal of a mesh after loading it.
+
+Both files start with a "j <generation>" line. A full save writes a new generation into the mesh and
+only then resets the journal. A journal left over from a crash in between has an old generation and
+is ignored. A partially written last line (no trailing newline) is ignored, too.
+
+Only the edits are recorded, not the state of the particles. Once the simulation moved them or an
+older state was restored model_journal_invalidate() marks the journal as outdated and the next sync is
+a full save. Otherwise the moved particles would be lost and beams added afterwards would get their
+length from the old positions when the journal is replayed.
+
+*/
+typedef struct {
+	char *filename;  // mesh file the journal belongs to
+	int fd;
+	uint32_t generation;
+	size_t entry_count;  // entries already in the journal file
+	bool outdated;  // the model changed in ways the entries don't record, the next sync is a full save
+	// Entries recorded since the last sync
+	char *pending;
+	size_t pending_len, pending_size, pending_count;
+} journal_t, *journal_p;
+
+// Compact the journal into a full save once it holds more than this many entries plus a quarter of
+// the model size. Keeps the amortized cost per edit constant.
+#define JOURNAL_COMPACT_MIN_ENTRIES 4096
+
+
+#define MODEL_TILE_SIZE 1024
+
+typedef struct {
+	vec2_t min, max;  // m
+} tile_bounds_t, *tile_bounds_p;
+
+typedef struct rigid_s rigid_t, *rigid_p;
+
 typedef struct {
 	float modulus_of_elasticity, beam_profile_area, deform_threshold, break_threshold;
 	size_t particle_count, beam_count, thruster_count;
+	size_t particle_capacity, beam_capacity, thruster_capacity;
 	particle_p particles;
 	beam_p beams;
 	thruster_p thrusters;
+	journal_p journal;  // NULL if edits are not recorded
+	arena_p arena;  // NULL if the arrays are on the heap
+	uint32_t revision, beam_breaks;
+	rigid_p rigid;  // islands simulated as rigid bodies, created by simulate_rigid()
+	
+	tile_bounds_p tile_bounds;
+	size_t tile_bounds_capacity, tile_bounds_count;  // tiles, bounds are valid for tile_bounds_count tiles
+	uint32_t tile_bounds_revision;
 } model_t, *model_p;
 
+#define MODEL_ARENA_PARTICLES	0
+#define MODEL_ARENA_BEAMS		1
+#define MODEL_ARENA_THRUSTERS	2
+#define MODEL_ARENA_REGIONS	3
+// Address space reserved per array, only touched pages use memory. 8 GiB hold 268M particles.
+#define MODEL_ARENA_REGION_SIZE	((size_t)8 * 1024 * 1024 * 1024)
+#define MODEL_ARENA_POOL_MAX	8
+#define MODEL_ARENA_POOL_KEEP	(64 * 1024 * 1024)
+
+extern arena_pool_t model_arena_pool;
+
+
+typedef void (*model_progress_func_t)(size_t bytes_done, size_t bytes_total, void *data);
+
 
 model_p model_new();
 void model_destroy(model_p model);
+model_p model_snapshot(model_p model);
+model_p model_snapshot_update(model_p snapshot, model_p model);
+void model_changed(model_p model);
 
 void model_add_particle(model_p model, float x, float y, float mass);
 void model_add_beam(model_p model, size_t from_idx, size_t to_idx);
 void model_add_thruster(model_p model, size_t from_idx, size_t to_idx, float force, uint8_t controlled_by);
 
+void model_reserve(model_p model, size_t particles, size_t beams, size_t thrusters);
+size_t model_add_particles(model_p model, const particle_t *particles, size_t count);
+size_t model_add_beams(model_p model, const beam_t *beams, size_t count);
+size_t model_add_thrusters(model_p model, const thruster_t *thrusters, size_t count);
+size_t model_remove_particles(model_p model, const size_t *indices, size_t count, size_t *remap);
+size_t model_remove_beams(model_p model, const size_t *indices, size_t count);
+size_t model_remove_thrusters(model_p model, const size_t *indices, size_t count);
+
 void model_save(model_p model, const char *filename);
+void model_sync(model_p model, const char *filename);
+bool model_sync_journal(model_p model, const char *filename);
+uint32_t model_write(model_p model, const char *filename);
+void model_journal_begin(model_p model, const char *filename);
+void model_journal_invalidate(model_p model);
+void model_journal_attach(model_p model, const char *filename, uint32_t generation);
 void model_load(model_p model, const char *filename);
+bool model_load_progress(model_p model, const char *filename, model_progress_func_t progress, void *data);
+
+vec2_t model_particle_center(model_p model);
+
+void model_tile_bounds_reserve(model_p model);
+void model_tile_bounds_commit(model_p model);
+bool model_tile_bounds_valid(model_p model);
+void model_tile_bounds_update(model_p model);
+
+static inline size_t model_tile_count(model_p model){
+	return (model->particle_count + MODEL_TILE_SIZE - 1) / MODEL_TILE_SIZE;
+}
+
+static inline size_t tile_particle_count(model_p model, size_t tile){
+	return (tile + 1 < model_tile_count(model)) ? MODEL_TILE_SIZE : model->particle_count - tile * MODEL_TILE_SIZE;
+}
+
+static inline tile_bounds_t tile_bounds_empty(){
+	return (tile_bounds_t){ { INFINITY, INFINITY }, { -INFINITY, -INFINITY } };
+}
 
-vec2_t model_particle_center(model_p model);
\ No newline at end of file
+static inline void tile_bounds_include(tile_bounds_p bounds, vec2_t pos){
+	bounds->min.x = fminf(bounds->min.x, pos.x);
+	bounds->min.y = fminf(bounds->min.y, pos.y);
+	bounds->max.x = fmaxf(bounds->max.x, pos.x);
+	bounds->max.y = fmaxf(bounds->max.y, pos.y);
+}
\ No newline at end of file
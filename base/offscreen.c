@@ -0,0 +1,59 @@
+#include <stdio.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+
+#include "offscreen.h"
+
+
+static EGLDisplay offscreen_display = EGL_NO_DISPLAY;
+static EGLContext offscreen_context = EGL_NO_CONTEXT;
+static GLuint offscreen_framebuffer, offscreen_renderbuffer;
+
+/**
+ * Creates a surfaceless EGL context with an offscreen framebuffer of the given size. Returns false if
+ * no context is available.
+ */
+bool offscreen_init(uint16_t width, uint16_t height){
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (get_platform_display == NULL)
+		return false;
+	
+	offscreen_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	if ( offscreen_display == EGL_NO_DISPLAY || !eglInitialize(offscreen_display, NULL, NULL) || !eglBindAPI(EGL_OPENGL_API) )
+		return false;
+	
+	const EGLint config_attribs[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+	EGLConfig config;
+	EGLint config_count = 0;
+	eglChooseConfig(offscreen_display, config_attribs, &config, 1, &config_count);
+	
+	offscreen_context = eglCreateContext(offscreen_display, (config_count > 0) ? config : NULL, EGL_NO_CONTEXT, NULL);
+	if ( offscreen_context == EGL_NO_CONTEXT || !eglMakeCurrent(offscreen_display, EGL_NO_SURFACE, EGL_NO_SURFACE, offscreen_context) )
+		return false;
+	
+	glGenFramebuffers(1, &offscreen_framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, offscreen_framebuffer);
+	glGenRenderbuffers(1, &offscreen_renderbuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, offscreen_renderbuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, offscreen_renderbuffer);
+	
+	printf("rendering offscreen with %s\n", glGetString(GL_RENDERER));
+	return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+
+void offscreen_destroy(){
+	if (offscreen_context == EGL_NO_CONTEXT)
+		return;
+	
+	glDeleteRenderbuffers(1, &offscreen_renderbuffer);
+	glDeleteFramebuffers(1, &offscreen_framebuffer);
+	eglMakeCurrent(offscreen_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(offscreen_display, offscreen_context);
+	eglTerminate(offscreen_display);
+	offscreen_context = EGL_NO_CONTEXT;
+	offscreen_display = EGL_NO_DISPLAY;
+}
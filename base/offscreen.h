@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+
+Offscreen GL context for rendering without a window or display server. offscreen_init() creates a
+surfaceless EGL context (Mesa's llvmpipe works without a GPU) and binds a framebuffer of the given size
+with a color renderbuffer, the renderer then draws into it like into a window:
+	
+	if ( !offscreen_init(1280, 720) )
+		return 1;
+	renderer_load(1280, 720);
+	...
+	renderer_unload();
+	offscreen_destroy();
+
+*/
+
+bool offscreen_init(uint16_t width, uint16_t height);
+void offscreen_destroy();
@@ -1,12 +1,23 @@
 #version 120
+#extension GL_ARB_uniform_buffer_object : require
 
-// vertex and cursor positions in screen space
+// Per frame data of the renderer, see frame_uniforms_t in renderer.c
+layout(std140) uniform frame_uniforms {
+	mat3 world_to_normal;
+	mat3 screen_to_normal;
+	vec2 screen_size;
+	float scale_exp;
+};
+
+// vertex of the quad, one particle per instance (position in world space and color)
 attribute vec2 pos;
+attribute vec2 instance_pos;
+attribute vec4 instance_color;
 
-uniform mat3 transform;
-uniform mat3 to_norm;
+varying vec4 color;
 
 void main(){
-	gl_Position.xyz = (to_norm * transform) * vec3(pos, 1);
+	gl_Position.xyz = world_to_normal * vec3(pos * 0.25 + instance_pos, 1);
 	gl_Position.w = 1;
+	color = instance_color;
 }
\ No newline at end of file
@@ -0,0 +1,37 @@
+#version 120
+#extension GL_ARB_uniform_buffer_object : require
+
+// Per frame data of the renderer, see frame_uniforms_t in renderer.c
+layout(std140) uniform frame_uniforms {
+	mat3 world_to_normal;
+	mat3 screen_to_normal;
+	vec2 screen_size;
+	float scale_exp;
+};
+
+// Origin (xy) and size (zw) of each tile in world space, see TILE_FRAMES_MAX in renderer.c
+layout(std140) uniform tile_frames {
+	vec4 tile_frame[1024];
+};
+
+uniform float alpha;
+
+// vertex of the quad, one particle per instance (position relative to the frame of its tile, tile
+// index and flags)
+attribute vec2 pos;
+attribute vec2 instance_pos;
+attribute float instance_tile;
+attribute float instance_flags;
+
+varying vec4 color;
+
+void main(){
+	vec4 frame = tile_frame[int(instance_tile)];
+	vec2 world_pos = frame.xy + instance_pos * frame.zw;
+	gl_Position.xyz = world_to_normal * vec3(pos * 0.25 + world_pos, 1);
+	gl_Position.w = 1;
+	
+	// Bit 0 is PARTICLE_FLAG_SELECTED
+	bool selected = mod(instance_flags, 2) >= 1;
+	color = selected ? vec4(1, 0, 0, alpha) : vec4(0, 1, 0, alpha);
+}
\ No newline at end of file
@@ -0,0 +1,205 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfcount.h"
+
+
+__thread perfcount_p pc_current = NULL;
+
+static const struct {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+} pc_events[PC_COUNTER_COUNT] = {
+	[PC_CYCLES]        = { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	[PC_INSTRUCTIONS]  = { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	[PC_L1D_MISSES]    = { "L1d misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	[PC_LLC_MISSES]    = { "LLC misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	[PC_BRANCH_MISSES] = { "branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES }
+};
+
+static const char *pc_phase_names[PC_PHASE_COUNT] = {
+	[PC_SIM_GRAB]        = "sim grab force",
+	[PC_SIM_THRUSTERS]   = "sim thrusters",
+	[PC_SIM_BEAMS]       = "sim beams",
+	[PC_SIM_INTEGRATION] = "sim integration",
+	[PC_SIM_RIGID]       = "sim rigid checks",
+	[PC_MODEL_LOAD]      = "model load"
+};
+
+
+/**
+ * Opens a group of counters for thread tid (0 is the calling thread). Returns false if not even one
+ * counter could be opened.
+ */
+static bool pc_group_open(pc_group_p group, pid_t tid){
+	group->leader_fd = -1;
+	group->open_count = 0;
+	
+	for(size_t i = 0; i < PC_COUNTER_COUNT; i++){
+		group->fds[i] = -1;
+		group->slot[i] = -1;
+		
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = pc_events[i].type;
+		attr.config = pc_events[i].config;
+		attr.disabled = (group->leader_fd == -1);
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		
+		int fd = syscall(SYS_perf_event_open, &attr, tid, -1, group->leader_fd, 0);
+		if (fd == -1)
+			continue;
+		
+		if (group->leader_fd == -1)
+			group->leader_fd = fd;
+		group->fds[i] = fd;
+		group->slot[i] = group->open_count++;
+	}
+	
+	if (group->leader_fd == -1) {
+		perror("perf_event_open");
+		return false;
+	}
+	
+	ioctl(group->leader_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(group->leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	return true;
+}
+
+static void pc_group_close(pc_group_p group){
+	for(size_t i = 0; i < PC_COUNTER_COUNT; i++){
+		if (group->fds[i] != -1 && group->fds[i] != group->leader_fd)
+			close(group->fds[i]);
+	}
+	close(group->leader_fd);
+}
+
+/**
+ * Reads all counters of the group with one syscall and adds them to values. Unavailable counters add
+ * nothing.
+ */
+static bool pc_group_read(pc_group_p group, uint64_t values[PC_COUNTER_COUNT]){
+	uint64_t buffer[3 + PC_COUNTER_COUNT];
+	ssize_t size = read(group->leader_fd, buffer, sizeof(uint64_t) * (3 + group->open_count));
+	if (size != (ssize_t)(sizeof(uint64_t) * (3 + group->open_count)))
+		return false;
+	
+	// buffer[0] is the number of counters, then time enabled and running (ns)
+	uint64_t enabled = buffer[1], running = buffer[2];
+	double scale = (running > 0 && running < enabled) ? (double)enabled / running : 1;
+	for(size_t i = 0; i < PC_COUNTER_COUNT; i++){
+		if (group->slot[i] != -1)
+			values[i] += buffer[3 + group->slot[i]] * scale;
+	}
+	return true;
+}
+
+
+/**
+ * Opens the counter group for the calling thread and makes it the thread's pc_current. Returns NULL if
+ * not even one counter could be opened.
+ */
+perfcount_p pc_open(){
+	perfcount_p pc = calloc(1, sizeof(perfcount_t));
+	if ( !pc_group_open(&pc->groups[0], 0) ) {
+		free(pc);
+		return NULL;
+	}
+	pc->group_count = 1;
+	
+	pc_current = pc;
+	return pc;
+}
+
+/**
+ * Also counts thread tid (e.g. a job worker, see job_thread_id()) from now on. Its counts are added to
+ * the phases measured by the thread that opened pc.
+ */
+bool pc_attach(perfcount_p pc, pid_t tid){
+	if (pc->group_count == PC_MAX_GROUPS || !pc_group_open(&pc->groups[pc->group_count], tid))
+		return false;
+	pc->group_count++;
+	return true;
+}
+
+void pc_close(perfcount_p pc){
+	if (pc_current == pc)
+		pc_current = NULL;
+	
+	for(size_t i = 0; i < pc->group_count; i++)
+		pc_group_close(&pc->groups[i]);
+	free(pc);
+}
+
+/**
+ * Reads the counters of all groups, one syscall per group, and sums them. Unavailable counters are set
+ * to 0.
+ */
+bool pc_read(perfcount_p pc, uint64_t values[PC_COUNTER_COUNT]){
+	memset(values, 0, sizeof(uint64_t) * PC_COUNTER_COUNT);
+	for(size_t i = 0; i < pc->group_count; i++){
+		if ( !pc_group_read(&pc->groups[i], values) )
+			return false;
+	}
+	return true;
+}
+
+void pc_reset(perfcount_p pc){
+	memset(pc->totals, 0, sizeof(pc->totals));
+	memset(pc->calls, 0, sizeof(pc->calls));
+}
+
+void pc_phase_begin(perfcount_p pc, pc_phase_t phase){
+	pc_read(pc, pc->start[phase]);
+}
+
+void pc_phase_end(perfcount_p pc, pc_phase_t phase){
+	uint64_t values[PC_COUNTER_COUNT];
+	if ( !pc_read(pc, values) )
+		return;
+	
+	for(size_t i = 0; i < PC_COUNTER_COUNT; i++)
+		pc->totals[phase][i] += (double)values[i] - (double)pc->start[phase][i];
+	pc->calls[phase]++;
+}
+
+/**
+ * Prints the counts per phase (per call if steps is 0, otherwise per simulation step) with IPC and miss
+ * rates per 1000 instructions. Instructions per cycle below ~1 with many LLC misses hints at a memory
+ * bound phase. The counts are summed over all threads counted by pc.
+ */
+void pc_report(perfcount_p pc, FILE *out, uint64_t steps){
+	if (pc->group_count > 1)
+		fprintf(out, "counts summed over %zu threads\n", pc->group_count);
+	fprintf(out, "%-16s %8s", "phase", "calls");
+	for(size_t i = 0; i < PC_COUNTER_COUNT; i++)
+		fprintf(out, " %14s", (pc->groups[0].slot[i] != -1) ? pc_events[i].name : "n/a");
+	fprintf(out, " %6s %10s %10s\n", "IPC", "L1d/kinst", "LLC/kinst");
+	
+	for(size_t p = 0; p < PC_PHASE_COUNT; p++){
+		if (pc->calls[p] == 0)
+			continue;
+		
+		double div = (steps > 0 && p != PC_MODEL_LOAD) ? steps : pc->calls[p];
+		fprintf(out, "%-16s %8" PRIu64, pc_phase_names[p], pc->calls[p]);
+		for(size_t i = 0; i < PC_COUNTER_COUNT; i++)
+			fprintf(out, " %14.0f", pc->totals[p][i] / div);
+		
+		double *t = pc->totals[p];
+		double kinst = t[PC_INSTRUCTIONS] / 1000;
+		fprintf(out, " %6.2f %10.2f %10.2f\n",
+			(t[PC_CYCLES] > 0) ? t[PC_INSTRUCTIONS] / t[PC_CYCLES] : 0,
+			(kinst > 0) ? t[PC_L1D_MISSES] / kinst : 0,
+			(kinst > 0) ? t[PC_LLC_MISSES] / kinst : 0);
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/**
+
+Hardware performance counters (perf_event_open) per phase of the simulation step and model loading.
+
+pc_open() opens one group of counters for the calling thread: cycles, instructions, L1 data cache read
+misses, last level cache misses and branch mispredictions. The group is read with one read() call, so
+pc_begin() and pc_end() cost one syscall each. The counts between them are added to the totals of the
+phase.
+
+A group only counts one thread. Phases that run on the job system need a group for every worker,
+pc_attach() adds one for another thread (see job_thread_id()). pc_begin() and pc_end() then read all
+groups and the phase gets the sum, one syscall per group. Idle workers spin for a while before they
+sleep, that spinning is counted for whichever phase is running at the time.
+
+The counters are stored per thread in pc_current, pc_begin() and pc_end() do nothing on threads
+without them (e.g. the I/O thread) or if the counters are unavailable (no PMU, perf_event_paranoid too
+high). Counters the CPU doesn't support are left out of the group and reported as unavailable.
+
+If the kernel has to multiplex the counters the values are scaled by time enabled / time running.
+
+*/
+
+typedef enum {
+	PC_CYCLES,
+	PC_INSTRUCTIONS,
+	PC_L1D_MISSES,
+	PC_LLC_MISSES,
+	PC_BRANCH_MISSES,
+	PC_COUNTER_COUNT
+} pc_counter_t;
+
+typedef enum {
+	PC_SIM_GRAB,
+	PC_SIM_THRUSTERS,
+	PC_SIM_BEAMS,
+	PC_SIM_INTEGRATION,
+	PC_SIM_RIGID,
+	PC_MODEL_LOAD,
+	PC_PHASE_COUNT
+} pc_phase_t;
+
+#define PC_MAX_GROUPS 256
+
+typedef struct {
+	int leader_fd;
+	int fds[PC_COUNTER_COUNT];  // -1 if unavailable
+	// Position of each counter in the values read from the group, -1 if unavailable
+	int slot[PC_COUNTER_COUNT];
+	size_t open_count;
+} pc_group_t, *pc_group_p;
+
+typedef struct {
+	pc_group_t groups[PC_MAX_GROUPS];  // the first one counts the thread that called pc_open()
+	size_t group_count;
+	
+	uint64_t start[PC_PHASE_COUNT][PC_COUNTER_COUNT];
+	double totals[PC_PHASE_COUNT][PC_COUNTER_COUNT];
+	uint64_t calls[PC_PHASE_COUNT];
+} perfcount_t, *perfcount_p;
+
+extern __thread perfcount_p pc_current;
+
+perfcount_p pc_open();
+bool pc_attach(perfcount_p pc, pid_t tid);
+void pc_close(perfcount_p pc);
+bool pc_read(perfcount_p pc, uint64_t values[PC_COUNTER_COUNT]);
+void pc_reset(perfcount_p pc);
+void pc_report(perfcount_p pc, FILE *out, uint64_t steps);
+
+void pc_phase_begin(perfcount_p pc, pc_phase_t phase);
+void pc_phase_end(perfcount_p pc, pc_phase_t phase);
+
+static inline void pc_begin(pc_phase_t phase){
+	if (pc_current)
+		pc_phase_begin(pc_current, phase);
+}
+
+static inline void pc_end(pc_phase_t phase){
+	if (pc_current)
+		pc_phase_end(pc_current, phase);
+}
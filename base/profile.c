@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "profile.h"
+
+
+bool prof_enabled = true;
+
+prof_timer_t prof_timers[PROF_PHASE_COUNT] = {
+	[PROF_SIMULATE]        = { .name = "simulate" },
+	[PROF_SIM_GRAB]        = { .name = "sim grab force" },
+	[PROF_SIM_THRUSTERS]   = { .name = "sim thrusters" },
+	[PROF_SIM_BEAMS]       = { .name = "sim beams" },
+	[PROF_SIM_INTEGRATION] = { .name = "sim integration" },
+	[PROF_SIM_RIGID]       = { .name = "sim rigid checks" },
+	[PROF_DRAW]            = { .name = "draw" },
+	[PROF_DRAW_GRID]       = { .name = "draw grid" },
+	[PROF_DRAW_UPLOAD]     = { .name = "draw upload" },
+	[PROF_DRAW_PARTICLES]  = { .name = "draw particles" },
+	[PROF_DRAW_BEAMS]      = { .name = "draw beams" },
+	[PROF_DRAW_THRUSTERS]  = { .name = "draw thrusters" },
+	[PROF_DRAW_CURSOR]     = { .name = "draw cursor" },
+	[PROF_DRAW_SWAP]       = { .name = "swap" }
+};
+
+
+/**
+ * Current time of the monotonic clock in ns.
+ */
+uint64_t prof_now(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int prof_compare(const void *a, const void *b){
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Min, mean and 99th percentile of the samples in the window of a phase. Sorts a copy of the window so
+ * don't call it every step.
+ */
+prof_stats_t prof_stats(prof_phase_t phase){
+	prof_timer_p timer = &prof_timers[phase];
+	size_t count = (timer->total < PROF_WINDOW) ? timer->total : PROF_WINDOW;
+	if (count == 0)
+		return (prof_stats_t){ 0, 0, 0, 0 };
+	
+	uint64_t sorted[PROF_WINDOW];
+	memcpy(sorted, timer->samples, sizeof(uint64_t) * count);
+	qsort(sorted, count, sizeof(uint64_t), prof_compare);
+	
+	uint64_t sum = 0;
+	for(size_t i = 0; i < count; i++)
+		sum += sorted[i];
+	
+	// Nearest rank percentile
+	size_t p99_rank = (count * 99 + 99) / 100;
+	return (prof_stats_t){
+		.count = count,
+		.min = sorted[0] / 1e6,
+		.mean = (double)sum / count / 1e6,
+		.p99 = sorted[p99_rank - 1] / 1e6
+	};
+}
+
+void prof_reset(){
+	for(size_t i = 0; i < PROF_PHASE_COUNT; i++)
+		prof_timers[i].total = 0;
+}
+
+bool prof_export_csv(const char *filename){
+	FILE *f = fopen(filename, "w");
+	if (f == NULL) {
+		perror("fopen");
+		return false;
+	}
+	
+	fprintf(f, "phase,samples,min_ms,mean_ms,p99_ms\n");
+	for(size_t i = 0; i < PROF_PHASE_COUNT; i++){
+		prof_stats_t s = prof_stats(i);
+		fprintf(f, "%s,%" PRIu64 ",%.6f,%.6f,%.6f\n", prof_timers[i].name, s.count, s.min, s.mean, s.p99);
+	}
+	
+	fclose(f);
+	return true;
+}
+
+bool prof_export_json(const char *filename){
+	FILE *f = fopen(filename, "w");
+	if (f == NULL) {
+		perror("fopen");
+		return false;
+	}
+	
+	fprintf(f, "{\"window\": %d, \"phases\": [\n", PROF_WINDOW);
+	for(size_t i = 0; i < PROF_PHASE_COUNT; i++){
+		prof_stats_t s = prof_stats(i);
+		fprintf(f, "\t{\"name\": \"%s\", \"samples\": %" PRIu64 ", \"min_ms\": %.6f, \"mean_ms\": %.6f, \"p99_ms\": %.6f}%s\n",
+			prof_timers[i].name, s.count, s.min, s.mean, s.p99, (i < PROF_PHASE_COUNT - 1) ? "," : "");
+	}
+	fprintf(f, "]}\n");
+	
+	fclose(f);
+	return true;
+}
+
+/**
+ * Exports as JSON if the filename ends with .json, otherwise as CSV.
+ */
+bool prof_export(const char *filename){
+	size_t len = strlen(filename);
+	if (len >= 5 && strcmp(filename + len - 5, ".json") == 0)
+		return prof_export_json(filename);
+	return prof_export_csv(filename);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+
+Per-phase timing of the simulation step and the renderer.
+
+Wrap a phase in prof_begin() and prof_end(). The duration is measured with the monotonic clock and
+stored in a ring of the last PROF_WINDOW samples of that phase. prof_stats() calculates min, mean and
+99th percentile over that window. All functions are meant to be called from the main thread only.
+
+	prof_begin(PROF_SIM_BEAMS);
+	...
+	prof_end(PROF_SIM_BEAMS);
+
+The PROF_SIMULATE and PROF_DRAW phases cover the whole step and frame, the phases after them are
+nested inside.
+
+Renderer phases measure the CPU time spent issuing GL commands. The GPU work mostly shows up in the swap
+phase where the driver waits for it.
+
+*/
+
+#define PROF_WINDOW 512
+
+typedef enum {
+	PROF_SIMULATE,
+	PROF_SIM_GRAB,
+	PROF_SIM_THRUSTERS,
+	PROF_SIM_BEAMS,
+	PROF_SIM_INTEGRATION,
+	PROF_SIM_RIGID,
+	PROF_DRAW,
+	PROF_DRAW_GRID,
+	PROF_DRAW_UPLOAD,
+	PROF_DRAW_PARTICLES,
+	PROF_DRAW_BEAMS,
+	PROF_DRAW_THRUSTERS,
+	PROF_DRAW_CURSOR,
+	PROF_DRAW_SWAP,
+	PROF_PHASE_COUNT
+} prof_phase_t;
+
+typedef struct {
+	uint64_t count;  // samples in the window
+	double min, mean, p99;  // ms
+} prof_stats_t, *prof_stats_p;
+
+typedef struct {
+	const char *name;
+	uint64_t start;  // ns, set by prof_begin()
+	uint64_t samples[PROF_WINDOW];  // ns
+	uint64_t total;  // number of samples ever recorded
+} prof_timer_t, *prof_timer_p;
+
+extern bool prof_enabled;
+extern prof_timer_t prof_timers[PROF_PHASE_COUNT];
+
+uint64_t prof_now();
+prof_stats_t prof_stats(prof_phase_t phase);
+void prof_reset();
+bool prof_export_csv(const char *filename);
+bool prof_export_json(const char *filename);
+bool prof_export(const char *filename);
+
+static inline void prof_begin(prof_phase_t phase){
+	if (prof_enabled)
+		prof_timers[phase].start = prof_now();
+}
+
+static inline void prof_end(prof_phase_t phase){
+	if (prof_enabled) {
+		prof_timer_p timer = &prof_timers[phase];
+		timer->samples[timer->total % PROF_WINDOW] = prof_now() - timer->start;
+		timer->total++;
+	}
+}
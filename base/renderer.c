@@ -0,0 +1,1421 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <assert.h>
+#define __USE_XOPEN 1
+#include <math.h>
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/gl.h>
+
+#include "common.h"
+#include "renderer.h"
+#include "profile.h"
+#include "alloc.h"
+
+
+// Viewport of the renderer. Data from the viewport is used by other components.
+viewport_p viewport;
+
+//
+// Frame uniforms
+//
+
+// Viewport data shared by all programs through the frame_uniforms block. Layout is std140, the
+// columns of a mat3 are padded to a vec4 each.
+typedef struct {
+	float world_to_normal[3][4];
+	float screen_to_normal[3][4];
+	float screen_size[2];
+	float scale_exp;
+	float padding;
+} frame_uniforms_t;
+
+#define FRAME_UNIFORM_BINDING 0
+GLuint frame_uniform_buffer;
+// Content of the buffer, it's only uploaded again when the viewport changed
+frame_uniforms_t frame_uniforms;
+
+void frame_uniforms_load(){
+	glGenBuffers(1, &frame_uniform_buffer);
+	assert(frame_uniform_buffer != 0);
+	glBindBuffer(GL_UNIFORM_BUFFER, frame_uniform_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(frame_uniforms_t), NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, frame_uniform_buffer);
+	memset(&frame_uniforms, 0, sizeof(frame_uniforms));
+}
+
+void frame_uniforms_unload(){
+	glDeleteBuffers(1, &frame_uniform_buffer);
+}
+
+/**
+ * Uploads the viewport data if it changed since the last call. Every draw function that uses the
+ * frame_uniforms block calls it first, so they also work when called on their own.
+ */
+static void frame_uniforms_update(){
+	frame_uniforms_t u;
+	memset(&u, 0, sizeof(u));
+	for(size_t c = 0; c < 3; c++){
+		for(size_t r = 0; r < 3; r++){
+			u.world_to_normal[c][r] = viewport->world_to_normal[c*3 + r];
+			u.screen_to_normal[c][r] = viewport->screen_to_normal[c*3 + r];
+		}
+	}
+	u.screen_size[0] = viewport->screen_size.x;
+	u.screen_size[1] = viewport->screen_size.y;
+	u.scale_exp = viewport->scale_exp;
+	
+	if ( memcmp(&u, &frame_uniforms, sizeof(u)) == 0 )
+		return;
+	frame_uniforms = u;
+	glBindBuffer(GL_UNIFORM_BUFFER, frame_uniform_buffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frame_uniforms), &frame_uniforms);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+
+//
+// Grid
+//
+program_p grid_prog;
+GLuint grid_vertex_buffer, grid_vertex_array;
+GLint grid_color_uni;
+// Space between grid lines in world units
+vec2_t grid_default_spacing = {1, 1};
+bool grid_visible = true;
+
+// Lines of the current view, 4 vertices (a quad 2 pixels wide) per line in normalized device
+// coordinates. The lines of the lower level come first, then the ones of the upper level.
+float *grid_vertices = NULL;
+size_t grid_vertex_capacity = 0, grid_vertex_buffer_capacity = 0;  // vertices
+size_t grid_lower_count, grid_upper_count;  // lines
+float grid_lower_alpha;
+// View the lines were generated for
+struct { vec2_t pos, screen_size; float scale_exp; } grid_view;
+bool grid_outdated = true;
+
+void grid_load(){
+	program_finish(grid_prog);
+	assert(grid_prog->linked);
+	grid_color_uni = program_uniform(grid_prog, "color", GL_FLOAT_VEC4);
+	
+	glGenBuffers(1, &grid_vertex_buffer);
+	assert(grid_vertex_buffer != 0);
+	glBindBuffer(GL_ARRAY_BUFFER, grid_vertex_buffer);
+	
+	glGenVertexArrays(1, &grid_vertex_array);
+	glBindVertexArray(grid_vertex_array);
+	GLint pos_attrib = program_attrib(grid_prog, "pos", GL_FLOAT_VEC2);
+	glEnableVertexAttribArray(pos_attrib);
+	glVertexAttribPointer(pos_attrib, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	
+	grid_outdated = true;
+}
+
+void grid_unload(){
+	glDeleteVertexArrays(1, &grid_vertex_array);
+	glDeleteBuffers(1, &grid_vertex_buffer);
+	mem_track_free(MEM_GL_STAGING, sizeof(float) * 2 * grid_vertex_buffer_capacity);
+	mem_free(MEM_RENDERER, grid_vertices);
+	grid_vertices = NULL;
+	grid_vertex_capacity = grid_vertex_buffer_capacity = 0;
+	program_destroy(grid_prog);
+}
+
+// Same as mod() in GLSL, the result has the sign of y
+static float grid_mod(float x, float y){
+	return x - y * floorf(x / y);
+}
+
+/**
+ * Appends the lines of one axis (0 for vertical lines, 1 for horizontal ones) every spacing pixels,
+ * shifted by offset pixels. A line covers the pixels whose centers are less than 1 pixel away from it.
+ */
+static void grid_axis(size_t axis, float spacing, float offset, size_t *vertex_count){
+	float length = (axis == 0) ? viewport->screen_size.x : viewport->screen_size.y;
+	float first = ceilf((offset - 1) / spacing), last = floorf((length + 1 + offset) / spacing);
+	for(float k = first; k <= last; k++){
+		float center = k * spacing - offset;
+		float from = (center - 1) / length * 2 - 1, to = (center + 1) / length * 2 - 1;
+		const float quad[4][2] = { { from, -1 }, { to, -1 }, { to, 1 }, { from, 1 } };
+		
+		if (*vertex_count + 4 > grid_vertex_capacity) {
+			grid_vertex_capacity = (grid_vertex_capacity == 0) ? 1024 : grid_vertex_capacity * 2;
+			grid_vertices = mem_realloc(MEM_RENDERER, grid_vertices, sizeof(float) * 2 * grid_vertex_capacity);
+		}
+		float *v = grid_vertices + *vertex_count * 2;
+		for(size_t i = 0; i < 4; i++){
+			v[i*2 + axis] = quad[i][0];
+			v[i*2 + 1 - axis] = quad[i][1];
+		}
+		*vertex_count += 4;
+	}
+}
+
+/**
+ * Generates the grid lines when the view changed since the last call. There are two levels of grid
+ * lines, each upper cell contains 4x4 lower ones. While zooming out the lines of the lower level fade
+ * out until the upper level becomes the lower one.
+ */
+static void grid_update(){
+	if ( !grid_outdated && grid_view.scale_exp == viewport->scale_exp
+		&& grid_view.pos.x == viewport->pos.x && grid_view.pos.y == viewport->pos.y
+		&& grid_view.screen_size.x == viewport->screen_size.x && grid_view.screen_size.y == viewport->screen_size.y )
+		return;
+	grid_outdated = false;
+	grid_view.pos = viewport->pos;
+	grid_view.screen_size = viewport->screen_size;
+	grid_view.scale_exp = viewport->scale_exp;
+	
+	// Spacing and offset of the grid in pixels
+	vec2_t grid_spacing = (vec2_t){
+		grid_default_spacing.x * viewport->world_to_screen[0],
+		grid_default_spacing.y * viewport->world_to_screen[4]
+	};
+	vec2_t grid_offset = (vec2_t){
+		viewport->pos.x * viewport->world_to_screen[0],
+		viewport->pos.y * viewport->world_to_screen[4]
+	};
+	
+	// The two nearest levels, the upper level has twice the scale exponent of the lower one
+	float blend = grid_mod(viewport->scale_exp, 2);
+	float scale_down = floorf(viewport->scale_exp - blend);
+	float scale_up = scale_down + 2;
+	grid_lower_alpha = 1 - blend;
+	
+	size_t vertex_count = 0;
+	float scales[2] = { scale_down, scale_up };
+	for(size_t level = 0; level < 2; level++){
+		vec2_t spacing = { grid_spacing.x * powf(2, scales[level]), grid_spacing.y * powf(2, scales[level]) };
+		vec2_t offset = {
+			grid_mod(grid_offset.x, spacing.x) - grid_mod(viewport->screen_size.x / 2, spacing.x),
+			grid_mod(grid_offset.y, spacing.y) - grid_mod(viewport->screen_size.y / 2, spacing.y)
+		};
+		
+		size_t level_start = vertex_count;
+		grid_axis(0, spacing.x, offset.x, &vertex_count);
+		grid_axis(1, spacing.y, offset.y, &vertex_count);
+		if (level == 0)
+			grid_lower_count = (vertex_count - level_start) / 4;
+		else
+			grid_upper_count = (vertex_count - level_start) / 4;
+	}
+	
+	glBindBuffer(GL_ARRAY_BUFFER, grid_vertex_buffer);
+	if (vertex_count > grid_vertex_buffer_capacity) {
+		mem_track_free(MEM_GL_STAGING, sizeof(float) * 2 * grid_vertex_buffer_capacity);
+		grid_vertex_buffer_capacity = grid_vertex_capacity;
+		glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 2 * grid_vertex_buffer_capacity, NULL, GL_DYNAMIC_DRAW);
+		mem_track_alloc(MEM_GL_STAGING, sizeof(float) * 2 * grid_vertex_buffer_capacity);
+	}
+	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * 2 * vertex_count, grid_vertices);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+/**
+ * Draws the grid as quads. It's drawn right after clearing to black: the colors are premultiplied and
+ * blended with GL_MAX so pixels where lines cross (or both levels overlap) aren't blended twice.
+ */
+void grid_draw(){
+	grid_update();
+	
+	glUseProgram(grid_prog->id);
+	glBindVertexArray(grid_vertex_array);
+	glBlendEquation(GL_MAX);
+	
+	if (grid_lower_alpha > 0) {
+		glUniform4f(grid_color_uni, 0, 0, 0.5 * grid_lower_alpha, grid_lower_alpha);
+		glDrawArrays(GL_QUADS, 0, grid_lower_count * 4);
+	}
+	glUniform4f(grid_color_uni, 0, 0, 0.5, 1);
+	glDrawArrays(GL_QUADS, grid_lower_count * 4, grid_upper_count * 4);
+	
+	glBlendEquation(GL_FUNC_ADD);
+	glBindVertexArray(0);
+	glUseProgram(0);
+}
+
+//
+// Cursor
+//
+vec2_t cursor_pos = {0, 0};
+bool cursor_visible = true;
+color_t cursor_color = {1, 1, 1, 1};
+program_p cursor_prog;
+GLuint cursor_vertex_buffer, cursor_vertex_array;
+GLint cursor_pos_uni, cursor_color_uni;
+
+void cursor_load(){
+	program_finish(cursor_prog);
+	assert(cursor_prog->linked);
+	program_uniform_block(cursor_prog, "frame_uniforms", FRAME_UNIFORM_BINDING);
+	cursor_pos_uni = program_uniform(cursor_prog, "cursor_pos", GL_FLOAT_VEC2);
+	cursor_color_uni = program_uniform(cursor_prog, "color", GL_FLOAT_VEC4);
+	
+	glGenBuffers(1, &cursor_vertex_buffer);
+	assert(cursor_vertex_buffer != 0);
+	glBindBuffer(GL_ARRAY_BUFFER, cursor_vertex_buffer);
+	
+	// Rectangle
+	const float vertecies[] = {
+		5, 5,
+		-5, 5,
+		-5, -5,
+		5, -5
+	};
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertecies), vertecies, GL_STATIC_DRAW);
+	
+	glGenVertexArrays(1, &cursor_vertex_array);
+	glBindVertexArray(cursor_vertex_array);
+	GLint pos_attrib = program_attrib(cursor_prog, "pos", GL_FLOAT_VEC2);
+	glEnableVertexAttribArray(pos_attrib);
+	glVertexAttribPointer(pos_attrib, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void cursor_unload(){
+	glDeleteVertexArrays(1, &cursor_vertex_array);
+	glDeleteBuffers(1, &cursor_vertex_buffer);
+	program_destroy(cursor_prog);
+}
+
+void cursor_draw(){
+	//printf("cursor pos: x %f y %f\n", cursor_pos.x, cursor_pos.y);
+	
+	frame_uniforms_update();
+	glUseProgram(cursor_prog->id);
+	glBindVertexArray(cursor_vertex_array);
+	
+	glUniform2f(cursor_pos_uni, cursor_pos.x, cursor_pos.y);
+	glUniform4f(cursor_color_uni, cursor_color.r, cursor_color.g, cursor_color.b, cursor_color.a);
+	glDrawArrays(GL_QUADS, 0, 4);
+	
+	glBindVertexArray(0);
+	glUseProgram(0);
+}
+
+
+//
+// Streaming
+//
+
+// Data the CPU writes every frame goes through a ring of STREAM_REGIONS regions in one buffer. Each
+// frame writes into the next region and fences the previous one once all its draws were issued, so the
+// CPU only waits when it gets STREAM_REGIONS frames ahead of the GPU. With buffer storage (GL 4.4 or
+// ARB_buffer_storage) the buffer is mapped once and stays mapped. Otherwise each frame maps its region
+// unsynchronized, the fence already guarantees that the GPU is done with it. Growing the buffer
+// orphans the old storage.
+#define STREAM_REGIONS 3
+#define STREAM_ALIGN 64
+
+GLuint stream_buffer;
+bool stream_persistent = false;
+uint8_t *stream_mapped = NULL;  // whole buffer while persistently mapped
+size_t stream_region_size = 0, stream_region = 0;
+bool stream_region_used = false;
+GLsync stream_fences[STREAM_REGIONS];
+
+static bool stream_buffer_storage_supported(){
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	return (major > 4 || (major == 4 && minor >= 4) || gl_extension_supported("GL_ARB_buffer_storage"));
+}
+
+static void stream_wait(size_t region){
+	if (stream_fences[region] == NULL)
+		return;
+	while ( glClientWaitSync(stream_fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED )
+		;
+	glDeleteSync(stream_fences[region]);
+	stream_fences[region] = NULL;
+}
+
+/**
+ * Creates the storage for regions of region_size bytes. stream_buffer has to be bound to
+ * GL_ARRAY_BUFFER.
+ */
+static void stream_storage(size_t region_size){
+	stream_region_size = region_size;
+	if (stream_persistent) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_ARRAY_BUFFER, stream_region_size * STREAM_REGIONS, NULL, flags);
+		stream_mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, stream_region_size * STREAM_REGIONS, flags);
+		assert(stream_mapped != NULL);
+	} else {
+		glBufferData(GL_ARRAY_BUFFER, stream_region_size * STREAM_REGIONS, NULL, GL_STREAM_DRAW);
+	}
+	mem_track_alloc(MEM_GL_STAGING, stream_region_size * STREAM_REGIONS);
+}
+
+static void stream_load(){
+	stream_persistent = stream_buffer_storage_supported();
+	glGenBuffers(1, &stream_buffer);
+	assert(stream_buffer != 0);
+	glBindBuffer(GL_ARRAY_BUFFER, stream_buffer);
+	stream_storage(64 * 1024);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	
+	stream_region = 0;
+	stream_region_used = false;
+	memset(stream_fences, 0, sizeof(stream_fences));
+}
+
+static void stream_unload(){
+	for(size_t i = 0; i < STREAM_REGIONS; i++)
+		stream_wait(i);
+	if (stream_mapped) {
+		glBindBuffer(GL_ARRAY_BUFFER, stream_buffer);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		stream_mapped = NULL;
+	}
+	glDeleteBuffers(1, &stream_buffer);
+	mem_track_free(MEM_GL_STAGING, stream_region_size * STREAM_REGIONS);
+	stream_region_size = 0;
+}
+
+/**
+ * Moves on to the next region and returns a pointer to write bytes into it. offset is set to the
+ * position of the data in stream_buffer. Draws of the last frame have to be issued before this is
+ * called, they're covered by the fence of their region. Leaves stream_buffer bound to GL_ARRAY_BUFFER,
+ * call stream_end() once all data is written.
+ */
+static void* stream_begin(size_t bytes, size_t *offset){
+	if (stream_region_used) {
+		stream_fences[stream_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		stream_region = (stream_region + 1) % STREAM_REGIONS;
+	}
+	stream_region_used = true;
+	glBindBuffer(GL_ARRAY_BUFFER, stream_buffer);
+	
+	if (bytes > stream_region_size) {
+		// Immutable storage can't be resized, so replace the buffer. Persistent mappings have to be
+		// unmapped before that and all regions must be idle since the old mapping goes away.
+		size_t region_size = stream_region_size;
+		while (region_size < bytes)
+			region_size *= 2;
+		
+		for(size_t i = 0; i < STREAM_REGIONS; i++)
+			stream_wait(i);
+		if (stream_mapped) {
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+			stream_mapped = NULL;
+		}
+		glDeleteBuffers(1, &stream_buffer);
+		mem_track_free(MEM_GL_STAGING, stream_region_size * STREAM_REGIONS);
+		glGenBuffers(1, &stream_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, stream_buffer);
+		stream_storage(region_size);
+		stream_region = 0;
+	}
+	
+	stream_wait(stream_region);
+	*offset = stream_region * stream_region_size;
+	if (stream_persistent)
+		return stream_mapped + *offset;
+	return glMapBufferRange(GL_ARRAY_BUFFER, *offset, bytes, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+}
+
+static void stream_end(){
+	if (!stream_persistent)
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static size_t stream_align(size_t bytes){
+	return (bytes + STREAM_ALIGN - 1) / STREAM_ALIGN * STREAM_ALIGN;
+}
+
+/**
+ * Makes attrib a per instance attribute of the bound vertex array.
+ */
+static void instance_attrib_enable(GLint attrib){
+	glEnableVertexAttribArray(attrib);
+	glVertexAttribDivisor(attrib, 1);
+}
+
+
+//
+// Frame data
+//
+
+// Per instance data of thrusters, the shape is rotated between both particles
+typedef struct {
+	float x1, y1, x2, y2;
+	uint8_t color[4];
+} thruster_instance_t;
+
+// Per instance data of tiles drawn as a box, corners in world space
+typedef struct {
+	float x1, y1, x2, y2;
+	uint8_t color[4];
+} box_instance_t;
+
+typedef struct {
+	size_t first, count;
+} draw_range_t;
+
+// Level of detail, see renderer.h
+renderer_lod_t renderer_lod = { 2, 1, 2, 1 };
+
+// Compact streams (see renderer.h): positions are 16 bit fixed point relative to the frame (origin and
+// size) of their tile, particles get a byte of flags instead of a color. The shaders find the frame in
+// the tile_frames uniform block through a static buffer with the tile index of each particle.
+bool renderer_compact_streams = false;
+// Size of the tile_frames block in the *_compact.vs shaders
+#define TILE_FRAMES_MAX 1024
+#define TILE_FRAME_BINDING 1
+#define PARTICLE_FLAG_SELECTED	1<<0
+GLuint tile_frame_buffer, tile_index_buffer;
+size_t tile_index_capacity = 0;  // particles
+
+// What renderer_upload() put into the stream for the current frame. Positions and colors are indexed
+// like the particles of the model, but only the tiles needed by the draws are written. Thruster and
+// box instances are packed.
+model_p frame_model = NULL;
+size_t frame_thruster_count = 0, frame_box_count = 0;
+size_t frame_positions_offset, frame_colors_offset, frame_thrusters_offset, frame_boxes_offset;  // in stream_buffer
+float frame_particle_alpha = 1;
+bool frame_compact = false;
+// Particles and beams (in the index buffer) to draw, ranges of consecutive visible tiles
+draw_range_t *frame_particle_ranges = NULL;
+size_t frame_particle_range_count = 0;
+GLsizei *frame_beam_counts = NULL;  // indices per range for glMultiDrawElements()
+const GLvoid **frame_beam_offsets = NULL;
+size_t frame_beam_range_count = 0;
+
+// Two particle indices per unbroken beam, sorted into groups by the tile of the first particle. Only
+// rebuilt when the model structure changed or a beam broke since the indices were built.
+GLuint beam_index_buffer;
+uint32_t *beam_indices = NULL;
+size_t beam_index_count = 0, beam_index_capacity = 0, beam_buffer_capacity = 0;  // beams
+model_p beam_index_model = NULL;
+uint32_t beam_index_revision = 0, beam_index_breaks = 0;
+size_t beam_index_beam_count = 0, beam_index_particle_count = 0;
+
+// Per tile data, tile_capacity entries each (one more for the offsets)
+size_t tile_capacity = 0;
+size_t *beam_group_offsets = NULL;  // first beam of each group, the last entry is beam_index_count
+float *beam_group_lengths = NULL;  // m, sum of the beam lengths of each group
+float *tile_detail = NULL;  // 1 drawn as particles and beams, 0 only as box, both blended in between
+float (*tile_frames)[4] = NULL;  // origin and size in world space, content of tile_frame_buffer
+size_t *tile_neighbor_offsets = NULL;  // range in tile_neighbors, the last entry is the total count
+size_t *tile_scratch = NULL;
+uint8_t *tile_flags = NULL;
+// Other tiles the beams of each group reach into
+uint32_t *tile_neighbors = NULL;
+size_t tile_neighbor_capacity = 0;
+
+#define TILE_VISIBLE	1<<0
+#define TILE_BEAMS		1<<1
+#define TILE_UPLOAD		1<<2
+#define TILE_BOX		1<<3
+// m, size of a particle quad (see particle.vs)
+#define PARTICLE_SIZE 0.25
+// m, particle quads and thruster shapes reach this far beyond their particles
+#define CULL_MARGIN 1.0
+
+static void tiles_reserve(size_t tile_count){
+	if (tile_flags != NULL && tile_count <= tile_capacity)
+		return;
+	tile_capacity = tile_count;
+	beam_group_offsets = mem_realloc(MEM_RENDERER, beam_group_offsets, sizeof(size_t) * (tile_capacity + 1));
+	tile_neighbor_offsets = mem_realloc(MEM_RENDERER, tile_neighbor_offsets, sizeof(size_t) * (tile_capacity + 1));
+	beam_group_lengths = mem_realloc(MEM_RENDERER, beam_group_lengths, sizeof(float) * tile_capacity);
+	tile_detail = mem_realloc(MEM_RENDERER, tile_detail, sizeof(float) * tile_capacity);
+	tile_frames = mem_realloc(MEM_RENDERER, tile_frames, sizeof(float) * 4 * tile_capacity);
+	tile_scratch = mem_realloc(MEM_RENDERER, tile_scratch, sizeof(size_t) * tile_capacity);
+	tile_flags = mem_realloc(MEM_RENDERER, tile_flags, sizeof(uint8_t) * tile_capacity);
+	frame_particle_ranges = mem_realloc(MEM_RENDERER, frame_particle_ranges, sizeof(draw_range_t) * tile_capacity);
+	frame_beam_counts = mem_realloc(MEM_RENDERER, frame_beam_counts, sizeof(GLsizei) * tile_capacity);
+	frame_beam_offsets = mem_realloc(MEM_RENDERER, frame_beam_offsets, sizeof(GLvoid*) * tile_capacity);
+}
+
+static void beam_indices_update(model_p model){
+	if (model == beam_index_model && model->revision == beam_index_revision && model->beam_breaks == beam_index_breaks
+		&& model->beam_count == beam_index_beam_count && model->particle_count == beam_index_particle_count)
+		return;
+	beam_index_model = model;
+	beam_index_revision = model->revision;
+	beam_index_breaks = model->beam_breaks;
+	beam_index_beam_count = model->beam_count;
+	beam_index_particle_count = model->particle_count;
+	
+	size_t tile_count = model_tile_count(model);
+	tiles_reserve(tile_count);
+	
+	// Counting sort of the unbroken beams by the tile of their first particle, beams of a group keep
+	// their model order
+	memset(tile_scratch, 0, sizeof(size_t) * tile_count);
+	beam_index_count = 0;
+	for(size_t i = 0; i < model->beam_count; i++){
+		if (model->beams[i].flags & BEAM_BROKEN)
+			continue;
+		tile_scratch[model->beams[i].i1 / MODEL_TILE_SIZE]++;
+		beam_index_count++;
+	}
+	
+	if (beam_index_count > beam_index_capacity) {
+		beam_index_capacity = beam_index_count;
+		beam_indices = mem_realloc(MEM_RENDERER, beam_indices, sizeof(uint32_t) * 2 * beam_index_capacity);
+	}
+	
+	size_t offset = 0;
+	for(size_t t = 0; t < tile_count; t++){
+		beam_group_offsets[t] = offset;
+		beam_group_lengths[t] = 0;
+		offset += tile_scratch[t];
+		tile_scratch[t] = beam_group_offsets[t];
+	}
+	beam_group_offsets[tile_count] = offset;
+	
+	for(size_t i = 0; i < model->beam_count; i++){
+		beam_p b = &model->beams[i];
+		if (b->flags & BEAM_BROKEN)
+			continue;
+		size_t bi = tile_scratch[b->i1 / MODEL_TILE_SIZE]++;
+		beam_group_lengths[b->i1 / MODEL_TILE_SIZE] += b->length;
+		beam_indices[bi*2+0] = b->i1;
+		beam_indices[bi*2+1] = b->i2;
+	}
+	
+	// Tiles each group reaches into, tile_scratch marks the group that listed a tile last
+	for(size_t t = 0; t < tile_count; t++)
+		tile_scratch[t] = SIZE_MAX;
+	size_t neighbor_count = 0;
+	for(size_t t = 0; t < tile_count; t++){
+		tile_neighbor_offsets[t] = neighbor_count;
+		for(size_t bi = beam_group_offsets[t]; bi < beam_group_offsets[t+1]; bi++){
+			size_t other = beam_indices[bi*2+1] / MODEL_TILE_SIZE;
+			if (other == t || tile_scratch[other] == t)
+				continue;
+			tile_scratch[other] = t;
+			
+			if (neighbor_count >= tile_neighbor_capacity) {
+				tile_neighbor_capacity = (tile_neighbor_capacity == 0) ? 1024 : tile_neighbor_capacity * 2;
+				tile_neighbors = mem_realloc(MEM_RENDERER, tile_neighbors, sizeof(uint32_t) * tile_neighbor_capacity);
+			}
+			tile_neighbors[neighbor_count++] = other;
+		}
+	}
+	tile_neighbor_offsets[tile_count] = neighbor_count;
+	
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, beam_index_buffer);
+	if (beam_index_count > beam_buffer_capacity) {
+		mem_track_free(MEM_GL_STAGING, sizeof(uint32_t) * 2 * beam_buffer_capacity);
+		beam_buffer_capacity = beam_index_count;
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * 2 * beam_buffer_capacity, NULL, GL_STATIC_DRAW);
+		mem_track_alloc(MEM_GL_STAGING, sizeof(uint32_t) * 2 * beam_buffer_capacity);
+	}
+	if (beam_index_count > 0)
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, sizeof(uint32_t) * 2 * beam_index_count, beam_indices);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+// Visible part of the world plus the margin. Lines are antialiased, so they can touch a pixel or two
+// beyond their ends.
+static tile_bounds_t view_bounds(){
+	float margin = CULL_MARGIN + 2 * viewport->world_size.x / viewport->screen_size.x;
+	return (tile_bounds_t){
+		{ viewport->pos.x - viewport->world_size.x / 2 - margin, viewport->pos.y - viewport->world_size.y / 2 - margin },
+		{ viewport->pos.x + viewport->world_size.x / 2 + margin, viewport->pos.y + viewport->world_size.y / 2 + margin }
+	};
+}
+
+static bool bounds_overlap(tile_bounds_t a, tile_bounds_t b){
+	return (a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y && b.min.y <= a.max.y);
+}
+
+// Fades from 1 at begin down to 0 at end while size shrinks, always 1 if the level is disabled
+static float lod_fade(float size, float begin, float end){
+	if (begin <= end || size >= begin)
+		return 1;
+	if (size <= end)
+		return 0;
+	return (size - end) / (begin - end);
+}
+
+/**
+ * Flags the tiles whose particles are visible, whose beam group is visible and whose positions are
+ * needed by either. A beam group is visible if the bounds of its tile and the tiles it reaches into
+ * overlap the viewport, that box contains all its beams.
+ * 
+ * Level of detail: particles fade out when their quads shrink below renderer_lod.particles_begin
+ * pixels. Tiles with less than renderer_lod.tiles_begin pixels per particle fade into a box over their
+ * bounds, their particles and beams are no longer drawn once the box is opaque.
+ */
+static void tiles_cull(model_p model){
+	if ( !model_tile_bounds_valid(model) )
+		model_tile_bounds_update(model);
+	
+	tile_bounds_t view = view_bounds();
+	float pixel_size = viewport->world_size.x / viewport->screen_size.x;
+	frame_particle_alpha = lod_fade(PARTICLE_SIZE / pixel_size, renderer_lod.particles_begin, renderer_lod.particles_end);
+	
+	size_t tile_count = model_tile_count(model);
+	for(size_t t = 0; t < tile_count; t++){
+		tile_bounds_t bounds = model->tile_bounds[t];
+		float width = fmaxf(bounds.max.x - bounds.min.x, pixel_size) / pixel_size;
+		float height = fmaxf(bounds.max.y - bounds.min.y, pixel_size) / pixel_size;
+		tile_detail[t] = lod_fade(width * height / tile_particle_count(model, t), renderer_lod.tiles_begin, renderer_lod.tiles_end);
+		
+		tile_flags[t] = 0;
+		if ( !bounds_overlap(bounds, view) )
+			continue;
+		if (tile_detail[t] > 0 && frame_particle_alpha > 0)
+			tile_flags[t] |= TILE_VISIBLE | TILE_UPLOAD;
+		if (tile_detail[t] < 1)
+			tile_flags[t] |= TILE_BOX;
+	}
+	
+	for(size_t t = 0; t < tile_count; t++){
+		if (beam_group_offsets[t] == beam_group_offsets[t+1] || tile_detail[t] == 0)
+			continue;
+		
+		tile_bounds_t group = model->tile_bounds[t];
+		for(size_t n = tile_neighbor_offsets[t]; n < tile_neighbor_offsets[t+1]; n++){
+			tile_bounds_t other = model->tile_bounds[tile_neighbors[n]];
+			tile_bounds_include(&group, other.min);
+			tile_bounds_include(&group, other.max);
+		}
+		if ( !bounds_overlap(group, view) )
+			continue;
+		
+		tile_flags[t] |= TILE_BEAMS | TILE_UPLOAD;
+		for(size_t n = tile_neighbor_offsets[t]; n < tile_neighbor_offsets[t+1]; n++)
+			tile_flags[tile_neighbors[n]] |= TILE_UPLOAD;
+	}
+	
+	// Merge consecutive tiles into draw ranges
+	frame_particle_range_count = frame_beam_range_count = 0;
+	size_t beam_range_end = 0;  // index after the last beam range
+	for(size_t t = 0; t < tile_count; t++){
+		if (tile_flags[t] & TILE_VISIBLE) {
+			size_t first = t * MODEL_TILE_SIZE, count = tile_particle_count(model, t);
+			draw_range_t *last = (frame_particle_range_count > 0) ? &frame_particle_ranges[frame_particle_range_count - 1] : NULL;
+			if (last && last->first + last->count == first)
+				last->count += count;
+			else
+				frame_particle_ranges[frame_particle_range_count++] = (draw_range_t){ first, count };
+		}
+		
+		if (tile_flags[t] & TILE_BEAMS) {
+			size_t first = beam_group_offsets[t] * 2;
+			GLsizei count = (beam_group_offsets[t+1] - beam_group_offsets[t]) * 2;
+			const GLvoid *offset = (const GLvoid*)(sizeof(uint32_t) * first);
+			if (frame_beam_range_count > 0 && beam_range_end == first) {
+				frame_beam_counts[frame_beam_range_count - 1] += count;
+			} else {
+				frame_beam_offsets[frame_beam_range_count] = offset;
+				frame_beam_counts[frame_beam_range_count] = count;
+				frame_beam_range_count++;
+			}
+			beam_range_end = first + count;
+		}
+	}
+}
+
+// The tile index of a particle only depends on its index, so the buffer only changes when it grows
+static void tile_indices_update(model_p model){
+	if (model->particle_count <= tile_index_capacity)
+		return;
+	
+	mem_track_free(MEM_GL_STAGING, sizeof(uint16_t) * tile_index_capacity);
+	tile_index_capacity = model_tile_count(model) * MODEL_TILE_SIZE;
+	uint16_t *indices = mem_malloc(MEM_RENDERER, sizeof(uint16_t) * tile_index_capacity);
+	for(size_t i = 0; i < tile_index_capacity; i++)
+		indices[i] = i / MODEL_TILE_SIZE;
+	
+	glBindBuffer(GL_ARRAY_BUFFER, tile_index_buffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(uint16_t) * tile_index_capacity, indices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	mem_track_alloc(MEM_GL_STAGING, sizeof(uint16_t) * tile_index_capacity);
+	mem_free(MEM_RENDERER, indices);
+}
+
+/**
+ * Uses the compact streams for this frame if they're enabled, all tiles fit into the tile_frames block
+ * and the fixed point steps of the uploaded tiles are below a quarter pixel. Sets up the tile frames in
+ * that case.
+ */
+static bool frame_compact_check(model_p model){
+	size_t tile_count = model_tile_count(model);
+	if ( !renderer_compact_streams || tile_count > TILE_FRAMES_MAX || tile_count == 0 )
+		return false;
+	
+	float max_step = viewport->world_size.x / viewport->screen_size.x / 4;
+	for(size_t t = 0; t < tile_count; t++){
+		tile_bounds_t b = model->tile_bounds[t];
+		tile_frames[t][0] = b.min.x;
+		tile_frames[t][1] = b.min.y;
+		// Tiles of a single particle (or a straight line of them) would divide by zero
+		tile_frames[t][2] = fmaxf(b.max.x - b.min.x, 1e-6);
+		tile_frames[t][3] = fmaxf(b.max.y - b.min.y, 1e-6);
+		if ( (tile_flags[t] & TILE_UPLOAD) && fmaxf(tile_frames[t][2], tile_frames[t][3]) / 65535 > max_step )
+			return false;
+	}
+	
+	tile_indices_update(model);
+	glBindBuffer(GL_UNIFORM_BUFFER, tile_frame_buffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(float) * 4 * tile_count, tile_frames);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	return true;
+}
+
+void frame_load(){
+	stream_load();
+	glGenBuffers(1, &beam_index_buffer);
+	assert(beam_index_buffer != 0);
+	
+	glGenBuffers(1, &tile_index_buffer);
+	assert(tile_index_buffer != 0);
+	glGenBuffers(1, &tile_frame_buffer);
+	assert(tile_frame_buffer != 0);
+	glBindBuffer(GL_UNIFORM_BUFFER, tile_frame_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(float) * 4 * TILE_FRAMES_MAX, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, TILE_FRAME_BINDING, tile_frame_buffer);
+}
+
+void frame_unload(){
+	glDeleteBuffers(1, &beam_index_buffer);
+	mem_track_free(MEM_GL_STAGING, sizeof(uint32_t) * 2 * beam_buffer_capacity);
+	glDeleteBuffers(1, &tile_index_buffer);
+	mem_track_free(MEM_GL_STAGING, sizeof(uint16_t) * tile_index_capacity);
+	glDeleteBuffers(1, &tile_frame_buffer);
+	tile_index_capacity = 0;
+	
+	mem_free(MEM_RENDERER, beam_indices);
+	mem_free(MEM_RENDERER, beam_group_offsets);
+	mem_free(MEM_RENDERER, beam_group_lengths);
+	mem_free(MEM_RENDERER, tile_detail);
+	mem_free(MEM_RENDERER, tile_frames);
+	mem_free(MEM_RENDERER, tile_neighbor_offsets);
+	mem_free(MEM_RENDERER, tile_scratch);
+	mem_free(MEM_RENDERER, tile_flags);
+	mem_free(MEM_RENDERER, tile_neighbors);
+	mem_free(MEM_RENDERER, frame_particle_ranges);
+	mem_free(MEM_RENDERER, frame_beam_counts);
+	mem_free(MEM_RENDERER, frame_beam_offsets);
+	beam_indices = NULL;
+	beam_group_offsets = tile_neighbor_offsets = tile_scratch = NULL;
+	beam_group_lengths = tile_detail = NULL;
+	tile_frames = NULL;
+	tile_flags = NULL;
+	tile_neighbors = NULL;
+	frame_particle_ranges = NULL;
+	frame_beam_counts = NULL;
+	frame_beam_offsets = NULL;
+	beam_index_capacity = beam_index_count = beam_buffer_capacity = tile_capacity = tile_neighbor_capacity = 0;
+	frame_particle_range_count = frame_beam_range_count = frame_box_count = 0;
+	beam_index_model = NULL;
+	
+	stream_unload();
+	frame_model = NULL;
+}
+
+/**
+ * Culls the model against the viewport and streams the particle positions, particle colors and
+ * thruster instances the draws of the current frame need. Rebuilds the beam indices if necessary.
+ * renderer_draw() calls it once per frame before particles_draw() and thrusters_draw().
+ */
+void renderer_upload(model_p model){
+	prof_begin(PROF_DRAW_UPLOAD);
+	frame_model = model;
+	beam_indices_update(model);
+	tiles_cull(model);
+	frame_compact = frame_compact_check(model);
+	
+	tile_bounds_t view = view_bounds();
+	size_t position_size = frame_compact ? sizeof(uint16_t) * 2 : sizeof(vec2_t);
+	size_t color_size = frame_compact ? sizeof(uint8_t) : sizeof(uint8_t) * 4;
+	
+	frame_positions_offset = 0;
+	frame_colors_offset = frame_positions_offset + stream_align(position_size * model->particle_count);
+	frame_thrusters_offset = frame_colors_offset + stream_align(color_size * model->particle_count);
+	frame_boxes_offset = frame_thrusters_offset + stream_align(sizeof(thruster_instance_t) * model->thruster_count);
+	size_t bytes = frame_boxes_offset + sizeof(box_instance_t) * model_tile_count(model);
+	frame_thruster_count = frame_box_count = 0;
+	
+	if (bytes > 0) {
+		size_t offset = 0;
+		uint8_t *data = stream_begin(bytes, &offset);
+		frame_positions_offset += offset;
+		frame_colors_offset += offset;
+		frame_thrusters_offset += offset;
+		frame_boxes_offset += offset;
+		
+		vec2_t *positions = (vec2_t*)(data + frame_positions_offset - offset);
+		uint8_t (*colors)[4] = (uint8_t (*)[4])(data + frame_colors_offset - offset);
+		uint16_t (*fixed_positions)[2] = (uint16_t (*)[2])(data + frame_positions_offset - offset);
+		uint8_t *flags = data + frame_colors_offset - offset;
+		uint8_t particle_alpha = lroundf(frame_particle_alpha * 255);
+		for(size_t t = 0; t < model_tile_count(model); t++){
+			if ( !(tile_flags[t] & TILE_UPLOAD) )
+				continue;
+			
+			size_t end = (t + 1) * MODEL_TILE_SIZE;
+			if (end > model->particle_count)
+				end = model->particle_count;
+			if (frame_compact) {
+				float x = tile_frames[t][0], y = tile_frames[t][1];
+				float sx = 65535 / tile_frames[t][2], sy = 65535 / tile_frames[t][3];
+				for(size_t i = t * MODEL_TILE_SIZE; i < end; i++){
+					vec2_t pos = model->particles[i].pos;
+					fixed_positions[i][0] = lroundf( fminf(fmaxf((pos.x - x) * sx, 0), 65535) );
+					fixed_positions[i][1] = lroundf( fminf(fmaxf((pos.y - y) * sy, 0), 65535) );
+				}
+			} else {
+				for(size_t i = t * MODEL_TILE_SIZE; i < end; i++)
+					positions[i] = model->particles[i].pos;
+			}
+			
+			if ( !(tile_flags[t] & TILE_VISIBLE) )
+				continue;
+			if (frame_compact) {
+				for(size_t i = t * MODEL_TILE_SIZE; i < end; i++)
+					flags[i] = (model->particles[i].flags & PARTICLE_SELECTED) ? PARTICLE_FLAG_SELECTED : 0;
+			} else {
+				for(size_t i = t * MODEL_TILE_SIZE; i < end; i++){
+					bool selected = (model->particles[i].flags & PARTICLE_SELECTED);
+					colors[i][0] = selected ? 255 : 0;
+					colors[i][1] = selected ? 0 : 255;
+					colors[i][2] = 0;
+					colors[i][3] = particle_alpha;
+				}
+			}
+		}
+		
+		thruster_instance_t *thrusters = (thruster_instance_t*)(data + frame_thrusters_offset - offset);
+		for(size_t i = 0; i < model->thruster_count; i++){
+			thruster_p thruster = &model->thrusters[i];
+			vec2_t p1 = model->particles[thruster->i1].pos, p2 = model->particles[thruster->i2].pos;
+			tile_bounds_t bounds = tile_bounds_empty();
+			tile_bounds_include(&bounds, p1);
+			tile_bounds_include(&bounds, p2);
+			if ( !bounds_overlap(bounds, view) )
+				continue;
+			
+			uint8_t r, g, b;
+			if (thruster->controlled_by & THRUSTER_BACK)
+				r = 255, g = 255, b = 255;
+			else if (thruster->controlled_by & THRUSTER_FRONT)
+				r = 128, g = 128, b = 128;
+			else if (thruster->controlled_by & THRUSTER_LEFT)
+				r = 128, g = 0, b = 0;
+			else
+				r = 0, g = 128, b = 0;
+			
+			thrusters[frame_thruster_count++] = (thruster_instance_t){ p1.x, p1.y, p2.x, p2.y, { r, g, b, 255 } };
+		}
+		
+		// Boxes are at least a pixel in size. Their opacity is the part of the box the beams (a pixel
+		// wide lines) and particles would cover.
+		box_instance_t *boxes = (box_instance_t*)(data + frame_boxes_offset - offset);
+		float pixel_size = viewport->world_size.x / viewport->screen_size.x;
+		for(size_t t = 0; t < model_tile_count(model); t++){
+			if ( !(tile_flags[t] & TILE_BOX) )
+				continue;
+			
+			tile_bounds_t b = model->tile_bounds[t];
+			vec2_t center = { (b.min.x + b.max.x) / 2, (b.min.y + b.max.y) / 2 };
+			vec2_t size = { fmaxf(b.max.x - b.min.x, pixel_size), fmaxf(b.max.y - b.min.y, pixel_size) };
+			float covered = beam_group_lengths[t] * pixel_size + tile_particle_count(model, t) * PARTICLE_SIZE * PARTICLE_SIZE;
+			float alpha = fminf(covered / (size.x * size.y), 1) * (1 - tile_detail[t]);
+			
+			boxes[frame_box_count++] = (box_instance_t){
+				center.x - size.x / 2, center.y - size.y / 2, center.x + size.x / 2, center.y + size.y / 2,
+				{ 255, 255, 255, lroundf(alpha * 255) }
+			};
+		}
+		stream_end();
+	}
+	
+	prof_end(PROF_DRAW_UPLOAD);
+}
+
+
+//
+// Particles
+//
+program_p particle_prog, beam_prog, box_prog, particle_compact_prog, beam_compact_prog;
+GLuint particle_vertex_buffer, particle_vertex_array, beam_vertex_array, box_vertex_array;
+GLuint particle_compact_vertex_array, beam_compact_vertex_array;
+GLint particle_instance_pos_attrib, particle_instance_color_attrib, beam_pos_attrib;
+GLint box_instance_corners_attrib, box_instance_color_attrib;
+GLint particle_compact_instance_pos_attrib, particle_compact_instance_tile_attrib, particle_compact_instance_flags_attrib;
+GLint beam_compact_pos_attrib;
+GLint beam_color_uni, beam_compact_color_uni, particle_compact_alpha_uni;
+
+void particles_load(){
+	program_finish(beam_prog);
+	assert(beam_prog->linked);
+	program_uniform_block(beam_prog, "frame_uniforms", FRAME_UNIFORM_BINDING);
+	beam_pos_attrib = program_attrib(beam_prog, "pos", GL_FLOAT_VEC2);
+	beam_color_uni = program_uniform(beam_prog, "color", GL_FLOAT_VEC4);
+	
+	program_finish(particle_prog);
+	assert(particle_prog->linked);
+	program_uniform_block(particle_prog, "frame_uniforms", FRAME_UNIFORM_BINDING);
+	particle_instance_pos_attrib = program_attrib(particle_prog, "instance_pos", GL_FLOAT_VEC2);
+	particle_instance_color_attrib = program_attrib(particle_prog, "instance_color", GL_FLOAT_VEC4);
+	
+	program_finish(box_prog);
+	assert(box_prog->linked);
+	program_uniform_block(box_prog, "frame_uniforms", FRAME_UNIFORM_BINDING);
+	box_instance_corners_attrib = program_attrib(box_prog, "instance_corners", GL_FLOAT_VEC4);
+	box_instance_color_attrib = program_attrib(box_prog, "instance_color", GL_FLOAT_VEC4);
+	
+	program_finish(beam_compact_prog);
+	assert(beam_compact_prog->linked);
+	program_uniform_block(beam_compact_prog, "frame_uniforms", FRAME_UNIFORM_BINDING);
+	program_uniform_block(beam_compact_prog, "tile_frames", TILE_FRAME_BINDING);
+	beam_compact_pos_attrib = program_attrib(beam_compact_prog, "pos", GL_FLOAT_VEC2);
+	beam_compact_color_uni = program_uniform(beam_compact_prog, "color", GL_FLOAT_VEC4);
+	
+	program_finish(particle_compact_prog);
+	assert(particle_compact_prog->linked);
+	program_uniform_block(particle_compact_prog, "frame_uniforms", FRAME_UNIFORM_BINDING);
+	program_uniform_block(particle_compact_prog, "tile_frames", TILE_FRAME_BINDING);
+	particle_compact_instance_pos_attrib = program_attrib(particle_compact_prog, "instance_pos", GL_FLOAT_VEC2);
+	particle_compact_instance_tile_attrib = program_attrib(particle_compact_prog, "instance_tile", GL_FLOAT);
+	particle_compact_instance_flags_attrib = program_attrib(particle_compact_prog, "instance_flags", GL_FLOAT);
+	particle_compact_alpha_uni = program_uniform(particle_compact_prog, "alpha", GL_FLOAT);
+	
+	glGenBuffers(1, &particle_vertex_buffer);
+	assert(particle_vertex_buffer != 0);
+	glBindBuffer(GL_ARRAY_BUFFER, particle_vertex_buffer);
+	
+	const float vertecies[] = {
+		// Rectangle
+		0.5, 0.5,
+		-0.5, 0.5,
+		-0.5, -0.5,
+		0.5, -0.5,
+		// Arrow: -->
+		1, 0,
+		0.25, 0.25,
+		0, -1,
+		0.25, -0.25
+	};
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertecies), vertecies, GL_STATIC_DRAW);
+	
+	// The instance attributes point into the stream buffer, they're set by particles_draw() since the
+	// offset changes every frame
+	glGenVertexArrays(1, &particle_vertex_array);
+	glBindVertexArray(particle_vertex_array);
+	GLint pos_attrib = program_attrib(particle_prog, "pos", GL_FLOAT_VEC2);
+	glEnableVertexAttribArray(pos_attrib);
+	glVertexAttribPointer(pos_attrib, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
+	instance_attrib_enable(particle_instance_pos_attrib);
+	instance_attrib_enable(particle_instance_color_attrib);
+	glBindVertexArray(0);
+	
+	// Boxes and compact particles use the same rectangle
+	glGenVertexArrays(1, &box_vertex_array);
+	glBindVertexArray(box_vertex_array);
+	pos_attrib = program_attrib(box_prog, "pos", GL_FLOAT_VEC2);
+	glEnableVertexAttribArray(pos_attrib);
+	glVertexAttribPointer(pos_attrib, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
+	instance_attrib_enable(box_instance_corners_attrib);
+	instance_attrib_enable(box_instance_color_attrib);
+	glBindVertexArray(0);
+	
+	glGenVertexArrays(1, &particle_compact_vertex_array);
+	glBindVertexArray(particle_compact_vertex_array);
+	pos_attrib = program_attrib(particle_compact_prog, "pos", GL_FLOAT_VEC2);
+	glEnableVertexAttribArray(pos_attrib);
+	glVertexAttribPointer(pos_attrib, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
+	instance_attrib_enable(particle_compact_instance_pos_attrib);
+	instance_attrib_enable(particle_compact_instance_tile_attrib);
+	instance_attrib_enable(particle_compact_instance_flags_attrib);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	
+	// Same for the particle positions the beam indices refer to
+	glGenVertexArrays(1, &beam_vertex_array);
+	glBindVertexArray(beam_vertex_array);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, beam_index_buffer);
+	glEnableVertexAttribArray(beam_pos_attrib);
+	glBindVertexArray(0);
+	
+	// The tile indices of compact beams don't move
+	glGenVertexArrays(1, &beam_compact_vertex_array);
+	glBindVertexArray(beam_compact_vertex_array);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, beam_index_buffer);
+	glEnableVertexAttribArray(beam_compact_pos_attrib);
+	GLint tile_attrib = program_attrib(beam_compact_prog, "tile", GL_FLOAT);
+	glBindBuffer(GL_ARRAY_BUFFER, tile_index_buffer);
+	glEnableVertexAttribArray(tile_attrib);
+	glVertexAttribPointer(tile_attrib, 1, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(uint16_t), 0);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	
+	glUseProgram(beam_prog->id);
+	glUniform4f(beam_color_uni, 1, 1, 1, 1);
+	glUseProgram(beam_compact_prog->id);
+	glUniform4f(beam_compact_color_uni, 1, 1, 1, 1);
+	glUseProgram(0);
+}
+
+void particles_unload(){
+	glDeleteVertexArrays(1, &particle_vertex_array);
+	glDeleteVertexArrays(1, &beam_vertex_array);
+	glDeleteVertexArrays(1, &box_vertex_array);
+	glDeleteVertexArrays(1, &particle_compact_vertex_array);
+	glDeleteVertexArrays(1, &beam_compact_vertex_array);
+	glDeleteBuffers(1, &particle_vertex_buffer);
+	program_destroy(particle_prog);
+	program_destroy(beam_prog);
+	program_destroy(box_prog);
+	program_destroy(particle_compact_prog);
+	program_destroy(beam_compact_prog);
+}
+
+/**
+ * Draws the particles and beams of model from the data of the last renderer_upload().
+ */
+void particles_draw(model_p model){
+	assert(model == frame_model);
+	frame_uniforms_update();
+	
+	// Draw particles, one instance per particle. The instance attributes start at each range of visible
+	// tiles.
+	prof_begin(PROF_DRAW_PARTICLES);
+	if (frame_particle_range_count > 0 && frame_compact) {
+		glUseProgram(particle_compact_prog->id);
+		glUniform1f(particle_compact_alpha_uni, frame_particle_alpha);
+		glBindVertexArray(particle_compact_vertex_array);
+		for(size_t i = 0; i < frame_particle_range_count; i++){
+			draw_range_t range = frame_particle_ranges[i];
+			glBindBuffer(GL_ARRAY_BUFFER, stream_buffer);
+			glVertexAttribPointer(particle_compact_instance_pos_attrib, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(uint16_t) * 2, (void*)(frame_positions_offset + sizeof(uint16_t) * 2 * range.first));
+			glVertexAttribPointer(particle_compact_instance_flags_attrib, 1, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(uint8_t), (void*)(frame_colors_offset + sizeof(uint8_t) * range.first));
+			glBindBuffer(GL_ARRAY_BUFFER, tile_index_buffer);
+			glVertexAttribPointer(particle_compact_instance_tile_attrib, 1, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(uint16_t), (void*)(sizeof(uint16_t) * range.first));
+			glDrawArraysInstanced(GL_QUADS, 0, 4, range.count);
+		}
+		
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+		glUseProgram(0);
+	} else if (frame_particle_range_count > 0) {
+		glUseProgram(particle_prog->id);
+		glBindVertexArray(particle_vertex_array);
+		glBindBuffer(GL_ARRAY_BUFFER, stream_buffer);
+		for(size_t i = 0; i < frame_particle_range_count; i++){
+			draw_range_t range = frame_particle_ranges[i];
+			glVertexAttribPointer(particle_instance_pos_attrib, 2, GL_FLOAT, GL_FALSE, sizeof(vec2_t), (void*)(frame_positions_offset + sizeof(vec2_t) * range.first));
+			glVertexAttribPointer(particle_instance_color_attrib, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(uint8_t) * 4, (void*)(frame_colors_offset + sizeof(uint8_t) * 4 * range.first));
+			glDrawArraysInstanced(GL_QUADS, 0, 4, range.count);
+		}
+		
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+		glUseProgram(0);
+	}
+	prof_end(PROF_DRAW_PARTICLES);
+	
+	
+	// Draw beams as indexed lines between the streamed particle positions, one range per run of
+	// visible beam groups
+	prof_begin(PROF_DRAW_BEAMS);
+	if (frame_beam_range_count > 0) {
+		glUseProgram(frame_compact ? beam_compact_prog->id : beam_prog->id);
+		glBindVertexArray(frame_compact ? beam_compact_vertex_array : beam_vertex_array);
+		glBindBuffer(GL_ARRAY_BUFFER, stream_buffer);
+		if (frame_compact)
+			glVertexAttribPointer(beam_compact_pos_attrib, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(uint16_t) * 2, (void*)frame_positions_offset);
+		else
+			glVertexAttribPointer(beam_pos_attrib, 2, GL_FLOAT, GL_FALSE, sizeof(vec2_t), (void*)frame_positions_offset);
+		glMultiDrawElements(GL_LINES, frame_beam_counts, GL_UNSIGNED_INT, frame_beam_offsets, frame_beam_range_count);
+		
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+		glUseProgram(0);
+	}
+	
+	// Tiles too small for their details are drawn as boxes
+	if (frame_box_count > 0) {
+		glUseProgram(box_prog->id);
+		glBindVertexArray(box_vertex_array);
+		glBindBuffer(GL_ARRAY_BUFFER, stream_buffer);
+		glVertexAttribPointer(box_instance_corners_attrib, 4, GL_FLOAT, GL_FALSE, sizeof(box_instance_t), (void*)(frame_boxes_offset + offsetof(box_instance_t, x1)));
+		glVertexAttribPointer(box_instance_color_attrib, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(box_instance_t), (void*)(frame_boxes_offset + offsetof(box_instance_t, color)));
+		glDrawArraysInstanced(GL_QUADS, 0, 4, frame_box_count);
+		
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+		glUseProgram(0);
+	}
+	prof_end(PROF_DRAW_BEAMS);
+}
+
+
+//
+// Thruster
+//
+program_p thruster_prog;
+GLuint thruster_vertex_buffer, thruster_vertex_array;
+GLint thruster_instance_ends_attrib, thruster_instance_color_attrib;
+
+void thrusters_load(){
+	program_finish(thruster_prog);
+	assert(thruster_prog->linked);
+	program_uniform_block(thruster_prog, "frame_uniforms", FRAME_UNIFORM_BINDING);
+	thruster_instance_ends_attrib = program_attrib(thruster_prog, "instance_ends", GL_FLOAT_VEC4);
+	thruster_instance_color_attrib = program_attrib(thruster_prog, "instance_color", GL_FLOAT_VEC4);
+	
+	glGenBuffers(1, &thruster_vertex_buffer);
+	assert(thruster_vertex_buffer != 0);
+	glBindBuffer(GL_ARRAY_BUFFER, thruster_vertex_buffer);
+	
+	const float vertecies[] = {
+		0.5, 0.125,
+		-0.5, 0.25,
+		-0.5, -0.25,
+		0.5, -0.125
+	};
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertecies), vertecies, GL_STATIC_DRAW);
+	
+	glGenVertexArrays(1, &thruster_vertex_array);
+	glBindVertexArray(thruster_vertex_array);
+	GLint pos_attrib = program_attrib(thruster_prog, "pos", GL_FLOAT_VEC2);
+	glEnableVertexAttribArray(pos_attrib);
+	glVertexAttribPointer(pos_attrib, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
+	instance_attrib_enable(thruster_instance_ends_attrib);
+	instance_attrib_enable(thruster_instance_color_attrib);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void thrusters_unload(){
+	glDeleteVertexArrays(1, &thruster_vertex_array);
+	glDeleteBuffers(1, &thruster_vertex_buffer);
+	program_destroy(thruster_prog);
+}
+
+/**
+ * Draws the thrusters of model from the data of the last renderer_upload().
+ */
+void thrusters_draw(model_p model){
+	assert(model == frame_model);
+	if (frame_thruster_count == 0)
+		return;
+	
+	frame_uniforms_update();
+	glUseProgram(thruster_prog->id);
+	glBindVertexArray(thruster_vertex_array);
+	glBindBuffer(GL_ARRAY_BUFFER, stream_buffer);
+	glVertexAttribPointer(thruster_instance_ends_attrib, 4, GL_FLOAT, GL_FALSE, sizeof(thruster_instance_t), (void*)(frame_thrusters_offset + offsetof(thruster_instance_t, x1)));
+	glVertexAttribPointer(thruster_instance_color_attrib, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(thruster_instance_t), (void*)(frame_thrusters_offset + offsetof(thruster_instance_t, color)));
+	glDrawArraysInstanced(GL_QUADS, 0, 4, frame_thruster_count);
+	
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+	glUseProgram(0);
+}
+
+
+//
+// Profiler overlay
+//
+program_p overlay_prog;
+GLuint overlay_vertex_buffer, overlay_vertex_array;
+GLint overlay_color_uni;
+bool overlay_visible = false;
+// Time that corresponds to the full bar width
+float overlay_budget_ms = 10;
+prof_stats_t overlay_stats[PROF_PHASE_COUNT];
+uint32_t overlay_frame = 0;
+// Two bars per phase and the budget line, each a quad
+const size_t overlay_vertex_bytes = sizeof(float) * (PROF_PHASE_COUNT * 2 + 1) * 4 * 2;
+
+void overlay_load(){
+	program_finish(overlay_prog);
+	assert(overlay_prog->linked);
+	overlay_color_uni = program_uniform(overlay_prog, "color", GL_FLOAT_VEC4);
+	
+	glGenBuffers(1, &overlay_vertex_buffer);
+	assert(overlay_vertex_buffer != 0);
+	glBindBuffer(GL_ARRAY_BUFFER, overlay_vertex_buffer);
+	glBufferData(GL_ARRAY_BUFFER, overlay_vertex_bytes, NULL, GL_STREAM_DRAW);
+	mem_track_alloc(MEM_GL_STAGING, overlay_vertex_bytes);
+	
+	glGenVertexArrays(1, &overlay_vertex_array);
+	glBindVertexArray(overlay_vertex_array);
+	GLint pos_attrib = program_attrib(overlay_prog, "pos", GL_FLOAT_VEC2);
+	glEnableVertexAttribArray(pos_attrib);
+	glVertexAttribPointer(pos_attrib, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 2, 0);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	
+	// Coordinates are normalized device coordinates
+	glUseProgram(overlay_prog->id);
+	glUniformMatrix3fv( program_uniform(overlay_prog, "to_norm", GL_FLOAT_MAT3), 1, GL_FALSE, (float[9]){ 1, 0, 0, 0, 1, 0, 0, 0, 1 });
+	glUseProgram(0);
+}
+
+void overlay_unload(){
+	glDeleteVertexArrays(1, &overlay_vertex_array);
+	glDeleteBuffers(1, &overlay_vertex_buffer);
+	program_destroy(overlay_prog);
+	mem_track_free(MEM_GL_STAGING, overlay_vertex_bytes);
+}
+
+void overlay_print(){
+	printf("%-20s %8s %8s %8s\n", "phase", "min ms", "mean ms", "p99 ms");
+	for(size_t i = 0; i < PROF_PHASE_COUNT; i++){
+		prof_stats_t s = prof_stats(i);
+		printf("%-20s %8.3f %8.3f %8.3f\n", prof_timers[i].name, s.min, s.mean, s.p99);
+	}
+}
+
+/**
+ * Draws one bar per phase in the top left corner, in the order of prof_phase_t. The bar shows the mean,
+ * the white tick the 99th percentile and the red line the budget. Stats are only updated every 16 frames
+ * since they sort the whole window.
+ */
+void overlay_draw(){
+	if (overlay_frame++ % 16 == 0) {
+		for(size_t i = 0; i < PROF_PHASE_COUNT; i++)
+			overlay_stats[i] = prof_stats(i);
+	}
+	
+	// Coordinates are normalized device coordinates
+	const float left = -0.95, top = 0.95, width = 0.8, row = 0.04, bar = 0.03;
+	float vertecies[(PROF_PHASE_COUNT * 2 + 1) * 4 * 2];
+	size_t vi = 0;
+	for(size_t i = 0; i < PROF_PHASE_COUNT * 2; i++){
+		size_t phase = i % PROF_PHASE_COUNT;
+		float y = top - phase * row;
+		float x1, x2;
+		if (i < PROF_PHASE_COUNT) {
+			x1 = left;
+			x2 = left + fminf(overlay_stats[phase].mean / overlay_budget_ms, 1.2) * width;
+		} else {
+			x1 = left + fminf(overlay_stats[phase].p99 / overlay_budget_ms, 1.2) * width;
+			x2 = x1 + 0.005;
+		}
+		const float quad[] = { x2, y, x1, y, x1, y - bar, x2, y - bar };
+		memcpy(vertecies + vi, quad, sizeof(quad));
+		vi += 8;
+	}
+	const float budget[] = { left + width + 0.005, top, left + width, top, left + width, top - PROF_PHASE_COUNT * row, left + width + 0.005, top - PROF_PHASE_COUNT * row };
+	memcpy(vertecies + vi, budget, sizeof(budget));
+	
+	glBindBuffer(GL_ARRAY_BUFFER, overlay_vertex_buffer);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertecies), vertecies);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	
+	glUseProgram(overlay_prog->id);
+	glBindVertexArray(overlay_vertex_array);
+	
+	// Simulation phases in yellow, renderer phases in cyan, whole step and frame a bit brighter
+	for(size_t i = 0; i < PROF_PHASE_COUNT; i++){
+		bool sim = (i < PROF_DRAW), total = (i == PROF_SIMULATE || i == PROF_DRAW);
+		glUniform4f(overlay_color_uni, sim ? 1 : 0, 1, sim ? 0 : 1, total ? 0.8 : 0.5);
+		glDrawArrays(GL_QUADS, i * 4, 4);
+	}
+	glUniform4f(overlay_color_uni, 1, 1, 1, 1);
+	glDrawArrays(GL_QUADS, PROF_PHASE_COUNT * 4, PROF_PHASE_COUNT * 4);
+	glUniform4f(overlay_color_uni, 1, 0, 0, 1);
+	glDrawArrays(GL_QUADS, PROF_PHASE_COUNT * 8, 4);
+	
+	glBindVertexArray(0);
+	glUseProgram(0);
+}
+
+
+//
+// Renderer
+//
+
+/**
+ * Creates the viewport and all GL resources. Needs a current GL context, the window (or an offscreen
+ * framebuffer) of the given size has to exist already.
+ */
+void renderer_load(uint16_t width, uint16_t height){
+	// Initialize viewport structure
+	viewport = vp_new((vec2_t){10, 10}, 2);
+	renderer_resize(width, height);
+	
+	// Enable alpha blending
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	
+	glEnable(GL_LINE_SMOOTH);
+	glHint(GL_LINE_SMOOTH_HINT, GL_NICEST);
+	
+	// All programs are created up front, drivers with parallel shader compilation work on them while
+	// the first ones are finished by the load functions
+	grid_prog = program_create("grid.vs", "unit.ps");
+	cursor_prog = program_create("cursor.vs", "cursor.ps");
+	beam_prog = program_create("beam.vs", "unit.ps");
+	particle_prog = program_create("particle.vs", "particle.ps");
+	box_prog = program_create("box.vs", "particle.ps");
+	particle_compact_prog = program_create("particle_compact.vs", "particle.ps");
+	beam_compact_prog = program_create("beam_compact.vs", "unit.ps");
+	thruster_prog = program_create("thruster.vs", "thruster.ps");
+	overlay_prog = program_create("unit.vs", "unit.ps");
+	
+	frame_uniforms_load();
+	grid_load();
+	cursor_load();
+	frame_load();
+	particles_load();
+	thrusters_load();
+	overlay_load();
+}
+
+void renderer_resize(uint16_t width, uint16_t height){
+	glViewport(0, 0, width, height);
+	vp_screen_changed(viewport, width, height);
+}
+
+void renderer_unload(){
+	overlay_unload();
+	thrusters_unload();
+	particles_unload();
+	frame_unload();
+	cursor_unload();
+	grid_unload();
+	frame_uniforms_unload();
+	vp_destroy(viewport);
+}
+
+void renderer_draw(model_p model){
+	prof_begin(PROF_DRAW);
+	glClearColor(0, 0, 0, 1.0);
+	glClear(GL_COLOR_BUFFER_BIT);
+	
+	prof_begin(PROF_DRAW_GRID);
+	if (grid_visible)
+		grid_draw();
+	prof_end(PROF_DRAW_GRID);
+	
+	renderer_upload(model);
+	particles_draw(model);
+	
+	prof_begin(PROF_DRAW_THRUSTERS);
+	thrusters_draw(model);
+	prof_end(PROF_DRAW_THRUSTERS);
+	
+	prof_begin(PROF_DRAW_CURSOR);
+	if (cursor_visible)
+		cursor_draw();
+	prof_end(PROF_DRAW_CURSOR);
+	
+	if (overlay_visible)
+		overlay_draw();
+	prof_end(PROF_DRAW);
+}
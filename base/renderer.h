@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "math.h"
+#include "viewport.h"
+#include "model.h"
+
+/**
+
+Draws a model with OpenGL. The renderer doesn't know about the window, it only needs a current GL
+context: base.c renders into an SDL window, the benchmarks and headless into the offscreen framebuffer
+of offscreen.h. cursor_visible hides the mouse cursor for the latter, grid_visible skips the grid (the
+frame budget governor of governor.h does when frames get too expensive).
+
+Per frame data is streamed through a ring of buffer regions (see the streaming section of
+renderer.c). renderer_upload() writes the particle positions once, particles_draw() uses them for the
+particle instances and the beam lines (indexed by a beam index buffer that is only rebuilt when the
+structure of the model changes). renderer_draw() does all of it, drawing single parts directly needs
+a renderer_upload() of the same model first:
+	
+	renderer_upload(model);
+	particles_draw(model);
+
+Only tiles of particles (see model.h) that overlap the viewport are uploaded and drawn. When zoomed out
+the level of detail drops per tile: particles fade out once their quads get smaller than
+renderer_lod.particles_begin pixels and are gone at particles_end. Tiles with less than tiles_begin
+pixels per particle (far away or densely packed) fade into a box over their bounds with the opacity of
+the beams and particles they contain, below tiles_end only the box is drawn. Setting begin and end to 0
+disables a level.
+
+With renderer_compact_streams particle positions are streamed as 16 bit fixed point relative to the
+bounds of their tile and particles get one byte of flags instead of a color, 5 instead of 12 bytes per
+particle. Frames where the fixed point steps would exceed a quarter pixel (tiles spread out far, e.g.
+debris when zoomed in) or the model has more than 1024 tiles fall back to floats.
+
+*/
+
+typedef struct {
+	float particles_begin, particles_end;  // px, size of a particle quad
+	float tiles_begin, tiles_end;  // px, area of the tile bounds per particle
+} renderer_lod_t;
+
+extern viewport_p viewport;
+extern vec2_t cursor_pos;
+extern bool cursor_visible;
+extern bool grid_visible;
+extern bool overlay_visible;
+extern float overlay_budget_ms;
+extern renderer_lod_t renderer_lod;
+extern bool renderer_compact_streams;
+
+void renderer_load(uint16_t width, uint16_t height);
+void renderer_resize(uint16_t width, uint16_t height);
+void renderer_unload();
+void renderer_upload(model_p model);
+void renderer_draw(model_p model);
+
+void grid_draw();
+void cursor_draw();
+void particles_draw(model_p model);
+void thrusters_draw(model_p model);
+void overlay_draw();
+void overlay_print();
@@ -0,0 +1,586 @@
+#include <stdlib.h>
+#include <string.h>
+#define __USE_XOPEN 1
+#include <math.h>
+
+#include "rigid.h"
+#include "alloc.h"
+
+
+static void* rigid_grow(void *array, size_t elem, size_t capacity){
+	return mem_realloc(MEM_SIMULATION, array, elem * (capacity ? capacity : 1));
+}
+
+static size_t rigid_find(size_t *parent, size_t i){
+	while (parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+/**
+ * Splits the model into islands of particles connected by unbroken beams. Islands that were rigid
+ * and still consist of the same particles keep their state, all others start soft.
+ */
+static void rigid_build(model_p model, rigid_p rigid){
+	bool keep = !(rigid->revision != model->revision || rigid->particle_count != model->particle_count
+		|| rigid->beam_count != model->beam_count);
+	
+	if (model->particle_count > rigid->particle_capacity) {
+		rigid->particle_capacity = model->particle_count;
+		rigid->particle_island = rigid_grow(rigid->particle_island, sizeof(uint32_t), rigid->particle_capacity);
+		rigid->island_particles = rigid_grow(rigid->island_particles, sizeof(size_t), rigid->particle_capacity);
+		rigid->offsets = rigid_grow(rigid->offsets, sizeof(vec2_t), rigid->particle_capacity);
+		rigid->box_min = rigid_grow(rigid->box_min, sizeof(vec2_t), rigid->particle_capacity);
+		rigid->box_max = rigid_grow(rigid->box_max, sizeof(vec2_t), rigid->particle_capacity);
+	}
+	if (model->beam_count > rigid->beam_capacity) {
+		rigid->beam_capacity = model->beam_count;
+		rigid->island_beams = rigid_grow(rigid->island_beams, sizeof(size_t), rigid->beam_capacity);
+		rigid->soft_beams = rigid_grow(rigid->soft_beams, sizeof(size_t), rigid->beam_capacity);
+	}
+	
+	// Union find with island_particles as parent array. The root of a set is its lowest particle index.
+	size_t *parent = rigid->island_particles;
+	for(size_t i = 0; i < model->particle_count; i++)
+		parent[i] = i;
+	for(size_t i = 0; i < model->beam_count; i++){
+		beam_p beam = &model->beams[i];
+		if (beam->flags & BEAM_BROKEN)
+			continue;
+		size_t r1 = rigid_find(parent, beam->i1), r2 = rigid_find(parent, beam->i2);
+		if (r1 < r2)
+			parent[r2] = r1;
+		else if (r2 < r1)
+			parent[r1] = r2;
+	}
+	
+	// Roots come before the other particles of their set, number the islands in that order
+	size_t island_count = 0;
+	for(size_t i = 0; i < model->particle_count; i++){
+		size_t root = rigid_find(parent, i);
+		rigid->particle_island[i] = (root == i) ? island_count++ : rigid->particle_island[root];
+	}
+	
+	if (island_count > rigid->island_capacity) {
+		rigid->island_capacity = island_count;
+		rigid->islands = rigid_grow(rigid->islands, sizeof(rigid_island_t), rigid->island_capacity);
+		rigid->previous_islands = rigid_grow(rigid->previous_islands, sizeof(rigid_island_t), rigid->island_capacity);
+		rigid->rigid_islands = rigid_grow(rigid->rigid_islands, sizeof(size_t), rigid->island_capacity);
+	}
+	
+	rigid_island_p previous = rigid->islands;
+	size_t previous_count = rigid->island_count;
+	rigid->islands = rigid->previous_islands;
+	rigid->previous_islands = previous;
+	
+	rigid_island_p islands = rigid->islands;
+	for(size_t i = 0; i < island_count; i++){
+		islands[i] = (rigid_island_t){
+			.check_interval = RIGID_CHECK_INTERVAL, .backoff = RIGID_CHECK_INTERVAL,
+			.next_check = rigid->step + RIGID_CHECK_INTERVAL
+		};
+	}
+	
+	// Sort particles and beams by island (counting sort, keeps the model order within an island)
+	for(size_t i = 0; i < model->particle_count; i++){
+		rigid_island_p island = &islands[rigid->particle_island[i]];
+		if (island->particle_count++ == 0)
+			island->root = i;
+	}
+	for(size_t i = 0; i < model->beam_count; i++)
+		islands[rigid->particle_island[model->beams[i].i1]].beam_count++;
+	
+	size_t particle_offset = 0, beam_offset = 0;
+	for(size_t i = 0; i < island_count; i++){
+		islands[i].particle_begin = particle_offset;
+		islands[i].beam_begin = beam_offset;
+		particle_offset += islands[i].particle_count;
+		beam_offset += islands[i].beam_count;
+		islands[i].particle_count = islands[i].beam_count = 0;
+	}
+	for(size_t i = 0; i < model->particle_count; i++){
+		rigid_island_p island = &islands[rigid->particle_island[i]];
+		rigid->island_particles[island->particle_begin + island->particle_count++] = i;
+	}
+	for(size_t i = 0; i < model->beam_count; i++){
+		rigid_island_p island = &islands[rigid->particle_island[model->beams[i].i1]];
+		rigid->island_beams[island->beam_begin + island->beam_count++] = i;
+	}
+	
+	// Rigid islands didn't lose a beam, the island of their root is the same set
+	if (keep) {
+		for(size_t i = 0; i < previous_count; i++){
+			if ( !previous[i].rigid )
+				continue;
+			rigid_island_p island = &islands[rigid->particle_island[previous[i].root]];
+			if (island->particle_count != previous[i].particle_count)
+				continue;
+			
+			size_t particle_begin = island->particle_begin, beam_begin = island->beam_begin;
+			*island = previous[i];
+			island->particle_begin = particle_begin;
+			island->beam_begin = beam_begin;
+		}
+	}
+	
+	rigid->island_count = island_count;
+	rigid->revision = model->revision;
+	rigid->particle_count = model->particle_count;
+	rigid->beam_count = model->beam_count;
+	rigid->rebuild = false;
+	rigid->lists_outdated = true;
+}
+
+/**
+ * Returns the rigid state of model for this step, creates it and rebuilds the islands if necessary and
+ * resets the external forces of all islands.
+ */
+rigid_p rigid_update(model_p model){
+	if (model->rigid == NULL) {
+		model->rigid = mem_calloc(MEM_SIMULATION, 1, sizeof(rigid_t));
+		model->rigid->rebuild = true;
+	}
+	
+	rigid_p rigid = model->rigid;
+	rigid->step++;
+	if (rigid->rebuild || rigid->revision != model->revision || rigid->particle_count != model->particle_count
+		|| rigid->beam_count != model->beam_count)
+		rigid_build(model, rigid);
+	
+	for(size_t i = 0; i < rigid->island_count; i++){
+		rigid->islands[i].force = (vec2_t){0, 0};
+		rigid->islands[i].torque = 0;
+		rigid->islands[i].load = 0;
+	}
+	return rigid;
+}
+
+void rigid_destroy(rigid_p rigid){
+	if (rigid == NULL)
+		return;
+	mem_free(MEM_SIMULATION, rigid->islands);
+	mem_free(MEM_SIMULATION, rigid->previous_islands);
+	mem_free(MEM_SIMULATION, rigid->particle_island);
+	mem_free(MEM_SIMULATION, rigid->island_particles);
+	mem_free(MEM_SIMULATION, rigid->island_beams);
+	mem_free(MEM_SIMULATION, rigid->offsets);
+	mem_free(MEM_SIMULATION, rigid->box_min);
+	mem_free(MEM_SIMULATION, rigid->box_max);
+	mem_free(MEM_SIMULATION, rigid->soft_beams);
+	mem_free(MEM_SIMULATION, rigid->rigid_islands);
+	mem_free(MEM_SIMULATION, rigid);
+}
+
+/**
+ * Records an external force that was added to a particle. Call it for every force besides the beam
+ * forces.
+ */
+void rigid_apply_force(model_p model, rigid_p rigid, size_t particle_idx, vec2_t force){
+	rigid_island_p island = &rigid->islands[rigid->particle_island[particle_idx]];
+	island->force = v2_add(island->force, force);
+	island->load += v2_length(force);
+	
+	if (island->rigid) {
+		vec2_t pos = model->particles[particle_idx].pos;
+		float rx = pos.x - island->center_x, ry = pos.y - island->center_y;
+		island->torque += rx * force.y - ry * force.x;
+	}
+}
+
+/**
+ * Called by the simulation step when a beam breaks, possibly from several threads.
+ */
+void rigid_beam_broken(rigid_p rigid){
+	__atomic_store_n(&rigid->rebuild, true, __ATOMIC_RELAXED);
+}
+
+
+//
+// Switching between soft and rigid
+//
+
+// Sum of the forces that deform an island: external forces plus centripetal forces, the latter add up
+// to at most sqrt(mass * inertia) * angular_vel^2.
+static float rigid_total_load(rigid_island_p island, float mass, float inertia, float angular_vel){
+	return island->load + sqrtf(mass * inertia) * angular_vel * angular_vel;
+}
+
+/**
+ * Ends the observation window of a soft island, the next one starts after the backoff.
+ */
+static void rigid_restart_window(rigid_p rigid, rigid_island_p island){
+	island->window_end = 0;
+	island->next_check = rigid->step + island->backoff;
+	if (island->backoff < RIGID_CHECK_INTERVAL_MAX)
+		island->backoff *= 2;
+}
+
+/**
+ * Takes a sample of the observation window of a soft island (starts one if none is running) and
+ * freezes the island at the end of a calm window. Particle forces only contain the external forces at
+ * this point.
+ */
+static void rigid_check_soft(model_p model, rigid_p rigid, rigid_island_p island, float dt){
+	const size_t *indices = rigid->island_particles + island->particle_begin;
+	particle_p particles = model->particles;
+	vec2_t *offsets = rigid->offsets, *box_min = rigid->box_min, *box_max = rigid->box_max;
+	
+	// Mass, center of mass and momentum relative to the first particle to keep the sums small
+	vec2_t origin = particles[indices[0]].pos;
+	double mass = 0, sx = 0, sy = 0, px = 0, py = 0, kinetic = 0;
+	for(size_t k = 0; k < island->particle_count; k++){
+		particle_p p = &particles[indices[k]];
+		mass += p->mass;
+		sx += p->mass * (p->pos.x - origin.x);
+		sy += p->mass * (p->pos.y - origin.y);
+		px += p->mass * p->vel.x;
+		py += p->mass * p->vel.y;
+		kinetic += 0.5 * p->mass * (p->vel.x * p->vel.x + p->vel.y * p->vel.y);
+	}
+	if ( !(mass > 0) )
+		return;
+	double cx = origin.x + sx / mass, cy = origin.y + sy / mass;
+	double vx = px / mass, vy = py / mass;
+	
+	double sxx = 0, syy = 0, sxy = 0, momentum = 0, torque = 0;
+	for(size_t k = 0; k < island->particle_count; k++){
+		particle_p p = &particles[indices[k]];
+		double rx = p->pos.x - cx, ry = p->pos.y - cy;
+		sxx += p->mass * rx * rx;
+		syy += p->mass * ry * ry;
+		sxy += p->mass * rx * ry;
+		momentum += p->mass * (rx * (p->vel.y - vy) - ry * (p->vel.x - vx));
+		torque += rx * p->force.y - ry * p->force.x;
+	}
+	double inertia = sxx + syy;
+	float angular_vel = (inertia > 0) ? momentum / inertia : 0;
+	float radius = sqrtf(inertia / mass);
+	float load = rigid_total_load(island, mass, inertia, angular_vel);
+	
+	// Largest deformation amplitude of the beams: sqrt(x^2 + (v / w)^2) of a harmonic oscillator with
+	// w^2 = k * (1/m1 + 1/m2). Rotation doesn't change beam lengths and isn't part of v.
+	float modulus_times_area = model->modulus_of_elasticity * model->beam_profile_area;
+	float amplitude = 0, stiffness = INFINITY, shortest = INFINITY;
+	double elastic = 0;
+	for(size_t k = 0; k < island->beam_count; k++){
+		beam_p beam = &model->beams[rigid->island_beams[island->beam_begin + k]];
+		if ( (beam->flags & BEAM_BROKEN) || !(beam->length > 0) )
+			continue;
+		
+		particle_p p1 = &particles[beam->i1], p2 = &particles[beam->i2];
+		vec2_t p1_to_p2 = v2_sub(p2->pos, p1->pos);
+		float length = v2_length(p1_to_p2);
+		float spring_constant = modulus_times_area / beam->length;
+		float dilatation = beam->length - length;
+		float rate = (length > 0) ? v2_sprod(v2_sub(p2->vel, p1->vel), p1_to_p2) / length : 0;
+		float omega_squared = spring_constant * (1 / p1->mass + 1 / p2->mass);
+		float beam_amplitude = sqrtf(dilatation * dilatation + rate * rate / omega_squared);
+		elastic += 0.5 * spring_constant * dilatation * dilatation;
+		
+		if (beam_amplitude > amplitude)
+			amplitude = beam_amplitude;
+		if (spring_constant < stiffness)
+			stiffness = spring_constant;
+		if (beam->length < shortest)
+			shortest = beam->length;
+	}
+	island->stiffness = stiffness;
+	
+	// Start a window with the current shape as reference. It lasts RIGID_WINDOW_PERIODS periods of the
+	// slowest stretching mode: a wave running along the island and back, T = 2 * length / c. The length
+	// comes from the largest principal second moment of the mass (exact for a bar), the wave speed
+	// c = sqrt(EA / (m / l)) from the shortest beams and the mean particle mass. In the first period the
+	// vibrations cover their range, in the second one they must not grow any more. Bending modes of
+	// slender islands are far slower (a 200 m truss 6 m wide takes about 140 s), they start when the load
+	// changes and show up as growing vibrations.
+	if (island->window_end == 0) {
+		for(size_t k = 0; k < island->particle_count; k++){
+			size_t i = indices[k];
+			offsets[i] = (vec2_t){ particles[i].pos.x - cx, particles[i].pos.y - cy };
+			box_min[i] = box_max[i] = (vec2_t){ 0, 0 };
+		}
+		
+		float length = sqrt(12 * ((sxx + syy) / 2 + sqrt((sxx - syy) * (sxx - syy) / 4 + sxy * sxy)) / mass);
+		float speed = isinf(shortest) ? 0 : sqrtf(modulus_times_area * shortest * island->particle_count / mass);
+		float period = (speed > 0) ? 2 * length / speed : 0;
+		uint64_t window = RIGID_WINDOW_PERIODS * period / dt;
+		if (window < RIGID_WINDOW_MIN)
+			window = RIGID_WINDOW_MIN;
+		
+		island->check_interval = window / RIGID_WINDOW_SAMPLES;
+		if (island->check_interval < RIGID_CHECK_INTERVAL)
+			island->check_interval = RIGID_CHECK_INTERVAL;
+		if (island->check_interval > RIGID_CHECK_INTERVAL_MAX)
+			island->check_interval = RIGID_CHECK_INTERVAL_MAX;
+		island->window_half = rigid->step + window / 2;
+		island->window_end = rigid->step + window;
+		island->next_check = rigid->step + island->check_interval;
+		island->window_force = island->force;
+		island->window_load = load;
+		island->force_sum = island->force;
+		island->torque_sum = torque;
+		island->samples = 1;
+		return;
+	}
+	
+	// Rotate the island back onto the reference shape by the best fitting angle (mass weighted). The
+	// range each particle covered around its reference position since the start is its vibration.
+	double dot = 0, cross = 0;
+	for(size_t k = 0; k < island->particle_count; k++){
+		size_t i = indices[k];
+		vec2_t o = offsets[i];
+		double rx = particles[i].pos.x - cx, ry = particles[i].pos.y - cy;
+		dot += particles[i].mass * (o.x * rx + o.y * ry);
+		cross += particles[i].mass * (o.x * ry - o.y * rx);
+	}
+	double angle = atan2(cross, dot);
+	float c = cos(angle), s = sin(angle);
+	float vibration = 0;
+	for(size_t k = 0; k < island->particle_count; k++){
+		size_t i = indices[k];
+		float rx = particles[i].pos.x - cx, ry = particles[i].pos.y - cy;
+		float dx = c * rx + s * ry - offsets[i].x, dy = -s * rx + c * ry - offsets[i].y;
+		box_min[i] = (vec2_t){ fminf(box_min[i].x, dx), fminf(box_min[i].y, dy) };
+		box_max[i] = (vec2_t){ fmaxf(box_max[i].x, dx), fmaxf(box_max[i].y, dy) };
+		float range = 0.5 * v2_length(v2_sub(box_max[i], box_min[i]));
+		if (range > vibration)
+			vibration = range;
+	}
+	
+	// The shape only fits the load it settles under, it has to stay within RIGID_LOAD_CHANGE of the load
+	// at the start (like the thaw condition of rigid_check()). Not the torque, thrusters turn with the
+	// vibrations and their lever arms are long. The amplitude already contains the deformation by the
+	// current load.
+	vec2_t body_force = { c * island->force.x + s * island->force.y, -s * island->force.x + c * island->force.y };
+	float allowed = RIGID_LOAD_CHANGE * island->window_load;
+	bool steady = fabsf(load - island->window_load) <= allowed
+		&& v2_length(v2_sub(body_force, island->window_force)) <= allowed;
+	bool calm = steady && amplitude < RIGID_FREEZE_MARGIN * model->deform_threshold
+		&& vibration <= fminf(RIGID_VIBRATION_FRACTION * radius, RIGID_MAX_VIBRATION);
+	
+	island->force_sum = v2_add(island->force_sum, body_force);
+	island->torque_sum += torque;
+	island->samples++;
+	if (calm && island->window_half != 0 && rigid->step >= island->window_half) {
+		island->vibration = vibration;
+		island->window_half = 0;
+	}
+	if (calm && rigid->step >= island->window_end)
+		calm = (vibration <= island->vibration * (1 + RIGID_VIBRATION_GROWTH) + RIGID_SETTLE_DISTANCE);
+	if (!calm) {
+		rigid_restart_window(rigid, island);
+		return;
+	}
+	if (rigid->step < island->window_end) {
+		island->next_check = rigid->step + island->check_interval;
+		return;
+	}
+	
+	// Freeze in the mean shape: the center of each particle's range, moved to the center of mass. The
+	// reference vibrates around it, so the particles stay within the vibration of their reference
+	// position. The energy of the dropped vibrations has to be small compared to that of the island.
+	// Thrusters of a vibrating island push in slightly different directions than in the mean shape, over
+	// long lever arms that adds up. The body keeps the difference between the mean force and torque of
+	// the window and those of the mean shape as bias. The latter are known at the next check, once the
+	// external forces were calculated from the rigid particles.
+	double ox = 0, oy = 0;
+	for(size_t k = 0; k < island->particle_count; k++){
+		size_t i = indices[k];
+		offsets[i] = v2_add(offsets[i], v2_muls(v2_add(box_min[i], box_max[i]), 0.5));
+		ox += particles[i].mass * offsets[i].x;
+		oy += particles[i].mass * offsets[i].y;
+	}
+	ox /= mass;
+	oy /= mass;
+	double frozen_inertia = 0, frozen_torque = 0;
+	for(size_t k = 0; k < island->particle_count; k++){
+		size_t i = indices[k];
+		offsets[i] = (vec2_t){ offsets[i].x - ox, offsets[i].y - oy };
+		frozen_inertia += particles[i].mass * (offsets[i].x * offsets[i].x + offsets[i].y * offsets[i].y);
+		float rx = c * offsets[i].x - s * offsets[i].y, ry = s * offsets[i].x + c * offsets[i].y;
+		frozen_torque += rx * particles[i].force.y - ry * particles[i].force.x;
+	}
+	double frozen_elastic = 0;
+	for(size_t k = 0; k < island->beam_count; k++){
+		beam_p beam = &model->beams[rigid->island_beams[island->beam_begin + k]];
+		if ( (beam->flags & BEAM_BROKEN) || !(beam->length > 0) )
+			continue;
+		float dilatation = beam->length - v2_length(v2_sub(offsets[beam->i2], offsets[beam->i1]));
+		frozen_elastic += 0.5 * modulus_times_area / beam->length * dilatation * dilatation;
+	}
+	float frozen_angular_vel = (frozen_inertia > 0) ? momentum / frozen_inertia : 0;
+	double energy = kinetic + elastic;
+	double frozen_energy = 0.5 * mass * (vx * vx + vy * vy) + 0.5 * momentum * frozen_angular_vel + frozen_elastic;
+	if ( !(fabs(energy - frozen_energy) <= RIGID_ENERGY_DROP * energy) ) {
+		rigid_restart_window(rigid, island);
+		return;
+	}
+	
+	island->rigid = true;
+	island->switched = true;
+	island->rested = false;
+	island->mass = mass;
+	island->inertia = frozen_inertia;
+	island->residual = amplitude;
+	island->frozen_load = rigid_total_load(island, mass, frozen_inertia, frozen_angular_vel);
+	island->frozen_force = body_force;
+	island->frozen_torque = frozen_torque;
+	island->force_bias = v2_sub(v2_divs(island->force_sum, island->samples), body_force);
+	island->torque_bias = island->torque_sum / island->samples - frozen_torque;
+	island->bias_pending = true;
+	island->center_x = cx;
+	island->center_y = cy;
+	island->angle = angle;
+	island->vel = (vec2_t){ vx, vy };
+	island->angular_vel = frozen_angular_vel;
+	island->torque = frozen_torque;
+	island->backoff = RIGID_CHECK_INTERVAL;
+}
+
+/**
+ * Checks the islands begin to end: soft islands that are due for a check are sampled and frozen once
+ * they are calm, rigid islands go back to soft if the external forces or the rotation would deform them.
+ */
+void rigid_check(model_p model, rigid_p rigid, size_t begin, size_t end, float dt){
+	for(size_t i = begin; i < end; i++){
+		rigid_island_p island = &rigid->islands[i];
+		if (island->rigid) {
+			float c = cos(island->angle), s = sin(island->angle);
+			vec2_t body_force = { c * island->force.x + s * island->force.y, -s * island->force.x + c * island->force.y };
+			if (island->bias_pending) {
+				island->force_bias = v2_add(island->force_bias, v2_sub(island->frozen_force, body_force));
+				island->torque_bias += island->frozen_torque - island->torque;
+				island->frozen_force = body_force;
+				island->frozen_torque = island->torque;
+				island->bias_pending = false;
+			}
+			
+			// Worst case: the whole change of the load since freezing goes through the softest beam
+			float load = rigid_total_load(island, island->mass, island->inertia, island->angular_vel);
+			float predicted = island->residual + (isinf(island->stiffness) ? 0 : fabsf(load - island->frozen_load) / island->stiffness);
+			
+			// The shape only fits the load it settled under. Net force (in the body frame), torque and the
+			// sum of all loads have to stay within RIGID_LOAD_CHANGE of it, otherwise bending can move the
+			// particles far more than the beams deform.
+			float radius = (island->mass > 0) ? sqrtf(island->inertia / island->mass) : 0;
+			float allowed = RIGID_LOAD_CHANGE * island->frozen_load;
+			bool load_changed = !( fabsf(load - island->frozen_load) <= allowed
+				&& v2_length(v2_sub(body_force, island->frozen_force)) <= allowed
+				&& fabsf(island->torque - island->frozen_torque) <= allowed * radius );
+			
+			if ( load_changed || !(predicted < RIGID_THAW_MARGIN * model->deform_threshold) ) {
+				island->rigid = false;
+				island->switched = true;
+				island->window_end = 0;
+				island->backoff = RIGID_CHECK_INTERVAL;
+				island->next_check = rigid->step + RIGID_CHECK_INTERVAL;
+			}
+		} else if (rigid->step >= island->next_check) {
+			rigid_check_soft(model, rigid, island, dt);
+		}
+	}
+}
+
+/**
+ * Rebuilds the lists of soft beams and rigid islands after islands switched.
+ */
+void rigid_lists(model_p model, rigid_p rigid){
+	bool outdated = rigid->lists_outdated;
+	for(size_t i = 0; i < rigid->island_count; i++){
+		outdated = outdated || rigid->islands[i].switched;
+		rigid->islands[i].switched = false;
+	}
+	if (!outdated)
+		return;
+	
+	rigid->soft_beam_count = 0;
+	for(size_t i = 0; i < model->beam_count; i++){
+		if ( !rigid->islands[rigid->particle_island[model->beams[i].i1]].rigid )
+			rigid->soft_beams[rigid->soft_beam_count++] = i;
+	}
+	
+	rigid->rigid_island_count = 0;
+	for(size_t i = 0; i < rigid->island_count; i++){
+		if (rigid->islands[i].rigid)
+			rigid->rigid_islands[rigid->rigid_island_count++] = i;
+	}
+	rigid->lists_outdated = false;
+}
+
+
+//
+// Rigid body step
+//
+
+/**
+ * Advances the rigid islands rigid_islands[begin] to rigid_islands[end - 1] by one step and sets the
+ * positions and velocities of their particles. Clears the particle forces like simulate().
+ */
+void rigid_step(model_p model, rigid_p rigid, size_t begin, size_t end, float dt, float *energy_column){
+	for(size_t n = begin; n < end; n++){
+		rigid_island_p island = &rigid->islands[rigid->rigid_islands[n]];
+		
+		float c = cos(island->angle), s = sin(island->angle);
+		vec2_t bias = island->force_bias;
+		island->vel.x += (island->force.x + c * bias.x - s * bias.y) / island->mass * dt;
+		island->vel.y += (island->force.y + s * bias.x + c * bias.y) / island->mass * dt;
+		if (island->inertia > 0)
+			island->angular_vel += (island->torque + island->torque_bias) / island->inertia * dt;
+		island->center_x += island->vel.x * dt;
+		island->center_y += island->vel.y * dt;
+		island->angle = remainder(island->angle + island->angular_vel * dt, 2 * M_PI);
+		
+		// An island at rest stays where it is, its particles only need to be updated once
+		bool resting = (island->load == 0 && island->vel.x == 0 && island->vel.y == 0 && island->angular_vel == 0);
+		if (resting && island->rested) {
+			if (energy_column) {
+				for(size_t k = 0; k < island->particle_count; k++)
+					energy_column[rigid->island_particles[island->particle_begin + k]] = 0;
+			}
+			continue;
+		}
+		island->rested = resting;
+		
+		c = cos(island->angle);
+		s = sin(island->angle);
+		float cx = island->center_x, cy = island->center_y;
+		vec2_t vel = island->vel;
+		float angular_vel = island->angular_vel;
+		const size_t *indices = rigid->island_particles + island->particle_begin;
+		for(size_t k = 0; k < island->particle_count; k++){
+			size_t i = indices[k];
+			particle_p p = &model->particles[i];
+			vec2_t offset = rigid->offsets[i];
+			float rx = c * offset.x - s * offset.y;
+			float ry = s * offset.x + c * offset.y;
+			
+			if (!resting)
+				p->pos = (vec2_t){ cx + rx, cy + ry };
+			p->vel = (vec2_t){ vel.x - angular_vel * ry, vel.y + angular_vel * rx };
+			p->force = (vec2_t){0, 0};
+			if (energy_column) energy_column[i] = 0.5 * p->mass * (p->vel.x * p->vel.x + p->vel.y * p->vel.y);
+		}
+	}
+}
+
+/**
+ * Fills the strain of the beams of rigid islands into a telemetry column, the soft beams are done by
+ * the simulation step.
+ */
+void rigid_strain(model_p model, rigid_p rigid, float *strain_column){
+	for(size_t n = 0; n < rigid->rigid_island_count; n++){
+		rigid_island_p island = &rigid->islands[rigid->rigid_islands[n]];
+		for(size_t k = 0; k < island->beam_count; k++){
+			size_t i = rigid->island_beams[island->beam_begin + k];
+			beam_p beam = &model->beams[i];
+			if (beam->flags & BEAM_BROKEN) {
+				strain_column[i] = NAN;
+				continue;
+			}
+			float length = v2_length( v2_sub(model->particles[beam->i2].pos, model->particles[beam->i1].pos) );
+			strain_column[i] = (beam->length - length) / beam->length;
+		}
+	}
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "math.h"
+#include "model.h"
+
+/**
+
+Rigid body fast path of the simulation. Particles connected by unbroken beams form an island (a ship
+or a piece of debris). As long as no beam of an island gets close to deform_threshold the island
+moves like a rigid body and simulating every spring is wasted work.
+
+Each step simulate_rigid() calls:
+	
+	rigid_p rigid = rigid_update(model);  // rebuilds the islands if the structure changed
+	// apply external forces, report each with rigid_apply_force()
+	rigid_check(model, rigid, 0, rigid->island_count, dt);  // switches islands between soft and rigid
+	rigid_lists(model, rigid);
+	// beam forces of rigid->soft_beams
+	rigid_step(model, rigid, 0, rigid->rigid_island_count, dt, energy_column);
+	// integrate the particles of soft islands
+
+rigid_check() and rigid_step() work on a range of islands and can run in parallel for different ones.
+
+Soft islands are observed over a window of RIGID_WINDOW_PERIODS periods of their slowest stretching
+mode (estimated from their size, mass and beams), sampled about RIGID_WINDOW_SAMPLES times. The shape
+at the start of the window is the reference. Each sample rotates the island back onto it by the best
+fitting angle and extends the range each particle covered around its reference position, half of the
+largest range is the vibration of the island. An undamped island keeps vibrating, so it is only frozen
+if during the whole window:
+
+- the largest deformation amplitude of the beams (current deformation and the part of the vibration
+  still to come) stayed below RIGID_FREEZE_MARGIN * deform_threshold,
+- the vibration stayed below RIGID_VIBRATION_FRACTION of the radius of gyration and RIGID_MAX_VIBRATION
+  (small strains add up to large movements in slender islands, a long truss bends by meters while each
+  beam barely deforms),
+- the vibration grew by less than RIGID_VIBRATION_GROWTH (plus RIGID_SETTLE_DISTANCE) in the second
+  half, slower modes like the bending of slender islands are still building up otherwise,
+- net force (in the window frame) and the sum of all loads stayed within RIGID_LOAD_CHANGE of the load
+  at the start.
+
+Otherwise a new window starts after a backoff that doubles with each failed window. At the end of a
+calm window the island is frozen in its mean shape, the center of the range of each particle. The
+reference vibrates around that shape, so frozen particles stay within the vibration of it. The energy
+of the dropped vibrations (kinetic energy of the vibration and elastic energy beyond that of the mean
+shape) has to be below RIGID_ENERGY_DROP of the energy of the island, otherwise the island stays soft
+for another window. An island starting at rest under thrust only freezes once it moves fast enough.
+Mass, center of mass, velocity and moment of inertia are calculated from the particles and the mean
+shape, the angular velocity from the angular momentum.
+
+A rigid island integrates the net force and torque of the external forces like simulate() integrates
+particles and sets the positions and velocities of its particles from the body state every step.
+Thrusters of a vibrating island push in slightly different directions than those of the mean shape.
+Over long lever arms that adds up to a noticeable torque, so the difference between the mean force and
+torque over the window and those of the mean shape is added as bias. The mean shape only fits the load
+it settled under. Once the net force (in the body frame), the torque or the sum of all loads (external
+and centripetal forces) changed by more than RIGID_LOAD_CHANGE of the load at freezing (e.g. thrusters
+were switched on, the island spins up) or the predicted deformation of the softest beam exceeds
+RIGID_THAW_MARGIN * deform_threshold, the island goes back to the soft body step. Its particles are
+always up to date, so that step continues from a consistent state.
+
+The islands are rebuilt when the model revision changes (all of them start soft again) or a beam
+breaks. Beams only break in soft islands, so rigid islands keep their state in that case. The rigid
+state of a model is kept in model->rigid and freed by model_destroy().
+
+*/
+
+#define RIGID_FREEZE_MARGIN 0.4
+#define RIGID_THAW_MARGIN 0.5
+#define RIGID_VIBRATION_FRACTION 0.02
+#define RIGID_MAX_VIBRATION 0.75  // m
+#define RIGID_VIBRATION_GROWTH 0.25
+#define RIGID_SETTLE_DISTANCE 0.01  // m
+#define RIGID_LOAD_CHANGE 0.05
+#define RIGID_ENERGY_DROP 0.02
+#define RIGID_WINDOW_PERIODS 2
+#define RIGID_WINDOW_SAMPLES 32
+#define RIGID_WINDOW_MIN 64  // steps
+// Steps between samples of a window at least, and before a new window after a failed one (doubled
+// after each failure up to the maximum)
+#define RIGID_CHECK_INTERVAL 8
+#define RIGID_CHECK_INTERVAL_MAX 256
+
+typedef struct {
+	size_t root;  // lowest particle index
+	size_t particle_begin, particle_count;  // range in island_particles
+	size_t beam_begin, beam_count;  // range in island_beams
+	bool rigid, switched;
+	bool rested;  // rigid and at rest since the last step, particles are up to date
+	uint32_t check_interval, backoff;  // steps between samples of the window, before the next window
+	uint64_t next_check, window_half, window_end;  // step, window_end is 0 while no window runs
+	float vibration;  // m, vibration at the middle of the window
+	vec2_t window_force;  // N, net external force in the window frame at the start of the window
+	float window_load;  // N
+	vec2_t force_sum;  // N, sum of the samples of the net force in the window frame
+	double torque_sum;  // Nm
+	uint32_t samples;
+	float stiffness;  // N_m, spring constant of the softest beam
+	
+	// External forces of the current step, reset by rigid_update()
+	vec2_t force;  // N
+	float torque, load;  // Nm around the center of mass (rigid islands only), N sum of all magnitudes
+	
+	// Body state, only valid while rigid
+	float mass, inertia;  // kg, kg_m2
+	float residual;  // m, deformation amplitude of the beams when the island was frozen
+	float frozen_load;  // N, external and centripetal forces when the island was frozen
+	vec2_t frozen_force;  // N, net external force in the body frame when the island was frozen
+	float frozen_torque;  // Nm
+	vec2_t force_bias;  // N, body frame, mean force of the window minus the one of the frozen shape
+	float torque_bias;  // Nm
+	bool bias_pending;  // force and torque of the frozen shape aren't known yet
+	double center_x, center_y, angle;  // m, rad
+	vec2_t vel;  // m_s
+	float angular_vel;  // rad_s
+} rigid_island_t, *rigid_island_p;
+
+struct rigid_s {
+	// Model layout the islands were built for
+	uint32_t revision;
+	size_t particle_count, beam_count;
+	bool rebuild;
+	uint64_t step;
+	
+	size_t island_count;
+	rigid_island_p islands, previous_islands;  // previous ones are kept while rebuilding
+	uint32_t *particle_island;  // island of each particle
+	size_t *island_particles, *island_beams;  // particle and beam indices sorted by island
+	vec2_t *offsets;  // m, body frame position of each particle of a rigid island, reference shape of the window of a soft one
+	vec2_t *box_min, *box_max;  // m, range each particle of a soft island covered around its reference position
+	
+	// Beams of soft islands in model order and the rigid islands. Rebuilt by rigid_lists() when an
+	// island switched. Soft particles are found through particle_island.
+	size_t *soft_beams, *rigid_islands;
+	size_t soft_beam_count, rigid_island_count;
+	bool lists_outdated;
+	
+	// Capacities of the arrays above
+	size_t island_capacity, particle_capacity, beam_capacity;
+};
+
+
+rigid_p rigid_update(model_p model);
+void rigid_destroy(rigid_p rigid);
+void rigid_apply_force(model_p model, rigid_p rigid, size_t particle_idx, vec2_t force);
+void rigid_check(model_p model, rigid_p rigid, size_t begin, size_t end, float dt);
+void rigid_lists(model_p model, rigid_p rigid);
+void rigid_step(model_p model, rigid_p rigid, size_t begin, size_t end, float dt, float *energy_column);
+void rigid_beam_broken(rigid_p rigid);
+void rigid_strain(model_p model, rigid_p rigid, float *strain_column);
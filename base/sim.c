@@ -0,0 +1,439 @@
+#include <stdint.h>
+#include <stdbool.h>
+#define __USE_XOPEN 1
+#include <math.h>
+#include <string.h>
+
+#include "sim.h"
+#include "trace.h"
+#include "profile.h"
+#include "perfcount.h"
+#include "jobs.h"
+#include "alloc.h"
+#include "rigid.h"
+
+
+ssize_t sim_grabbed_particle_idx = -1;
+vec2_t sim_grabbed_force = {0, 0};
+uint8_t sim_enabled_thrusters = 0;
+bool sim_turbo = false;
+uint64_t sim_step = 0;
+telemetry_p sim_telemetry = NULL;
+
+/**
+ * Calculates the force of beam i and deforms or breaks it. Returns false if the beam is broken (then
+ * it exerts no force), otherwise force is the force on its second particle, the first one gets the
+ * opposite.
+ */
+static inline bool sim_beam(model_p model, size_t i, float *strain_column, vec2_t *force_out){
+	float modulus_of_elasticity = model->modulus_of_elasticity; // 210e3; // 210e9; // N_m2 (elastic modulus of steel)
+	float beam_profile_area = model->beam_profile_area; // m2
+	float deform_threshold = model->deform_threshold; // m
+	float break_threshold = model->break_threshold; // m
+	beam_p beam = &model->beams[i];
+	
+	if (beam->flags & BEAM_BROKEN) {
+		if (strain_column) strain_column[i] = NAN;
+		return false;
+	}
+	
+	vec2_t p1_to_p2 = v2_sub(model->particles[beam->i2].pos, model->particles[beam->i1].pos);
+	float p1_to_p2_len = v2_length(p1_to_p2);
+	
+	float dilatation = beam->length - p1_to_p2_len;
+	float spring_constant = (modulus_of_elasticity * beam_profile_area) / beam->length;
+	float force = spring_constant * dilatation;
+	trace_instant(TRACE_DEBUG, "beam", "index length dilatation force", i, beam->length, dilatation, force);
+	if (strain_column) strain_column[i] = dilatation / beam->length;
+	
+	if (dilatation > break_threshold) {
+		beam->flags |= BEAM_BROKEN;
+		__atomic_add_fetch(&model->beam_breaks, 1, __ATOMIC_RELAXED);
+		trace_instant(TRACE_INFO, "beam broken", "index dilatation", i, dilatation);
+		return false;
+	} else if (dilatation > deform_threshold) {
+		beam->length -= force / (modulus_of_elasticity * beam_profile_area) * beam->length;
+		if (beam->length < 0)
+			beam->length = 0;
+		trace_instant(TRACE_DEBUG, "beam deformed", "index length force", i, beam->length, force);
+	}
+	
+	vec2_t p1_to_p2_norm = v2_divs(p1_to_p2, p1_to_p2_len);
+	*force_out = v2_muls(p1_to_p2_norm, force);
+	return true;
+}
+
+/**
+ * Advances particle i by one step and clears its force.
+ */
+static inline void sim_integrate(model_p model, size_t i, float dt, float *energy_column){
+	/*
+	a = f / m;
+	v = v + a * dt;
+	s = s + v * dt;
+	*/
+	particle_p p = &model->particles[i];
+	
+	vec2_t acl;
+	acl.x = p->force.x / p->mass;
+	acl.y = p->force.y / p->mass;
+	p->vel.x += acl.x * dt;
+	p->vel.y += acl.y * dt;
+	p->pos.x += p->vel.x * dt;
+	p->pos.y += p->vel.y * dt;
+	
+	p->force = (vec2_t){0, 0};
+	if (energy_column) energy_column[i] = 0.5 * p->mass * (p->vel.x * p->vel.x + p->vel.y * p->vel.y);
+}
+
+/**
+ * Integrates the particles of a tile and stores their bounding box in model->tile_bounds.
+ */
+static inline void sim_integrate_tile(model_p model, size_t tile, float dt, float *energy_column){
+	size_t begin = tile * MODEL_TILE_SIZE, end = begin + MODEL_TILE_SIZE;
+	if (end > model->particle_count)
+		end = model->particle_count;
+	
+	tile_bounds_t bounds = tile_bounds_empty();
+	for(size_t i = begin; i < end; i++){
+		sim_integrate(model, i, dt, energy_column);
+		tile_bounds_include(&bounds, model->particles[i].pos);
+	}
+	model->tile_bounds[tile] = bounds;
+}
+
+/**
+ * Applies the grab force and the forces of all enabled thrusters. They're reported to rigid unless it's
+ * NULL.
+ */
+static void sim_external_forces(model_p model, rigid_p rigid){
+	prof_begin(PROF_SIM_GRAB);
+	pc_begin(PC_SIM_GRAB);
+	if (sim_grabbed_particle_idx != -1) {
+		model->particles[sim_grabbed_particle_idx].force = v2_add(model->particles[sim_grabbed_particle_idx].force, v2_muls(sim_grabbed_force, 10));
+		if (rigid) rigid_apply_force(model, rigid, sim_grabbed_particle_idx, v2_muls(sim_grabbed_force, 10));
+	}
+	pc_end(PC_SIM_GRAB);
+	prof_end(PROF_SIM_GRAB);
+	
+	// Iterate over all thrusters and apply the thruster force to all connected particles
+	prof_begin(PROF_SIM_THRUSTERS);
+	pc_begin(PC_SIM_THRUSTERS);
+	trace_counter(TRACE_DEBUG, "thrusters", "enabled", sim_enabled_thrusters);
+	for(size_t i = 0; i < model->thruster_count; i++){
+		thruster_p t = &model->thrusters[i];
+		//if (debug) printf("  thruster: cb %02x, et %2x result %d\n", t->controlled_by, sim_enabled_thrusters, (sim_enabled_thrusters & t->controlled_by));
+		if ( !(sim_enabled_thrusters & t->controlled_by) )
+			continue;
+		
+		vec2_t force_dir = v2_norm( v2_sub(model->particles[t->i2].pos, model->particles[t->i1].pos) );
+		float force_mag = t->force;
+		// Turbo only for main thrusters. Otherwise turbo rotation tares the ship apart for sure.
+		if (sim_turbo && (t->controlled_by & THRUSTER_BACK))
+			force_mag *= 5;
+		vec2_t force = v2_muls(force_dir, force_mag);
+		
+		model->particles[t->i1].force = v2_add(model->particles[t->i1].force, force);
+		model->particles[t->i2].force = v2_add(model->particles[t->i2].force, force);
+		if (rigid) {
+			rigid_apply_force(model, rigid, t->i1, force);
+			rigid_apply_force(model, rigid, t->i2, force);
+		}
+	}
+	pc_end(PC_SIM_THRUSTERS);
+	prof_end(PROF_SIM_THRUSTERS);
+}
+
+/**
+ * dt in seconds.
+ */
+void simulate(model_p model, float dt){
+	prof_begin(PROF_SIMULATE);
+	trace_begin(TRACE_INFO, "simulate");
+	trace_instant(TRACE_DEBUG, "step", "dt", dt);
+	// The journal only records edits, the next save has to write the moved particles
+	model_journal_invalidate(model);
+	
+	// Columns of the telemetry sample, NULL if this step isn't captured
+	tlm_sample_p sample = sim_telemetry ? tlm_begin(sim_telemetry, model, sim_step) : NULL;
+	float *strain_column = sample ? sample->beam_strain : NULL;
+	float *energy_column = sample ? sample->particle_energy : NULL;
+	
+	//for(size_t i = 0; i < model->particle_count; i++)
+	//	model->particles[i].force = (vec2_t){0, 0};
+	
+	sim_external_forces(model, NULL);
+	
+	// Iterate all beams and calculate the forces they exert on the particles
+	prof_begin(PROF_SIM_BEAMS);
+	pc_begin(PC_SIM_BEAMS);
+	for(size_t i = 0; i < model->beam_count; i++){
+		vec2_t force;
+		if ( !sim_beam(model, i, strain_column, &force) )
+			continue;
+		
+		beam_p beam = &model->beams[i];
+		model->particles[beam->i1].force = v2_sub(model->particles[beam->i1].force, force);
+		model->particles[beam->i2].force = v2_add(model->particles[beam->i2].force, force);
+	}
+	pc_end(PC_SIM_BEAMS);
+	prof_end(PROF_SIM_BEAMS);
+	
+	// Iterate over all particles to advance to the next time step. Delete all forces afterwards.
+	prof_begin(PROF_SIM_INTEGRATION);
+	pc_begin(PC_SIM_INTEGRATION);
+	model_tile_bounds_reserve(model);
+	for(size_t t = 0; t < model_tile_count(model); t++)
+		sim_integrate_tile(model, t, dt, energy_column);
+	model_tile_bounds_commit(model);
+	pc_end(PC_SIM_INTEGRATION);
+	prof_end(PROF_SIM_INTEGRATION);
+	
+	if (sample)
+		tlm_commit(sim_telemetry, sample);
+	sim_step++;
+	trace_end(TRACE_INFO, "simulate");
+	prof_end(PROF_SIMULATE);
+}
+
+
+//
+// Multithreaded step
+//
+
+// Minimal number of elements per job, about 20 to 40 us of work
+#define SIM_BEAMS_PER_JOB 4096
+#define SIM_PARTICLES_PER_JOB 8192
+#define SIM_ISLANDS_PER_JOB 64
+
+typedef struct {
+	model_p model;
+	rigid_p rigid;
+	float dt;
+	float *strain_column, *energy_column;
+} sim_jobs_t, *sim_jobs_p;
+
+// Forces of the beams calculated in parallel, applied to the particles in beam order afterwards
+static vec2_t *sim_beam_forces = NULL;
+static size_t sim_beam_force_capacity = 0;
+
+static void sim_reserve_beam_forces(size_t count){
+	if (count > sim_beam_force_capacity) {
+		sim_beam_force_capacity = count;
+		sim_beam_forces = mem_realloc(MEM_SIMULATION, sim_beam_forces, sizeof(vec2_t) * sim_beam_force_capacity);
+	}
+}
+
+static void sim_beams_range(size_t begin, size_t end, void *data){
+	sim_jobs_p d = data;
+	for(size_t i = begin; i < end; i++)
+		sim_beam(d->model, i, d->strain_column, &sim_beam_forces[i]);
+}
+
+static void sim_integrate_range(size_t begin, size_t end, void *data){
+	sim_jobs_p d = data;
+	for(size_t t = begin; t < end; t++)
+		sim_integrate_tile(d->model, t, d->dt, d->energy_column);
+}
+
+/**
+ * Same step as simulate() with the beam forces and the integration spread over the job system. Forces
+ * are still added to the particles in beam order by the calling thread, so the result is identical.
+ */
+void simulate_jobs(model_p model, float dt){
+	prof_begin(PROF_SIMULATE);
+	trace_begin(TRACE_INFO, "simulate");
+	trace_instant(TRACE_DEBUG, "step", "dt", dt);
+	model_journal_invalidate(model);
+	
+	tlm_sample_p sample = sim_telemetry ? tlm_begin(sim_telemetry, model, sim_step) : NULL;
+	sim_jobs_t data = { model, NULL, dt, sample ? sample->beam_strain : NULL, sample ? sample->particle_energy : NULL };
+	sim_reserve_beam_forces(model->beam_count);
+	
+	sim_external_forces(model, NULL);
+	
+	prof_begin(PROF_SIM_BEAMS);
+	pc_begin(PC_SIM_BEAMS);
+	job_parallel_for(model->beam_count, SIM_BEAMS_PER_JOB, sim_beams_range, &data);
+	for(size_t i = 0; i < model->beam_count; i++){
+		beam_p beam = &model->beams[i];
+		if (beam->flags & BEAM_BROKEN)
+			continue;
+		model->particles[beam->i1].force = v2_sub(model->particles[beam->i1].force, sim_beam_forces[i]);
+		model->particles[beam->i2].force = v2_add(model->particles[beam->i2].force, sim_beam_forces[i]);
+	}
+	pc_end(PC_SIM_BEAMS);
+	prof_end(PROF_SIM_BEAMS);
+	
+	prof_begin(PROF_SIM_INTEGRATION);
+	pc_begin(PC_SIM_INTEGRATION);
+	model_tile_bounds_reserve(model);
+	job_parallel_for(model_tile_count(model), SIM_PARTICLES_PER_JOB / MODEL_TILE_SIZE, sim_integrate_range, &data);
+	model_tile_bounds_commit(model);
+	pc_end(PC_SIM_INTEGRATION);
+	prof_end(PROF_SIM_INTEGRATION);
+	
+	if (sample)
+		tlm_commit(sim_telemetry, sample);
+	sim_step++;
+	trace_end(TRACE_INFO, "simulate");
+	prof_end(PROF_SIMULATE);
+}
+
+
+//
+// Rigid body fast path
+//
+
+static void sim_rigid_check_range(size_t begin, size_t end, void *data){
+	sim_jobs_p d = data;
+	rigid_check(d->model, d->rigid, begin, end, d->dt);
+}
+
+static void sim_soft_beams_range(size_t begin, size_t end, void *data){
+	sim_jobs_p d = data;
+	for(size_t k = begin; k < end; k++){
+		size_t i = d->rigid->soft_beams[k];
+		bool intact = !(d->model->beams[i].flags & BEAM_BROKEN);
+		if ( !sim_beam(d->model, i, d->strain_column, &sim_beam_forces[k]) && intact )
+			rigid_beam_broken(d->rigid);
+	}
+}
+
+/**
+ * Integrates the soft particles of the tiles, the rigid ones were already moved by rigid_step(). The
+ * bounds include both.
+ */
+static void sim_soft_integrate_range(size_t begin, size_t end, void *data){
+	sim_jobs_p d = data;
+	for(size_t t = begin; t < end; t++){
+		size_t first = t * MODEL_TILE_SIZE, last = first + MODEL_TILE_SIZE;
+		if (last > d->model->particle_count)
+			last = d->model->particle_count;
+		
+		tile_bounds_t bounds = tile_bounds_empty();
+		for(size_t i = first; i < last; i++){
+			if ( !d->rigid->islands[d->rigid->particle_island[i]].rigid )
+				sim_integrate(d->model, i, d->dt, d->energy_column);
+			tile_bounds_include(&bounds, d->model->particles[i].pos);
+		}
+		d->model->tile_bounds[t] = bounds;
+	}
+}
+
+static void sim_rigid_step_range(size_t begin, size_t end, void *data){
+	sim_jobs_p d = data;
+	rigid_step(d->model, d->rigid, begin, end, d->dt, d->energy_column);
+}
+
+/**
+ * Step of simulate_jobs() that moves calm islands as rigid bodies (see rigid.h). Only the beams and
+ * particles of the other islands get the soft body step. While all islands are soft the result is the
+ * same as simulate().
+ */
+void simulate_rigid(model_p model, float dt){
+	prof_begin(PROF_SIMULATE);
+	trace_begin(TRACE_INFO, "simulate");
+	trace_instant(TRACE_DEBUG, "step", "dt", dt);
+	model_journal_invalidate(model);
+	
+	tlm_sample_p sample = sim_telemetry ? tlm_begin(sim_telemetry, model, sim_step) : NULL;
+	rigid_p rigid = rigid_update(model);
+	sim_jobs_t data = { model, rigid, dt, sample ? sample->beam_strain : NULL, sample ? sample->particle_energy : NULL };
+	sim_reserve_beam_forces(model->beam_count);
+	
+	sim_external_forces(model, rigid);
+	
+	prof_begin(PROF_SIM_RIGID);
+	pc_begin(PC_SIM_RIGID);
+	job_parallel_for(rigid->island_count, SIM_ISLANDS_PER_JOB, sim_rigid_check_range, &data);
+	rigid_lists(model, rigid);
+	trace_counter(TRACE_DEBUG, "rigid islands", "count", rigid->rigid_island_count);
+	pc_end(PC_SIM_RIGID);
+	prof_end(PROF_SIM_RIGID);
+	
+	// Without rigid islands the step is the one of simulate_jobs(), without the indirection over the
+	// soft lists
+	bool all_soft = (rigid->rigid_island_count == 0);
+	
+	prof_begin(PROF_SIM_BEAMS);
+	pc_begin(PC_SIM_BEAMS);
+	if (all_soft) {
+		uint32_t breaks = model->beam_breaks;
+		job_parallel_for(model->beam_count, SIM_BEAMS_PER_JOB, sim_beams_range, &data);
+		if (model->beam_breaks != breaks)
+			rigid_beam_broken(rigid);
+	} else {
+		job_parallel_for(rigid->soft_beam_count, SIM_BEAMS_PER_JOB, sim_soft_beams_range, &data);
+	}
+	size_t beam_count = all_soft ? model->beam_count : rigid->soft_beam_count;
+	for(size_t k = 0; k < beam_count; k++){
+		beam_p beam = &model->beams[all_soft ? k : rigid->soft_beams[k]];
+		if (beam->flags & BEAM_BROKEN)
+			continue;
+		model->particles[beam->i1].force = v2_sub(model->particles[beam->i1].force, sim_beam_forces[k]);
+		model->particles[beam->i2].force = v2_add(model->particles[beam->i2].force, sim_beam_forces[k]);
+	}
+	if (data.strain_column)
+		rigid_strain(model, rigid, data.strain_column);
+	pc_end(PC_SIM_BEAMS);
+	prof_end(PROF_SIM_BEAMS);
+	
+	prof_begin(PROF_SIM_INTEGRATION);
+	pc_begin(PC_SIM_INTEGRATION);
+	job_parallel_for(rigid->rigid_island_count, SIM_ISLANDS_PER_JOB, sim_rigid_step_range, &data);
+	model_tile_bounds_reserve(model);
+	job_parallel_for(model_tile_count(model), SIM_PARTICLES_PER_JOB / MODEL_TILE_SIZE, all_soft ? sim_integrate_range : sim_soft_integrate_range, &data);
+	model_tile_bounds_commit(model);
+	pc_end(PC_SIM_INTEGRATION);
+	prof_end(PROF_SIM_INTEGRATION);
+	
+	if (sample)
+		tlm_commit(sim_telemetry, sample);
+	sim_step++;
+	trace_end(TRACE_INFO, "simulate");
+	prof_end(PROF_SIMULATE);
+}
+
+
+closest_particle_t sim_nearest_particle(model_p model, vec2_t pos){
+	size_t closest_idx = 0;
+	float closest_dist = INFINITY;
+	vec2_t to_closest;
+	for(size_t i = 0; i < model->particle_count; i++){
+		vec2_t to_particle = v2_sub(model->particles[i].pos, pos);
+		float dist = v2_length(to_particle);
+		if (dist < closest_dist){
+			closest_idx = i;
+			closest_dist = dist;
+			to_closest = to_particle;
+		}
+	}
+	
+	return (closest_particle_t){ &model->particles[closest_idx], closest_idx, closest_dist, to_closest };
+}
+
+
+//
+// Kernels
+//
+
+// The reference itself is registered to check the harness. It and the multithreaded step have to
+// match exactly. Rigid islands are frozen in the mean shape of their vibrations and drop them, so the
+// particles stay within the vibration of the soft ones. That is at most RIGID_MAX_VIBRATION, the default
+// difftest runs (including the truss cases) stay below 0.5 m. The dropped vibrations are limited to
+// RIGID_ENERGY_DROP of the energy of an island, 5% catches a body step that gains or loses energy.
+sim_kernel_t sim_kernels[] = {
+	{ "reference", simulate, 0, 0, 0, 0 },
+	{ "jobs", simulate_jobs, 0, 0, 0, 0 },
+	{ "rigid", simulate_rigid, 1.0, 0.5, 0, 0.05 },
+};
+size_t sim_kernel_count = sizeof(sim_kernels) / sizeof(sim_kernels[0]);
+
+sim_kernel_p sim_kernel(const char *name){
+	for(size_t i = 0; i < sim_kernel_count; i++){
+		if (strcmp(sim_kernels[i].name, name) == 0)
+			return &sim_kernels[i];
+	}
+	return NULL;
+}
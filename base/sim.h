@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "math.h"
+#include "model.h"
+#include "telemetry.h"
+
+/**
+
+Simulation step of a model. Input state (grabbed particle, enabled thrusters, turbo) is set by the
+main loop through the sim_* globals. The headless runner uses the same step without any window.
+
+simulate_jobs() spreads the per beam and per particle loops over the workers of the job system (see
+jobs.h) and gives exactly the same result as simulate(). simulate_rigid() does the same but moves
+islands whose beams are far from deforming as rigid bodies (see rigid.h).
+
+*/
+
+typedef struct {
+	particle_p particle;
+	size_t index;
+	float dist;
+	vec2_t to_particle;
+} closest_particle_t;
+
+extern ssize_t sim_grabbed_particle_idx;
+extern vec2_t sim_grabbed_force;
+extern uint8_t sim_enabled_thrusters;
+extern bool sim_turbo;
+extern uint64_t sim_step;
+extern telemetry_p sim_telemetry;
+
+
+/**
+ * Alternative implementations of simulate() are registered in sim_kernels with the tolerances they have
+ * to stay within when difftest runs them side by side with the reference simulate().
+ */
+typedef void (*sim_kernel_func_t)(model_p model, float dt);
+
+typedef struct {
+	const char *name;
+	sim_kernel_func_t step;
+	float max_divergence, rms_divergence;  // m, particle positions compared to the reference
+	size_t break_mismatches;  // beams broken in only one of the two models
+	float energy_drift;  // relative difference of the total energy
+} sim_kernel_t, *sim_kernel_p;
+
+extern sim_kernel_t sim_kernels[];
+extern size_t sim_kernel_count;
+
+void simulate(model_p model, float dt);
+void simulate_jobs(model_p model, float dt);
+void simulate_rigid(model_p model, float dt);
+sim_kernel_p sim_kernel(const char *name);
+closest_particle_t sim_nearest_particle(model_p model, vec2_t pos);
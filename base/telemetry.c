@@ -0,0 +1,246 @@
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "telemetry.h"
+#include "alloc.h"
+
+// Memory used by the sample ring, at least tlm_min_slots samples fit in regardless
+static const size_t tlm_ring_bytes = 64 * 1024 * 1024;
+static const size_t tlm_min_slots = 4;
+
+
+// Columns start at the first cache line after the sample header
+static const size_t tlm_header_size = (sizeof(tlm_sample_t) + 63) & ~(size_t)63;
+
+
+static tlm_sample_p tlm_slot(telemetry_p tlm, uint64_t index){
+	return (tlm_sample_p)(tlm->slots + (index % tlm->slot_count) * tlm->slot_size);
+}
+
+
+//
+// Writer thread
+//
+
+typedef struct {
+	float *force;
+	uint8_t *shuffled, *compressed;
+	size_t force_size, shuffled_size, compressed_size;
+} tlm_buffers_t, *tlm_buffers_p;
+
+static void* grow(void *buffer, size_t *size, size_t required){
+	if (*size >= required)
+		return buffer;
+	*size = required;
+	return mem_realloc(MEM_TELEMETRY, buffer, required);
+}
+
+static void tlm_write_column(telemetry_p tlm, tlm_buffers_p buffers, uint32_t field, const float *values, size_t count){
+	uint32_t encoding = 0;
+	uint64_t raw_size = count * sizeof(float), stored_size = raw_size;
+	const void *data = values;
+	
+	if (tlm->compress && count > 0) {
+		// Group the bytes of all floats by significance. Sign and exponent bytes of similar values
+		// are then next to each other and compress a lot better.
+		buffers->shuffled = grow(buffers->shuffled, &buffers->shuffled_size, raw_size);
+		const uint8_t *bytes = (const uint8_t*)values;
+		for(size_t i = 0; i < count; i++){
+			for(size_t b = 0; b < sizeof(float); b++)
+				buffers->shuffled[b * count + i] = bytes[i * sizeof(float) + b];
+		}
+		
+		uLongf compressed_size = compressBound(raw_size);
+		buffers->compressed = grow(buffers->compressed, &buffers->compressed_size, compressed_size);
+		if ( compress2(buffers->compressed, &compressed_size, buffers->shuffled, raw_size, 1) == Z_OK && compressed_size < raw_size ) {
+			encoding = 1;
+			stored_size = compressed_size;
+			data = buffers->compressed;
+		}
+	}
+	
+	fwrite(&field, sizeof(field), 1, tlm->file);
+	fwrite(&encoding, sizeof(encoding), 1, tlm->file);
+	fwrite(&raw_size, sizeof(raw_size), 1, tlm->file);
+	fwrite(&stored_size, sizeof(stored_size), 1, tlm->file);
+	fwrite(data, 1, stored_size, tlm->file);
+}
+
+static void tlm_write_sample(telemetry_p tlm, tlm_buffers_p buffers, tlm_sample_p sample){
+	uint32_t column_count = 0;
+	for(uint32_t field = TLM_BEAM_STRAIN; field <= TLM_PARTICLE_ENERGY; field <<= 1){
+		if (tlm->fields & field)
+			column_count++;
+	}
+	
+	fwrite(&sample->step, sizeof(sample->step), 1, tlm->file);
+	fwrite(&sample->particle_count, sizeof(sample->particle_count), 1, tlm->file);
+	fwrite(&sample->beam_count, sizeof(sample->beam_count), 1, tlm->file);
+	fwrite(&column_count, sizeof(column_count), 1, tlm->file);
+	
+	if (tlm->fields & TLM_BEAM_STRAIN)
+		tlm_write_column(tlm, buffers, TLM_BEAM_STRAIN, sample->beam_strain, sample->beam_count);
+	
+	if (tlm->fields & TLM_BEAM_FORCE) {
+		buffers->force = grow(buffers->force, &buffers->force_size, sizeof(float) * sample->beam_count);
+		for(size_t i = 0; i < sample->beam_count; i++)
+			buffers->force[i] = sample->beam_strain[i] * sample->modulus_times_area;
+		tlm_write_column(tlm, buffers, TLM_BEAM_FORCE, buffers->force, sample->beam_count);
+	}
+	
+	if (tlm->fields & TLM_PARTICLE_ENERGY)
+		tlm_write_column(tlm, buffers, TLM_PARTICLE_ENERGY, sample->particle_energy, sample->particle_count);
+}
+
+static void* tlm_writer_main(void *arg){
+	mem_thread_background();
+	telemetry_p tlm = arg;
+	tlm_buffers_t buffers = { NULL, NULL, NULL, 0, 0, 0 };
+	
+	while (true) {
+		uint64_t head = __atomic_load_n(&tlm->head, __ATOMIC_ACQUIRE);
+		uint64_t tail = tlm->tail;
+		
+		if (tail == head) {
+			if ( __atomic_load_n(&tlm->quit, __ATOMIC_ACQUIRE) )
+				break;
+			nanosleep(&(struct timespec){ 0, 1000 * 1000 }, NULL);
+			continue;
+		}
+		
+		tlm_write_sample(tlm, &buffers, tlm_slot(tlm, tail));
+		__atomic_store_n(&tlm->tail, tail + 1, __ATOMIC_RELEASE);
+	}
+	
+	mem_free(MEM_TELEMETRY, buffers.force);
+	mem_free(MEM_TELEMETRY, buffers.shuffled);
+	mem_free(MEM_TELEMETRY, buffers.compressed);
+	return NULL;
+}
+
+
+//
+// Producer interface (simulation thread)
+//
+
+/**
+ * Opens filename and starts the writer thread. fields is a combination of the TLM_* flags, a sample
+ * is taken every interval steps.
+ */
+telemetry_p tlm_open(const char *filename, uint32_t fields, uint32_t interval, bool compress){
+	FILE *file = fopen(filename, "wb");
+	if (file == NULL){
+		perror("tlm_open: fopen");
+		return NULL;
+	}
+	
+	telemetry_p tlm = malloc(sizeof(telemetry_t));
+	*tlm = (telemetry_t){
+		.fields = fields,
+		.interval = (interval > 0) ? interval : 1,
+		.compress = compress,
+		.file = file,
+		.slots = NULL,
+		.slot_size = 0, .slot_count = 0, .ring_bytes = tlm_ring_bytes,
+		.head = 0, .tail = 0,
+		.particle_count = 0, .beam_count = 0,
+		.quit = false,
+		.captured = 0, .dropped = 0
+	};
+	
+	uint32_t version = 1, compression = compress;
+	fwrite("PHTL", 1, 4, file);
+	fwrite(&version, sizeof(version), 1, file);
+	fwrite(&tlm->fields, sizeof(tlm->fields), 1, file);
+	fwrite(&tlm->interval, sizeof(tlm->interval), 1, file);
+	fwrite(&compression, sizeof(compression), 1, file);
+	
+	pthread_create(&tlm->thread, NULL, tlm_writer_main, tlm);
+	return tlm;
+}
+
+/**
+ * Writes all samples still in the ring, stops the writer thread and closes the file.
+ */
+void tlm_close(telemetry_p tlm){
+	__atomic_store_n(&tlm->quit, true, __ATOMIC_RELEASE);
+	pthread_join(tlm->thread, NULL);
+	fclose(tlm->file);
+	
+	printf("telemetry: %" PRIu64 " samples written, %" PRIu64 " dropped\n", tlm->captured, tlm->dropped);
+	if (tlm->slots)
+		mem_track_free(MEM_TELEMETRY, tlm->slot_size * tlm->slot_count);
+	free(tlm->slots);
+	free(tlm);
+}
+
+/**
+ * Sizes the slots for the particle and beam count of model. Waits until the writer thread took all
+ * samples of the old layout out of the ring. Only happens after edits or loads.
+ */
+static void tlm_layout(telemetry_p tlm, model_p model){
+	while ( __atomic_load_n(&tlm->tail, __ATOMIC_ACQUIRE) != tlm->head )
+		nanosleep(&(struct timespec){ 0, 100 * 1000 }, NULL);
+	
+	if (tlm->slots)
+		mem_track_free(MEM_TELEMETRY, tlm->slot_size * tlm->slot_count);
+	tlm->particle_count = model->particle_count;
+	tlm->beam_count = model->beam_count;
+	
+	// Keep slots cache line aligned
+	tlm->slot_size = (tlm_header_size + sizeof(float) * (tlm->beam_count + tlm->particle_count) + 63) & ~(size_t)63;
+	tlm->slot_count = tlm->ring_bytes / tlm->slot_size;
+	if (tlm->slot_count < tlm_min_slots)
+		tlm->slot_count = tlm_min_slots;
+	
+	free(tlm->slots);
+	if ( posix_memalign((void**)&tlm->slots, 64, tlm->slot_size * tlm->slot_count) != 0 )
+		tlm->slots = NULL;
+	else
+		mem_track_alloc(MEM_TELEMETRY, tlm->slot_size * tlm->slot_count);
+}
+
+/**
+ * Returns the sample to fill for this step or NULL if the step isn't captured. This is the case if
+ * step isn't a multiple of the interval or if the ring is full (the sample is dropped then).
+ */
+tlm_sample_p tlm_begin(telemetry_p tlm, model_p model, uint64_t step){
+	if (step % tlm->interval != 0)
+		return NULL;
+	
+	if (tlm->slots == NULL || model->particle_count != tlm->particle_count || model->beam_count != tlm->beam_count) {
+		tlm_layout(tlm, model);
+		if (tlm->slots == NULL)
+			return NULL;
+	}
+	
+	if ( tlm->head - __atomic_load_n(&tlm->tail, __ATOMIC_ACQUIRE) == tlm->slot_count ){
+		tlm->dropped++;
+		return NULL;
+	}
+	
+	tlm_sample_p sample = tlm_slot(tlm, tlm->head);
+	float *columns = (float*)((uint8_t*)sample + tlm_header_size);
+	*sample = (tlm_sample_t){
+		.step = step,
+		.particle_count = model->particle_count,
+		.beam_count = model->beam_count,
+		.modulus_times_area = model->modulus_of_elasticity * model->beam_profile_area,
+		.beam_strain = columns,
+		.particle_energy = columns + model->beam_count
+	};
+	return sample;
+}
+
+/**
+ * Hands a sample filled by simulate() over to the writer thread.
+ */
+void tlm_commit(telemetry_p tlm, tlm_sample_p sample){
+	(void)sample;
+	__atomic_store_n(&tlm->head, tlm->head + 1, __ATOMIC_RELEASE);
+	tlm->captured++;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <pthread.h>
+#include "model.h"
+
+/**
+
+Telemetry sink that writes per-beam and per-particle time series into a columnar binary file.
+
+simulate() fills a sample directly from its loops: tlm_begin() hands out a free slot of a lock-free
+single producer, single consumer ring buffer (or NULL if this step isn't captured), simulate() writes
+the beam strain and particle kinetic energy into it and tlm_commit() publishes it. A background thread
+takes samples out of the ring, derives the other columns and writes them to disk. If the writer can't
+keep up samples are dropped instead of stalling the simulation.
+
+File format (little endian):
+
+	header: "PHTL" magic, u32 version (1), u32 fields, u32 interval, u32 compression
+	chunk:  u64 step, u32 particle_count, u32 beam_count, u32 column_count
+	        column_count times:
+	        u32 field, u32 encoding, u64 raw_size, u64 stored_size, stored_size bytes of data
+
+Columns are float32 arrays with one value per beam or particle. Broken beams are NaN. With encoding 0
+the data is stored as is, with encoding 1 the bytes of the floats are shuffled into 4 planes and
+compressed with zlib (deflate).
+
+Beam strain is (rest length - current length) / rest length, positive when compressed like in
+simulate(). Beam force is the strain times the modulus of elasticity and the beam profile area.
+
+*/
+
+#define TLM_BEAM_STRAIN		1<<0
+#define TLM_BEAM_FORCE		1<<1
+#define TLM_PARTICLE_ENERGY	1<<2
+
+typedef struct {
+	uint64_t step;
+	uint32_t particle_count, beam_count;
+	float modulus_times_area;
+	// Columns filled by simulate(), point into the slot right after this header
+	float *beam_strain, *particle_energy;
+} tlm_sample_t, *tlm_sample_p;
+
+typedef struct {
+	uint32_t fields, interval;
+	bool compress;
+	FILE *file;
+	
+	// Ring of samples. head is only written by the producer, tail only by the writer thread.
+	uint8_t *slots;
+	size_t slot_size, slot_count, ring_bytes;
+	uint64_t head, tail;
+	size_t particle_count, beam_count;
+	
+	pthread_t thread;
+	bool quit;
+	uint64_t captured, dropped;
+} telemetry_t, *telemetry_p;
+
+
+telemetry_p tlm_open(const char *filename, uint32_t fields, uint32_t interval, bool compress);
+void tlm_close(telemetry_p tlm);
+
+tlm_sample_p tlm_begin(telemetry_p tlm, model_p model, uint64_t step);
+void tlm_commit(telemetry_p tlm, tlm_sample_p sample);
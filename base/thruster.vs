@@ -1,12 +1,30 @@
 #version 120
+#extension GL_ARB_uniform_buffer_object : require
 
-// vertex and cursor positions in screen space
+// Per frame data of the renderer, see frame_uniforms_t in renderer.c
+layout(std140) uniform frame_uniforms {
+	mat3 world_to_normal;
+	mat3 screen_to_normal;
+	vec2 screen_size;
+	float scale_exp;
+};
+
+// vertex of the thruster shape, one thruster per instance (positions of both particles in world space
+// and color)
 attribute vec2 pos;
+attribute vec4 instance_ends;
+attribute vec4 instance_color;
 
-uniform mat3 transform;
-uniform mat3 to_norm;
+varying vec4 color;
 
 void main(){
-	gl_Position.xyz = (to_norm * transform) * vec3(pos, 1);
+	// Centered between the particles and rotated to point from the first to the second one
+	vec2 p1_to_p2 = instance_ends.zw - instance_ends.xy;
+	vec2 center = instance_ends.xy + p1_to_p2 * 0.5;
+	vec2 dir = (length(p1_to_p2) > 0) ? normalize(p1_to_p2) : vec2(1, 0);
+	vec2 rotated = vec2(dir.x * pos.x - dir.y * pos.y, dir.y * pos.x + dir.x * pos.y);
+	
+	gl_Position.xyz = world_to_normal * vec3(center + rotated, 1);
 	gl_Position.w = 1;
+	color = instance_color;
 }
\ No newline at end of file
@@ -0,0 +1,302 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+
+bool trace_enabled = false;
+size_t trace_buffer_events = 256 * 1024;
+
+typedef struct trace_buffer_s {
+	trace_event_p events;
+	size_t capacity;  // power of two
+	uint64_t head;  // number of events ever recorded, only written by the owning thread
+	uint32_t thread_id;
+	struct trace_buffer_s *next;
+} trace_buffer_t, *trace_buffer_p;
+
+// List of all thread buffers. Buffers of finished threads are kept so their events can be exported.
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static trace_buffer_p trace_buffers = NULL;
+static uint32_t trace_thread_count = 0;
+static __thread trace_buffer_p trace_local = NULL;
+
+
+static trace_buffer_p trace_register(){
+	size_t capacity = 1;
+	while (capacity < trace_buffer_events)
+		capacity *= 2;
+	
+	trace_buffer_p buffer = malloc(sizeof(trace_buffer_t));
+	buffer->events = malloc(sizeof(trace_event_t) * capacity);
+	buffer->capacity = capacity;
+	buffer->head = 0;
+	
+	pthread_mutex_lock(&trace_mutex);
+	buffer->thread_id = ++trace_thread_count;
+	buffer->next = trace_buffers;
+	trace_buffers = buffer;
+	pthread_mutex_unlock(&trace_mutex);
+	
+	trace_local = buffer;
+	return buffer;
+}
+
+static trace_event_p trace_next(trace_buffer_p *buffer_ptr){
+	trace_buffer_p buffer = trace_local ? trace_local : trace_register();
+	*buffer_ptr = buffer;
+	
+	trace_event_p event = &buffer->events[buffer->head & (buffer->capacity - 1)];
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	event->timestamp = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	return event;
+}
+
+static void trace_publish(trace_buffer_p buffer){
+	__atomic_store_n(&buffer->head, buffer->head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Records an event in the ring of the calling thread. Use the trace_* macros instead of calling this
+ * directly, they remove events above TRACE_LEVEL at compile time.
+ */
+void trace_record(trace_type_t type, uint8_t level, const char *name, const char *arg_names, const float *args, size_t arg_count){
+	trace_buffer_p buffer;
+	trace_event_p event = trace_next(&buffer);
+	
+	if (arg_count > TRACE_MAX_ARGS)
+		arg_count = TRACE_MAX_ARGS;
+	event->name = name;
+	event->arg_names = arg_names;
+	event->type = type;
+	event->level = level;
+	event->arg_count = arg_count;
+	event->text[0] = '\0';
+	for(size_t i = 0; i < arg_count; i++)
+		event->args[i] = args[i];
+	
+	trace_publish(buffer);
+}
+
+void trace_record_text(uint8_t level, const char *name, const char *format, ...){
+	trace_buffer_p buffer;
+	trace_event_p event = trace_next(&buffer);
+	
+	event->name = name;
+	event->arg_names = NULL;
+	event->type = TRACE_INSTANT;
+	event->level = level;
+	event->arg_count = 0;
+	
+	va_list args;
+	va_start(args, format);
+	vsnprintf(event->text, TRACE_TEXT_SIZE, format, args);
+	va_end(args);
+	
+	trace_publish(buffer);
+}
+
+/**
+ * Drops all recorded events. Only call this while no other thread records events.
+ */
+void trace_clear(){
+	pthread_mutex_lock(&trace_mutex);
+	for(trace_buffer_p buffer = trace_buffers; buffer != NULL; buffer = buffer->next)
+		__atomic_store_n(&buffer->head, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+
+//
+// Export
+//
+
+// Index of the oldest event still in the ring
+static uint64_t trace_first(trace_buffer_p buffer, uint64_t head){
+	return (head > buffer->capacity) ? head - buffer->capacity : 0;
+}
+
+// Copies the nth space separated name of names into buffer
+static const char* trace_arg_name(const char *names, size_t n, char *buffer, size_t size){
+	const char *start = names;
+	for(size_t i = 0; i < n && start != NULL; i++){
+		start = strchr(start, ' ');
+		if (start) start++;
+	}
+	if (start == NULL || *start == '\0'){
+		snprintf(buffer, size, "arg%zu", n);
+		return buffer;
+	}
+	
+	size_t len = strcspn(start, " ");
+	if (len >= size)
+		len = size - 1;
+	memcpy(buffer, start, len);
+	buffer[len] = '\0';
+	return buffer;
+}
+
+static void trace_json_string(FILE *file, const char *text){
+	fputc('"', file);
+	for(const char *c = text; *c != '\0'; c++){
+		if (*c == '"' || *c == '\\')
+			fprintf(file, "\\%c", *c);
+		else if ((unsigned char)*c < 0x20)
+			fprintf(file, "\\u%04x", *c);
+		else
+			fputc(*c, file);
+	}
+	fputc('"', file);
+}
+
+/**
+ * Writes all events in the Chrome trace event format. Events recorded by other threads while exporting
+ * may show up garbled, so export while the other threads are idle or tracing is disabled.
+ */
+bool trace_export_json(const char *filename){
+	FILE *file = fopen(filename, "w");
+	if (file == NULL){
+		perror("trace_export_json: fopen");
+		return false;
+	}
+	
+	const char phases[] = { [TRACE_INSTANT] = 'i', [TRACE_BEGIN] = 'B', [TRACE_END] = 'E', [TRACE_COUNTER] = 'C' };
+	size_t event_count = 0;
+	char arg_name[64];
+	
+	fprintf(file, "{\"traceEvents\":[\n");
+	pthread_mutex_lock(&trace_mutex);
+	for(trace_buffer_p buffer = trace_buffers; buffer != NULL; buffer = buffer->next){
+		uint64_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+		for(uint64_t i = trace_first(buffer, head); i < head; i++){
+			trace_event_p e = &buffer->events[i & (buffer->capacity - 1)];
+			
+			fprintf(file, "%s{\"name\":", (event_count > 0) ? ",\n" : "");
+			trace_json_string(file, e->name);
+			fprintf(file, ",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u", phases[e->type], e->timestamp / 1000.0, buffer->thread_id);
+			if (e->type == TRACE_INSTANT)
+				fprintf(file, ",\"s\":\"t\"");
+			
+			if (e->arg_count > 0 || e->text[0] != '\0'){
+				fprintf(file, ",\"args\":{");
+				for(size_t j = 0; j < e->arg_count; j++){
+					fprintf(file, "%s", (j > 0) ? "," : "");
+					trace_json_string(file, trace_arg_name(e->arg_names ? e->arg_names : "", j, arg_name, sizeof(arg_name)));
+					// JSON has no representation for NaN and infinity
+					if ( isfinite(e->args[j]) )
+						fprintf(file, ":%g", e->args[j]);
+					else
+						fprintf(file, ":\"%g\"", e->args[j]);
+				}
+				if (e->text[0] != '\0'){
+					fprintf(file, "%s\"text\":", (e->arg_count > 0) ? "," : "");
+					trace_json_string(file, e->text);
+				}
+				fprintf(file, "}");
+			}
+			
+			fprintf(file, "}");
+			event_count++;
+		}
+	}
+	pthread_mutex_unlock(&trace_mutex);
+	fprintf(file, "\n]}\n");
+	
+	fclose(file);
+	printf("exported %zu trace events to %s\n", event_count, filename);
+	return true;
+}
+
+// Assigns ids to name strings, names are literals so the pointer identifies them
+typedef struct {
+	const char **strings;
+	size_t count, size;
+} trace_strings_t;
+
+static uint32_t trace_string_id(trace_strings_t *table, const char *string){
+	if (string == NULL)
+		return UINT32_MAX;
+	
+	for(size_t i = 0; i < table->count; i++){
+		if (table->strings[i] == string)
+			return i;
+	}
+	
+	if (table->count == table->size){
+		table->size = (table->size == 0) ? 64 : table->size * 2;
+		table->strings = realloc(table->strings, sizeof(const char*) * table->size);
+	}
+	table->strings[table->count] = string;
+	return table->count++;
+}
+
+/**
+ * Writes all events in a compact binary format (little endian):
+ * 
+ * 	header:  "PHTR" magic, u32 version (1), u64 offset of the string table, u32 thread count
+ * 	thread:  u32 thread id, u64 event count, events
+ * 	event:   u64 timestamp (ns), u32 name id, u32 arg names id (0xffffffff if none), u8 type, u8 level,
+ * 	         u8 arg count, u8 text length, arg count floats, text length chars
+ * 	strings: u32 count, count times u32 length and length chars
+ */
+bool trace_export_binary(const char *filename){
+	FILE *file = fopen(filename, "wb");
+	if (file == NULL){
+		perror("trace_export_binary: fopen");
+		return false;
+	}
+	
+	trace_strings_t table = { NULL, 0, 0 };
+	uint32_t version = 1, thread_count = 0;
+	uint64_t string_table_offset = 0;
+	
+	pthread_mutex_lock(&trace_mutex);
+	for(trace_buffer_p buffer = trace_buffers; buffer != NULL; buffer = buffer->next)
+		thread_count++;
+	
+	fwrite("PHTR", 1, 4, file);
+	fwrite(&version, sizeof(version), 1, file);
+	fwrite(&string_table_offset, sizeof(string_table_offset), 1, file);
+	fwrite(&thread_count, sizeof(thread_count), 1, file);
+	
+	for(trace_buffer_p buffer = trace_buffers; buffer != NULL; buffer = buffer->next){
+		uint64_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+		uint64_t first = trace_first(buffer, head), event_count = head - first;
+		fwrite(&buffer->thread_id, sizeof(buffer->thread_id), 1, file);
+		fwrite(&event_count, sizeof(event_count), 1, file);
+		
+		for(uint64_t i = first; i < head; i++){
+			trace_event_p e = &buffer->events[i & (buffer->capacity - 1)];
+			uint32_t ids[2] = { trace_string_id(&table, e->name), trace_string_id(&table, e->arg_names) };
+			uint8_t bytes[4] = { e->type, e->level, e->arg_count, strlen(e->text) };
+			fwrite(&e->timestamp, sizeof(e->timestamp), 1, file);
+			fwrite(ids, sizeof(ids), 1, file);
+			fwrite(bytes, sizeof(bytes), 1, file);
+			fwrite(e->args, sizeof(float), e->arg_count, file);
+			fwrite(e->text, 1, bytes[3], file);
+		}
+	}
+	pthread_mutex_unlock(&trace_mutex);
+	
+	string_table_offset = ftell(file);
+	uint32_t string_count = table.count;
+	fwrite(&string_count, sizeof(string_count), 1, file);
+	for(size_t i = 0; i < table.count; i++){
+		uint32_t len = strlen(table.strings[i]);
+		fwrite(&len, sizeof(len), 1, file);
+		fwrite(table.strings[i], 1, len, file);
+	}
+	
+	fseek(file, 8, SEEK_SET);
+	fwrite(&string_table_offset, sizeof(string_table_offset), 1, file);
+	
+	fclose(file);
+	free(table.strings);
+	return true;
+}
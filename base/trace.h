@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+
+Low overhead tracing for diagnostics in hot loops.
+
+Events are only recorded while trace_enabled is set. Each thread records into its own ring buffer
+without locking. When a ring is full the oldest events are overwritten (flight recorder). Export the
+rings as Chrome trace JSON (chrome://tracing, Perfetto) or in a compact binary format.
+
+Events with a level above TRACE_LEVEL are removed at compile time, including the evaluation of their
+arguments. Build with e.g. -DTRACE_LEVEL=0 to remove all tracing.
+
+Arguments are floats, their names are given as one space separated string:
+
+	trace_instant(TRACE_DEBUG, "beam", "length dilatation force", beam->length, dilatation, force);
+	trace_begin(TRACE_INFO, "simulate");
+	trace_end(TRACE_INFO, "simulate");
+
+Names and argument names must be string literals (only the pointers are stored). trace_text() formats
+its text like printf() into the event, it's truncated to TRACE_TEXT_SIZE - 1 chars.
+
+*/
+
+#define TRACE_INFO		1
+#define TRACE_DEBUG		2
+#define TRACE_VERBOSE	3
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_DEBUG
+#endif
+
+#define TRACE_MAX_ARGS 6
+#define TRACE_TEXT_SIZE 48
+
+typedef enum { TRACE_INSTANT, TRACE_BEGIN, TRACE_END, TRACE_COUNTER } trace_type_t;
+
+typedef struct {
+	uint64_t timestamp;  // ns, monotonic clock
+	const char *name, *arg_names;
+	float args[TRACE_MAX_ARGS];
+	uint8_t type, level, arg_count;
+	char text[TRACE_TEXT_SIZE];
+} trace_event_t, *trace_event_p;
+
+extern bool trace_enabled;
+// Events per thread ring, only read when a thread records its first event
+extern size_t trace_buffer_events;
+
+void trace_record(trace_type_t type, uint8_t level, const char *name, const char *arg_names, const float *args, size_t arg_count);
+void trace_record_text(uint8_t level, const char *name, const char *format, ...) __attribute__ ((format (printf, 3, 4)));
+void trace_clear();
+bool trace_export_json(const char *filename);
+bool trace_export_binary(const char *filename);
+
+#define trace_event_(type, level, name, arg_names, ...) do { \
+	if ( (level) <= TRACE_LEVEL && trace_enabled ) { \
+		const float trace_args_[] = { 0, ##__VA_ARGS__ }; \
+		trace_record(type, level, name, arg_names, trace_args_ + 1, sizeof(trace_args_) / sizeof(float) - 1); \
+	} \
+} while(0)
+
+#define trace_instant(level, name, arg_names, ...) trace_event_(TRACE_INSTANT, level, name, arg_names, ##__VA_ARGS__)
+#define trace_counter(level, name, arg_names, ...) trace_event_(TRACE_COUNTER, level, name, arg_names, ##__VA_ARGS__)
+#define trace_begin(level, name) trace_event_(TRACE_BEGIN, level, name, NULL)
+#define trace_end(level, name) trace_event_(TRACE_END, level, name, NULL)
+
+#define trace_text(level, name, ...) do { \
+	if ( (level) <= TRACE_LEVEL && trace_enabled ) \
+		trace_record_text(level, name, __VA_ARGS__); \
+} while(0)
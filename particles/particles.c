@@ -19,6 +19,9 @@
 #include <GL/gl.h>
 #include <GL/glext.h>
 
+#include "../base/alloc.h"
+#include "../base/jobs.h"
+
 
 GLuint prog;
 GLuint vertex_shader;
@@ -38,7 +41,7 @@ typedef struct {
 } entity_t, *entity_p;
 
 entity_t *entities;
-size_t entity_count;
+size_t entity_count, entity_capacity;
 
 
 typedef struct {
@@ -189,7 +192,7 @@ void renderer_init(uint16_t window_width, uint16_t window_height, const char *ti
 	glUseProgram(prog);
 	
 	
-
+	
 	glGenBuffers(1, &vertex_buffer);
 	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
 	
@@ -218,11 +221,26 @@ void renderer_shutdown(){
 }
 
 
+/**
+ * Makes room for count entities. The capacity is at least doubled so spawning doesn't realloc every
+ * frame.
+ */
+void entities_reserve(size_t count){
+	if (count <= entity_capacity)
+		return;
+	
+	size_t capacity = (entity_capacity < 64) ? 64 : entity_capacity;
+	while (capacity < count)
+		capacity *= 2;
+	entities = mem_realloc(MEM_PARTICLES, entities, sizeof(entity_t) * capacity);
+	entity_capacity = capacity;
+}
+
 void build_world(){
 	srand(9);
 	
 	entity_count = 2500;
-	entities = realloc(entities, sizeof(entity_t) * entity_count);
+	entities_reserve(entity_count);
 	for(size_t i = 0; i < entity_count; i++){
 		entities[i].pos.x = (rand() / (float)RAND_MAX) * 500;
 		entities[i].pos.y = (rand() / (float)RAND_MAX) * 200;
@@ -234,7 +252,7 @@ void build_world(){
 	}
 	
 	attractor_count = 3;
-	attractors = realloc(attractors, sizeof(attractor_t) * attractor_count);
+	attractors = mem_realloc(MEM_PARTICLES, attractors, sizeof(attractor_t) * attractor_count);
 	for(size_t i = 0; i < attractor_count; i++){
 		attractors[i].pos.x = (win_w / 4) + (rand() / (float)RAND_MAX) * (win_w / 2);
 		attractors[i].pos.y = (win_h / 4) + (rand() / (float)RAND_MAX) * (win_h / 2);
@@ -242,7 +260,7 @@ void build_world(){
 	}
 	
 	emiter_count = 1;
-	emiters = realloc(emiters, sizeof(emiter_t) * emiter_count);
+	emiters = mem_realloc(MEM_PARTICLES, emiters, sizeof(emiter_t) * emiter_count);
 	emiters[0] = (emiter_t){
 		.pos = (vec_t){10, 10},
 		.vel = (vec_t){10, 10},
@@ -251,34 +269,20 @@ void build_world(){
 		.min_mass = 2.5, .max_mass = 10,
 		.min_ttl = 10, .max_ttl = 25
 	};
+	
+	// Room for everything the emiters spawn before the first entities die, so the steady state of
+	// simulate() doesn't allocate
+	size_t steady_count = entity_count;
+	for(size_t i = 0; i < emiter_count; i++)
+		steady_count += (size_t)(emiters[i].spawn_rate / cycle_duration) * (emiters[i].max_ttl * 1000 / cycle_duration + 1);
+	entities_reserve(steady_count);
 }
 
-void simulate(float dt){
-	// Emit new entities
-	for(size_t i = 0; i < emiter_count; i++){
-		emiter_p em = emiters + i;
-		size_t to_spawn_count = em->spawn_rate / cycle_duration;
-		
-		entities = realloc(entities, sizeof(entity_t) * (entity_count + to_spawn_count));
-		for(size_t j = entity_count; j < entity_count + to_spawn_count; j++){
-			entities[j] = (entity_t){
-				.pos = (vec_t){
-					.x = em->pos.x + (rand() / (float)RAND_MAX) * 100 - 50,
-					.y = em->pos.y + (rand() / (float)RAND_MAX) * 100 - 50
-				},
-				.vel = em->vel,
-				.force = (vec_t){0, 0},
-				.mass = em->min_mass + (rand() / (float)RAND_MAX) * (em->max_mass - em->min_mass),
-				.color = em->color,
-				.ttl = em->min_ttl + (rand() / (float)RAND_MAX) * (em->max_ttl - em->min_ttl)
-			};
-		}
-		
-		entity_count += to_spawn_count;
-	}
-	
-	// Apply attractor forces to each entity
-	for(size_t i = 0; i < entity_count; i++){
+// Entities per job, below that the jobs cost more than they save
+#define ENTITIES_PER_JOB 1024
+
+static void apply_attractors(size_t begin, size_t end, void *data){
+	for(size_t i = begin; i < end; i++){
 		entities[i].force = (vec_t){0, 0};
 		
 		for(size_t j = 0; j < attractor_count; j++){
@@ -293,14 +297,14 @@ void simulate(float dt){
 			}
 		}
 	}
-	
-	// Advance entities
-	ssize_t life_i = -1; // index of least alive entity
-	for(entity_p e = entities; e < entities + entity_count; e++){
+}
+
+static void advance_entities(size_t begin, size_t end, void *data){
+	float dt = *(float*)data;
+	for(entity_p e = entities + begin; e < entities + end; e++){
 		e->ttl -= dt;
 		if (e->ttl < 0)
 			continue;
-		life_i++;
 		
 		/*
 		a = f / m;
@@ -314,13 +318,48 @@ void simulate(float dt){
 		e->vel.y += acl.y * dt;
 		e->pos.x += e->vel.x * dt;
 		e->pos.y += e->vel.y * dt;
+	}
+}
+
+void simulate(float dt){
+	// Emit new entities
+	for(size_t i = 0; i < emiter_count; i++){
+		emiter_p em = emiters + i;
+		size_t to_spawn_count = em->spawn_rate / cycle_duration;
+		
+		entities_reserve(entity_count + to_spawn_count);
+		for(size_t j = entity_count; j < entity_count + to_spawn_count; j++){
+			entities[j] = (entity_t){
+				.pos = (vec_t){
+					.x = em->pos.x + (rand() / (float)RAND_MAX) * 100 - 50,
+					.y = em->pos.y + (rand() / (float)RAND_MAX) * 100 - 50
+				},
+				.vel = em->vel,
+				.force = (vec_t){0, 0},
+				.mass = em->min_mass + (rand() / (float)RAND_MAX) * (em->max_mass - em->min_mass),
+				.color = em->color,
+				.ttl = em->min_ttl + (rand() / (float)RAND_MAX) * (em->max_ttl - em->min_ttl)
+			};
+		}
 		
+		entity_count += to_spawn_count;
+	}
+	
+	// Apply attractor forces to each entity and advance them, both in parallel on the job system
+	job_parallel_for(entity_count, ENTITIES_PER_JOB, apply_attractors, NULL);
+	job_parallel_for(entity_count, ENTITIES_PER_JOB, advance_entities, &dt);
+	
+	// Move the living entities together, serial to keep their order
+	ssize_t life_i = -1; // index of least alive entity
+	for(entity_p e = entities; e < entities + entity_count; e++){
+		if (e->ttl < 0)
+			continue;
+		life_i++;
 		entities[life_i] = *e;
 	}
 	
-	// Clean up old particles with a time to live < 0
+	// Clean up old particles with a time to live < 0, the capacity is kept for the next spawns
 	entity_count = life_i + 1;
-	entities = realloc(entities, sizeof(entity_t) * entity_count);
 }
 
 void draw(){
@@ -399,6 +438,8 @@ void draw(){
 
 
 int main(int argc, char **argv){
+	// JOBS sets the number of threads (default one per CPU), JOB_PIN pins them to CPUs
+	job_start(getenv("JOBS") ? strtoul(getenv("JOBS"), NULL, 10) : 0, getenv("JOB_PIN") != NULL);
 	SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER);
 	renderer_init(win_w, win_h, "GL Basics");
 	
@@ -410,9 +451,14 @@ int main(int argc, char **argv){
 	SDL_Event e;
 	bool quit = false;
 	uint32_t ticks = SDL_GetTicks();
+	// Set MEM_ASSERT to abort when drawing or simulating allocates without any input in between
+	bool mem_assert = (getenv("MEM_ASSERT") != NULL);
+	uint32_t steady_frames = 0;
 	
 	while (!quit) {
 		while ( SDL_PollEvent(&e) ) {
+			if (e.type != SDL_MOUSEMOTION)
+				steady_frames = 0;
 			//printf("event %d\n", e.type);
 			switch(e.type){
 				case SDL_QUIT:
@@ -484,8 +530,8 @@ int main(int argc, char **argv){
 							cursor_active = false;
 							break;
 						case SDL_BUTTON_RIGHT:
+							entities_reserve(entity_count + cursor_spawn_num);
 							entity_count += cursor_spawn_num;
-							entities = realloc(entities, sizeof(entity_t) * entity_count);
 							for(size_t i = entity_count - cursor_spawn_num - 1; i < entity_count; i++){
 								entities[i] = (entity_t){
 									.pos = (vec_t){
@@ -509,9 +555,11 @@ int main(int argc, char **argv){
 			}
 		}
 		
+		mem_frame_begin();
 		draw();
 		SDL_GL_SwapBuffers();
 		simulate(cycle_duration / 1000.0);
+		mem_frame_end(mem_assert && steady_frames++ >= 2);
 		
 		int32_t duration = cycle_duration - (SDL_GetTicks() - ticks);
 		if (duration > 0)
@@ -523,5 +571,6 @@ int main(int argc, char **argv){
 	renderer_shutdown();
 	
 	SDL_Quit();
+	job_stop();
 	return 0;
 }
\ No newline at end of file